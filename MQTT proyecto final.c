@@ -1,208 +1,476 @@
-#include <stdio.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/event_groups.h"
-#include "esp_log.h"
-#include "driver/gpio.h"
-#include "mqtt_client.h"
-#include "esp_wifi.h"
-#include "esp_event.h"
-#include "nvs_flash.h"
-#include "esp_netif.h"
-
-//*************************** Definiciones ***************************//
-#define TAG "Proyecto Final"
-#define WIFI_SSID "Nexxt"
-#define WIFI_PASSWORD "ab123456cd"
-#define WIFI_CONNECTED_BIT BIT0
-#define CONFIG_BROKER_URL "mqtt://broker.hivemq.com"
-
-// GPIO
-#define SPP_BUTTON GPIO_NUM_23
-#define LED0 GPIO_NUM_2
-
-// Lógica del GPIO
-#define LOGICA_NEGATIVA 0
-#define LOGICA_POSITIVA 1
-#define LOGICA LOGICA_NEGATIVA // Cambiar a LOGICA_POSITIVA si se requiere lógica positiva
-
-// Estados
-enum { ESTADO_0 = 0, ESTADO_1, ESTADO_2, ESTADO_3, ESTADO_4 };
-uint8_t estado_actual = ESTADO_0; // Estado actual de la máquina de estado.
-uint8_t estado_anterior = 99; // Se asegura que al inicio se registre un cambio.
-
-//*************************** Variables globales ***************************//
-static EventGroupHandle_t wifi_event_group;
-static uint8_t spp_button_pressed = 0; // Indica si el botón físico fue presionado.
-static uint8_t spp_button_mqtt = 0; // Indica si se recibió un comando desde MQTT.
-
-//*************************** Funciones ***************************//
-
-// Inicialización del GPIO
-void inicializar_gpio(void) {
-    gpio_reset_pin(SPP_BUTTON);
-    gpio_set_direction(SPP_BUTTON, GPIO_MODE_INPUT);
-    gpio_set_pull_mode(SPP_BUTTON, GPIO_PULLUP_ONLY);
-
-    gpio_reset_pin(LED0);
-    gpio_set_direction(LED0, GPIO_MODE_OUTPUT);
-
-    ESP_LOGI(TAG, "GPIO inicializado con lógica %s",
-             (LOGICA == LOGICA_NEGATIVA) ? "negativa" : "positiva");
-}
-
-// Conexión Wi-Fi
-static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(TAG, "Reintentando conexión Wi-Fi...");
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG, "Conexión Wi-Fi establecida, IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    }
-}
-
-void wifi_init_sta(void) {
-    wifi_event_group = xEventGroupCreate();
-
-    esp_netif_init();
-    esp_event_loop_create_default();
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
-
-    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, NULL);
-    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, NULL);
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASSWORD,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
-    };
-
-    esp_wifi_set_mode(WIFI_MODE_STA);
-    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-    esp_wifi_start();
-
-    ESP_LOGI(TAG, "Intentando conectar a Wi-Fi...");
-}
-
-// Manejo de eventos MQTT
-static void mqtt_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    esp_mqtt_event_handle_t event = event_data;
-    switch (event->event_id) {
-        case MQTT_EVENT_CONNECTED:
-            esp_mqtt_client_subscribe(event->client, "/2022-1143/SPP", 1);
-            break;
-
-        case MQTT_EVENT_DATA:
-            if (strncmp(event->topic, "/2022-1143/SPP", event->topic_len) == 0) {
-                if (strncmp(event->data, "1", event->data_len) == 0) {
-                    spp_button_mqtt = 1;
-                }
-            }
-            break;
-
-        default:
-            break;
-    }
-}
-
-void mqtt_init(void) {
-    esp_mqtt_client_config_t mqtt_config = {
-        .broker.address.uri = CONFIG_BROKER_URL,
-    };
-
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_config);
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, &mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
-}
-
-// Máquina de estados
-void maquina_estado_task(void *arg) {
-    while (1) {
-        if (!spp_button_pressed) {
-            if (gpio_get_level(SPP_BUTTON) == LOGICA) {
-                spp_button_pressed = 1;
-                estado_actual = (estado_actual + 1) % 5;
-            } else if (spp_button_mqtt) {
-                spp_button_mqtt = 0;
-                estado_actual = (estado_actual + 1) % 5;
-            }
-        }
-
-        if (gpio_get_level(SPP_BUTTON) != LOGICA) {
-            spp_button_pressed = 0;
-        }
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-}
-
-// Información serial
-void info_serial_task(void *arg) {
-    while (1) {
-        if (estado_anterior != estado_actual) {
-            ESP_LOGI(TAG, "Estado actual: %d", estado_actual);
-            estado_anterior = estado_actual;
-        }
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-}
-
-// Control del LED
-void led_control_task(void *arg) {
-    uint16_t contador = 0;
-    uint16_t tiempo_barrido = 100;
-    uint8_t led_level = 0;
-
-    while (1) {
-        switch (estado_actual) {
-            case ESTADO_1: tiempo_barrido = 500; break;
-            case ESTADO_2: tiempo_barrido = 100; break;
-            case ESTADO_3: tiempo_barrido = 1000; break;
-            case ESTADO_4: tiempo_barrido = (contador > 1000) ? 100 : contador + 100; break;
-            default: gpio_set_level(LED0, 0); contador = 0; break;
-        }
-
-        if (contador >= tiempo_barrido) {
-            contador = 0;
-            led_level = !led_level;
-            gpio_set_level(LED0, led_level);
-        }
-        contador += 10;
-        vTaskDelay(pdMS_TO_TICKS(10));
-    }
-}
-
-//*************************** Función principal ***************************//
-void app_main() {
-    inicializar_gpio();
-
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
-
-    ESP_LOGI(TAG, "Inicializando Wi-Fi...");
-    wifi_init_sta();
-
-    ESP_LOGI(TAG, "Inicializando MQTT...");
-    mqtt_init();
-
-    xTaskCreate(maquina_estado_task, "Maquina de Estado", 2048, NULL, 5, NULL);
-    xTaskCreate(info_serial_task, "Información Serial", 2048, NULL, 5, NULL);
-    xTaskCreate(led_control_task, "Control del LED", 2048, NULL, 5, NULL);
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PORTON_HOST
+// Compilación en la PC para el simulador de flota (ver herramientas/simulador_led.c)
+#include "herramientas/porton_host.h"
+#undef CONFIG_BROKER_URL // La URL del broker se define más abajo
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "mqtt_client.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "nvs_flash.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#endif
+
+#include "perfilador.h"
+#include "outbox.h"
+#include "sesion_tls.h"
+
+//*************************** Definiciones ***************************//
+#define TAG "Proyecto Final"
+#define WIFI_SSID "Nexxt"
+#define WIFI_PASSWORD "ab123456cd"
+#define WIFI_CONNECTED_BIT BIT0
+
+// Transporte MQTT
+#define MQTT_TLS 1 // Cambiar a 0 para usar mqtt:// en texto plano
+#if MQTT_TLS
+#define CONFIG_BROKER_URL "mqtts://broker.hivemq.com:8883"
+#else
+#define CONFIG_BROKER_URL "mqtt://broker.hivemq.com"
+#endif
+#define MQTT_CLIENT_PREFIJO "spp-" // Seguido de la MAC: único por equipo y fijo para que el broker conserve la sesión
+
+// GPIO
+#define SPP_BUTTON GPIO_NUM_23
+#define LED0 GPIO_NUM_2
+
+// Lógica del GPIO
+#define LOGICA_NEGATIVA 0
+#define LOGICA_POSITIVA 1
+#define LOGICA LOGICA_NEGATIVA // Cambiar a LOGICA_POSITIVA si se requiere lógica positiva
+
+// Perfil de planificación
+#define PERFIL_ORIGINAL 0
+#define PERFIL_TIEMPO_REAL 1
+#define PERFIL PERFIL_TIEMPO_REAL // Cambiar a PERFIL_ORIGINAL para tareas sin núcleo fijo y misma prioridad
+
+#if PERFIL == PERFIL_TIEMPO_REAL && !CONFIG_FREERTOS_UNICORE
+// Red (Wi-Fi, lwIP, MQTT) en el núcleo 0; control, entrada y salida en el núcleo 1.
+#define NUCLEO_RED 0
+#define NUCLEO_CONTROL 1
+#define PRIORIDAD_CONTROL 10 // Máquina de estados y lectura del botón
+#define PRIORIDAD_SALIDA 9 // Control del LED
+#define PRIORIDAD_MQTT 6
+#define PRIORIDAD_SERIAL 2 // Información serial, reporte de jitter, perfilador y outbox
+
+// Las tareas de Wi-Fi, lwIP y MQTT se fijan desde sdkconfig.defaults, no desde el código.
+#if !CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_0 || !CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0 || !CONFIG_MQTT_USE_CORE_0
+#error "Perfil de tiempo real: Wi-Fi, lwIP y MQTT no están fijados al núcleo 0 (ver sdkconfig.defaults)"
+#endif
+#else
+#define NUCLEO_RED tskNO_AFFINITY
+#define NUCLEO_CONTROL tskNO_AFFINITY
+#define PRIORIDAD_CONTROL 5
+#define PRIORIDAD_SALIDA 5
+#define PRIORIDAD_MQTT 5
+#define PRIORIDAD_SERIAL 5
+#endif
+
+// Monitor de jitter
+#define PERIODO_CONTROL_MS 100
+#define PERIODO_LED_MS 10
+#define JITTER_INTERVALO_MS 5000 // Cada cuánto se reporta la variación del periodo
+#define TOPIC_JITTER "/2022-1143/SPP/jitter" // Cada reporte en JSON, lo junta herramientas/carga_mqtt.c
+
+// Perfilador (perfilador.c)
+#define TOPIC_DIAGNOSTICO "/2022-1143/SPP/diagnostico" // "perfil" o "perfil:<ms>" inicia una medición (también por serial)
+#define TOPIC_PERFIL "/2022-1143/SPP/perfil" // Resultado de la medición en JSON
+#define TOPIC_EVENTOS "/2022-1143/SPP/eventos" // Cambios de estado y caídas de Wi-Fi, QoS 1 a través del outbox
+
+// Estados
+enum { ESTADO_0 = 0, ESTADO_1, ESTADO_2, ESTADO_3, ESTADO_4 };
+uint8_t estado_actual = ESTADO_0; // Estado actual de la máquina de estado.
+uint8_t estado_anterior = 99; // Se asegura que al inicio se registre un cambio.
+static const char *const NOMBRE_ESTADO[] = { "ESTADO_0", "ESTADO_1", "ESTADO_2", "ESTADO_3", "ESTADO_4" };
+
+//*************************** Variables globales ***************************//
+static EventGroupHandle_t wifi_event_group;
+
+#if MQTT_TLS
+// CA fijada del broker, embebida con EMBED_TXTFILES broker_ca.pem en el CMakeLists del componente.
+extern const uint8_t broker_ca_pem_start[] asm("_binary_broker_ca_pem_start");
+#endif
+
+// Tiempo de conexión al broker (TCP + TLS + CONNECT), primera conexión contra reconexiones.
+static int64_t conexion_inicio_us = 0;
+static uint32_t conexiones = 0;
+static int64_t conexion_primera_us = 0;
+static int64_t reconexion_suma_us = 0;
+static uint8_t spp_button_pressed = 0; // Indica si el botón físico fue presionado.
+static uint8_t spp_button_mqtt = 0; // Indica si se recibió un comando desde MQTT.
+
+// Estadísticas del periodo real de un lazo, acumuladas entre reportes.
+typedef struct {
+    portMUX_TYPE lock;
+    int64_t ultimo_us;
+    uint32_t muestras;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t suma_us;
+    uint64_t suma_cuad_us;
+} jitter_monitor_t;
+
+static jitter_monitor_t jitter_control = { .lock = portMUX_INITIALIZER_UNLOCKED };
+static jitter_monitor_t jitter_led = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+static esp_mqtt_client_handle_t cliente_mqtt = NULL;
+
+//*************************** Funciones ***************************//
+
+// Inicialización del GPIO
+void inicializar_gpio(void) {
+    gpio_reset_pin(SPP_BUTTON);
+    gpio_set_direction(SPP_BUTTON, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(SPP_BUTTON, GPIO_PULLUP_ONLY);
+
+    gpio_reset_pin(LED0);
+    gpio_set_direction(LED0, GPIO_MODE_OUTPUT);
+
+    ESP_LOGI(TAG, "GPIO inicializado con lógica %s",
+             (LOGICA == LOGICA_NEGATIVA) ? "negativa" : "positiva");
+}
+
+// Conexión Wi-Fi
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        // Solo la primera desconexión va al outbox, los reintentos fallidos no gastan la flash.
+        if (xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT) {
+            wifi_event_sta_disconnected_t *desconexion = (wifi_event_sta_disconnected_t *)event_data;
+            Outbox_Evento(OUTBOX_TELEMETRIA, "\"ev\":\"wifi_dc\",\"razon\":%d", desconexion->reason);
+        }
+        ESP_LOGI(TAG, "Reintentando conexión Wi-Fi...");
+        esp_wifi_connect();
+        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI(TAG, "Conexión Wi-Fi establecida, IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    }
+}
+
+void wifi_init_sta(void) {
+    wifi_event_group = xEventGroupCreate();
+
+    esp_netif_init();
+    esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, NULL);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, NULL);
+
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASSWORD,
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+        },
+    };
+
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "Intentando conectar a Wi-Fi...");
+}
+
+// Estado en curso para el perfilador; corre en la interrupción del muestreo, por eso está en IRAM.
+static int IRAM_ATTR estado_perfilador(void) {
+    return estado_actual;
+}
+
+// Manejo de eventos MQTT
+static void mqtt_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    esp_mqtt_event_handle_t event = event_data;
+    switch (event->event_id) {
+        case MQTT_EVENT_BEFORE_CONNECT:
+            conexion_inicio_us = esp_timer_get_time();
+            break;
+
+        case MQTT_EVENT_CONNECTED: {
+            int64_t duracion_us = esp_timer_get_time() - conexion_inicio_us;
+
+            if (conexiones++ == 0) {
+                conexion_primera_us = duracion_us;
+            } else {
+                reconexion_suma_us += duracion_us;
+            }
+            ESP_LOGI(TAG, "Conexión MQTT #%" PRIu32 " en %" PRId64 " ms (sesión MQTT %s), primera: %" PRId64 " ms, promedio reconexión: %" PRId64 " ms",
+                     conexiones, duracion_us / 1000, event->session_present ? "conservada" : "nueva",
+                     conexion_primera_us / 1000,
+                     (conexiones > 1) ? reconexion_suma_us / (conexiones - 1) / 1000 : (int64_t)0);
+#if MQTT_TLS
+            // Handshakes TLS completos contra reanudados (sesion_tls.c).
+            struct SESION_TLS_ESTADISTICAS tls;
+            Sesion_TLS_Estadisticas(&tls);
+            ESP_LOGI(TAG, "TLS: %" PRIu32 " completos (promedio %" PRId64 " ms, max %" PRId64 " ms), %" PRIu32 " reanudados (promedio %" PRId64 " ms, max %" PRId64 " ms), %" PRIu32 " fallidos",
+                     tls.completos, tls.completos ? tls.completo_suma_us / tls.completos / 1000 : (int64_t)0, tls.completo_max_us / 1000,
+                     tls.reanudados, tls.reanudados ? tls.reanudado_suma_us / tls.reanudados / 1000 : (int64_t)0, tls.reanudado_max_us / 1000,
+                     tls.fallidos);
+#endif
+
+            // Se suscribe en cada conexión aunque el broker haya conservado la sesión. El botón va con
+            // QoS 0 para que el broker no acumule pulsaciones mientras el equipo está desconectado.
+            esp_mqtt_client_subscribe(event->client, "/2022-1143/SPP", 0);
+            esp_mqtt_client_subscribe(event->client, TOPIC_DIAGNOSTICO, 0);
+
+            // Outbox_Task empieza a vaciar los eventos guardados durante la desconexión.
+            Outbox_Conexion(1);
+            break;
+        }
+
+        case MQTT_EVENT_DISCONNECTED:
+            Outbox_Conexion(0);
+            break;
+
+        case MQTT_EVENT_PUBLISHED:
+            Outbox_Publicado(event->msg_id);
+            break;
+
+        case MQTT_EVENT_DELETED:
+            // esp-mqtt descartó un QoS 1 sin PUBACK; si era del outbox vuelve a salir en otro lote.
+            Outbox_Borrado(event->msg_id);
+            break;
+
+        case MQTT_EVENT_DATA:
+            // Pedido del perfilador, lo atiende Perfilador_Task.
+            if (event->topic_len == strlen(TOPIC_DIAGNOSTICO) &&
+                strncmp(event->topic, TOPIC_DIAGNOSTICO, event->topic_len) == 0) {
+                Perfilador_Pedir(event->data, event->data_len);
+                break;
+            }
+            if (strncmp(event->topic, "/2022-1143/SPP", event->topic_len) == 0) {
+                if (strncmp(event->data, "1", event->data_len) == 0) {
+                    spp_button_mqtt = 1;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void mqtt_init(void) {
+    // El identificador sale de la MAC para que dos equipos no se roben la sesión en el broker.
+    static char client_id[32];
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(client_id, sizeof(client_id), MQTT_CLIENT_PREFIJO "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    esp_mqtt_client_config_t mqtt_config = {
+        .broker.address.uri = CONFIG_BROKER_URL,
+        .credentials.client_id = client_id,
+        .session.disable_clean_session = true,
+        .task.priority = PRIORIDAD_MQTT,
+    };
+#if MQTT_TLS
+    // Transporte de sesion_tls.c: solo acepta el broker firmado por la CA embebida y reanuda la sesión TLS al reconectar.
+    struct SESION_TLS_CONFIG config_tls = {
+        .tag = TAG,
+        .ca_pem = (const char *)broker_ca_pem_start,
+    };
+    mqtt_config.network.transport = Sesion_TLS_Transporte(&config_tls);
+#endif
+
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_config);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, &mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+    cliente_mqtt = client;
+    Perfilador_Cliente(client);
+    Outbox_Cliente(client);
+}
+
+// Monitor de jitter: se llama una vez por iteración del lazo a medir.
+static void jitter_muestra(jitter_monitor_t *j) {
+    int64_t ahora = esp_timer_get_time();
+
+    if (j->ultimo_us != 0) {
+        uint32_t periodo = (uint32_t)(ahora - j->ultimo_us);
+
+        taskENTER_CRITICAL(&j->lock);
+        if (j->muestras == 0 || periodo < j->min_us) j->min_us = periodo;
+        if (periodo > j->max_us) j->max_us = periodo;
+        j->suma_us += periodo;
+        j->suma_cuad_us += (uint64_t)periodo * periodo;
+        j->muestras++;
+        taskEXIT_CRITICAL(&j->lock);
+    }
+    j->ultimo_us = ahora;
+}
+
+// Reporta media, extremos y desviación del periodo, y reinicia la ventana.
+static void jitter_reportar(jitter_monitor_t *j, const char *nombre, uint32_t nominal_ms) {
+    taskENTER_CRITICAL(&j->lock);
+    jitter_monitor_t copia = *j;
+    j->muestras = 0;
+    j->min_us = 0;
+    j->max_us = 0;
+    j->suma_us = 0;
+    j->suma_cuad_us = 0;
+    taskEXIT_CRITICAL(&j->lock);
+
+    if (copia.muestras == 0) {
+        return;
+    }
+
+    double media = (double)copia.suma_us / copia.muestras;
+    double varianza = (double)copia.suma_cuad_us / copia.muestras - media * media;
+    ESP_LOGI(TAG, "Jitter %s: n=%" PRIu32 " nominal=%" PRIu32 " us media=%.1f us min=%" PRIu32
+             " us max=%" PRIu32 " us varianza=%.1f us^2",
+             nombre, copia.muestras, nominal_ms * 1000, media, copia.min_us, copia.max_us,
+             (varianza > 0) ? varianza : 0.0);
+
+    // También por MQTT, para comparar el jitter con y sin tráfico desde la PC.
+    if (cliente_mqtt != NULL) {
+        char mensaje[192];
+        snprintf(mensaje, sizeof(mensaje), "{\"lazo\":\"%s\",\"n\":%" PRIu32 ",\"nominal_us\":%" PRIu32 ",\"media_us\":%.1f,"
+                 "\"min_us\":%" PRIu32 ",\"max_us\":%" PRIu32 ",\"varianza_us2\":%.1f}",
+                 nombre, copia.muestras, nominal_ms * 1000, media, copia.min_us, copia.max_us,
+                 (varianza > 0) ? varianza : 0.0);
+        esp_mqtt_client_publish(cliente_mqtt, TOPIC_JITTER, mensaje, 0, 0, 0);
+    }
+}
+
+// Máquina de estados
+void maquina_estado_task(void *arg) {
+    TickType_t ultimo_despertar = xTaskGetTickCount();
+
+    while (1) {
+        uint8_t previo = estado_actual;
+        jitter_muestra(&jitter_control);
+
+        if (!spp_button_pressed) {
+            if (gpio_get_level(SPP_BUTTON) == LOGICA) {
+                spp_button_pressed = 1;
+                estado_actual = (estado_actual + 1) % 5;
+            } else if (spp_button_mqtt) {
+                spp_button_mqtt = 0;
+                estado_actual = (estado_actual + 1) % 5;
+            }
+        }
+
+        if (gpio_get_level(SPP_BUTTON) != LOGICA) {
+            spp_button_pressed = 0;
+        }
+
+        // Solo se encola, la escritura en flash la hace Outbox_Task.
+        if (estado_actual != previo) {
+            Outbox_Evento(OUTBOX_ESTADO, "\"ev\":\"estado\",\"estado\":%d,\"previo\":%d", estado_actual, previo);
+        }
+        xTaskDelayUntil(&ultimo_despertar, pdMS_TO_TICKS(PERIODO_CONTROL_MS));
+    }
+}
+
+// Información serial
+void info_serial_task(void *arg) {
+    uint32_t desde_reporte_ms = 0;
+
+    while (1) {
+        if (estado_anterior != estado_actual) {
+            ESP_LOGI(TAG, "Estado actual: %d", estado_actual);
+            estado_anterior = estado_actual;
+        }
+
+        desde_reporte_ms += 100;
+        if (desde_reporte_ms >= JITTER_INTERVALO_MS) {
+            desde_reporte_ms = 0;
+            jitter_reportar(&jitter_control, "maquina de estado", PERIODO_CONTROL_MS);
+            jitter_reportar(&jitter_led, "control del LED", PERIODO_LED_MS);
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+// Control del LED
+void led_control_task(void *arg) {
+    uint16_t contador = 0;
+    uint16_t tiempo_barrido = 100;
+    uint8_t led_level = 0;
+
+    while (1) {
+        jitter_muestra(&jitter_led);
+
+        switch (estado_actual) {
+            case ESTADO_1: tiempo_barrido = 500; break;
+            case ESTADO_2: tiempo_barrido = 100; break;
+            case ESTADO_3: tiempo_barrido = 1000; break;
+            case ESTADO_4: tiempo_barrido = (contador > 1000) ? 100 : contador + 100; break;
+            default: gpio_set_level(LED0, 0); contador = 0; break;
+        }
+
+        if (contador >= tiempo_barrido) {
+            contador = 0;
+            led_level = !led_level;
+            gpio_set_level(LED0, led_level);
+        }
+        contador += PERIODO_LED_MS;
+        vTaskDelay(pdMS_TO_TICKS(PERIODO_LED_MS));
+    }
+}
+
+//*************************** Función principal ***************************//
+void app_main() {
+    inicializar_gpio();
+
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    // El outbox va antes del Wi-Fi: su handler ya encola las desconexiones.
+    struct OUTBOX_CONFIG eventos = {
+        .tag = TAG,
+        .topic_eventos = TOPIC_EVENTOS,
+        .topic_telemetria = TOPIC_EVENTOS,
+        .contar = NULL,
+    };
+    Outbox_Iniciar(&eventos);
+    xTaskCreatePinnedToCore(Outbox_Task, "Outbox", 4096, NULL, PRIORIDAD_SERIAL, NULL, NUCLEO_RED);
+
+    ESP_LOGI(TAG, "Inicializando Wi-Fi...");
+    wifi_init_sta();
+
+    struct PERFILADOR_CONFIG perfil = {
+        .tag = TAG,
+        .topic = TOPIC_PERFIL,
+        .estado = estado_perfilador,
+        .nombres = NOMBRE_ESTADO,
+        .estados = sizeof(NOMBRE_ESTADO) / sizeof(NOMBRE_ESTADO[0]),
+    };
+    Perfilador_Iniciar(&perfil);
+
+    ESP_LOGI(TAG, "Inicializando MQTT...");
+    mqtt_init();
+
+    // El perfilador separa por estado las muestras de las dos tareas de control. La máquina de estado
+    // formatea los eventos del outbox (vsnprintf): su pila libre sale en el reporte del perfilador.
+    TaskHandle_t maquina = NULL;
+    TaskHandle_t led = NULL;
+    xTaskCreatePinnedToCore(maquina_estado_task, "Maquina de Estado", 3072, NULL, PRIORIDAD_CONTROL, &maquina, NUCLEO_CONTROL);
+    xTaskCreatePinnedToCore(info_serial_task, "Información Serial", 3072, NULL, PRIORIDAD_SERIAL, NULL, NUCLEO_RED);
+    xTaskCreatePinnedToCore(led_control_task, "Control del LED", 2048, NULL, PRIORIDAD_SALIDA, &led, NUCLEO_CONTROL);
+    Perfilador_Seguir(maquina);
+    Perfilador_Seguir(led);
+    xTaskCreatePinnedToCore(Perfilador_Task, "Perfilador", 4096, NULL, PRIORIDAD_SERIAL, NULL, NUCLEO_RED);
 }
\ No newline at end of file
@@ -1,654 +1,2067 @@
-/* MQTT (over TCP) Example
-
-   This example code is in the Public Domain (or CC0 licensed, at your option.)
-
-   Unless required by applicable law or agreed to in writing, this
-   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
-   CONDITIONS OF ANY KIND, either express or implied.
-*/
-/***********************************************************/
-/*                   Microcontroladores                    */
-/*  Nombre:    jose veloz                                  */
-/*  Matricula: 2022-1143                                   */
-/*  Seccion:   jueves                                      */
-/*  Practica:  Maquina de estado                           */
-/*  Fecha:     14/11/2024                                  */
-/***********************************************************/
-
-// Incluyendo Bibliotecas
-#include <stdio.h>
-#include <stdint.h>
-#include <stddef.h>
-#include <string.h>
-#include "esp_wifi.h"
-#include "esp_system.h"
-#include "nvs_flash.h"
-#include "esp_event.h"
-#include "esp_netif.h"
-#include "protocol_examples_common.h"
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/semphr.h"
-#include "freertos/queue.h"
-
-#include "lwip/sockets.h"
-#include "lwip/dns.h"
-#include "lwip/netdb.h"
-
-#include "esp_log.h"
-#include "mqtt_client.h"
-
-#include "driver/gpio.h"
-#include <stdlib.h>
-
-
-static const char *TAG = "mqtt_example";
-
-
-//Macros a utilizar para facilitar el entendimiento del código
-#define STATE_START 0
-#define CLOSE 1
-#define OPEN 2
-#define CLOSING 3
-#define OPENING 4
-#define BUG 5
-#define TRUE 1
-#define FALSE 0
-#define RT_MAX 12000
-#define ERROR_OK 0
-#define ERROR_LS 1
-#define ERROR_RT 2
-
-////GPIO DEL ESP32
-#define SENSOR_OPEN 34   
-#define SENSOR_CLOSE 35   
-#define MOTOR_ABRIR 13
-#define MOTOR_CERRAR 12
-#define LED_OPEN 14
-#define LED_CLOSE 27
-#define LED_ERROR 26
-#define LED_MQTT 2
-
-
-//Inicializamos todos los estados temporales en el estado de reseteo
-int NEXT_STATE    = STATE_START;
-int STATE       = STATE_START;
-int PAST_STATE     = STATE_START;
-
-
-//Estructura de datos
-struct DATA_IO
-{
-    unsigned int LSC:1;             //Limit switch que indica que el porton está CLOSE
-    unsigned int LSA:1;             //Limit switch que indica que el porton está OPEN
-    unsigned int SPP:1;             //Comando pulso-pulso
-    unsigned int MA:1;              //Salida que acciona el motor para abrir el porton
-    unsigned int MC:1;              //Salida que acciona el motor para cerrar el porton
-    unsigned int Cont_RT;           //Contador Run Time en segundos
-    unsigned int Led_A:1;           //Led indicador del porton OPENING
-    unsigned int Led_C:1;           //Led indicador del porton CLOSING
-    unsigned int Led_ER:1;          //Led indicador de error
-    unsigned int COD_ERR;           //Código de error
-    unsigned int DATOS_READY:1;     //Confirmación de recepción de los datos exteriores
-}data_io;
-
-
-//Prototipos de la funciones que se utilizarán en la máquina de estados
-int Funcion_Start(void);
-int Funcion_OPEN(void);
-int Funcion_OPENING(void);
-int Funcion_CLOSE(void);
-int Funcion_CLOSING(void);
-int Funcion_BUG(void);
-
-
-//Función para configurar los GPIOs
-void Configuracion_GPIO(void)
-{
-    gpio_set_direction(SENSOR_OPEN, GPIO_MODE_INPUT);
-    gpio_set_direction(SENSOR_CLOSE, GPIO_MODE_INPUT);
-    gpio_set_direction(MOTOR_ABRIR, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MOTOR_CERRAR, GPIO_MODE_OUTPUT);
-    gpio_set_direction(LED_OPEN, GPIO_MODE_OUTPUT);
-    gpio_set_direction(LED_CLOSE, GPIO_MODE_OUTPUT);
-    gpio_set_direction(LED_ERROR, GPIO_MODE_OUTPUT);
-
-    gpio_set_direction(LED_MQTT, GPIO_MODE_OUTPUT);
-    gpio_set_level(LED_MQTT, FALSE);
-}
-
-
-//Función para actualizar los valores de los GPIOs y las variables de control
-void Actualización_GPIO(void)
-{
-    data_io.DATOS_READY = FALSE;
-    vTaskDelay(10/portTICK_PERIOD_MS);
-    data_io.LSA = gpio_get_level(SENSOR_OPEN);
-    data_io.LSC = gpio_get_level(SENSOR_CLOSE);
-    gpio_set_level(MOTOR_ABRIR, data_io.MA);
-    gpio_set_level(MOTOR_CERRAR, data_io.MC);
-    gpio_set_level(LED_OPEN, data_io.Led_A);
-    gpio_set_level(LED_CLOSE, data_io.Led_C);
-    gpio_set_level(LED_ERROR, data_io.Led_ER);
-    data_io.DATOS_READY = TRUE;
-}
-
-
-//Función para trabajar con el dato recibido por MQTT
-void Dato_MQTT(char *mensaje_recibido)
-{
-    if((strcmp(mensaje_recibido, "1")) == 0)
-    {
-        //Imprimimos en pantalla que se ha mandado a cerrar el porton
-        if (STATE == OPEN)
-        {
-            printf("\nMANDATO: CERRAR EL PORTON\n");
-        }
-
-        //Imprimimos en pantalla que se ha mandado a abrir el porton
-        if (STATE == CLOSE)
-        {
-            printf("\nMANDATO: ABRIR EL PORTON\n");
-        }
-        
-        //Actualizamos la variable de control para abrir/cerrar el porton
-        data_io.SPP = TRUE;
-        mensaje_recibido = "0";
-    }
-}
-
-
-static void log_error_if_nonzero(const char *message, int error_code)
-{
-    if (error_code != 0) {
-        ESP_LOGE(TAG, "Last error %s: 0x%x", message, error_code);
-    }
-}
-
-/*
- * @brief Event handler registered to receive MQTT events
- *
- *  This function is called by the MQTT client event loop.
- *
- * @param handler_args user data registered to the event.
- * @param base Event base for the handler(always MQTT Base in this example).
- * @param event_id The id for the received event.
- * @param event_data The data for the event, esp_mqtt_event_handle_t.
- */
-static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
-{
-    ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
-    esp_mqtt_event_handle_t event = event_data;
-    esp_mqtt_client_handle_t client = event->client;
-    int msg_id;
-    switch ((esp_mqtt_event_id_t)event_id) {
-    case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-
-        msg_id = esp_mqtt_client_subscribe(client, "Estado_del_porton", 0);
-        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-        msg_id = esp_mqtt_client_subscribe(client, "Boton_de_control", 0);
-        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-        msg_id = esp_mqtt_client_publish(client, "Boton_de_control", "0", 0, 0, 0);
-        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-       
-
-        /*
-        msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
-        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-        msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
-        ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
-        */
-        
-        break;
-    case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-        break;
-
-    case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-        msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-        break;
-    case MQTT_EVENT_UNSUBSCRIBED:
-        ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
-
-/////////////////////////////////////////////////////////////////////////////
-
-        char dato_recibido [100];                               //Creamos la variable que nos almcenará el mesaje recibido por MQTT
-        strncpy(dato_recibido, event->data, event->data_len);   //Copiamos el dato recibido por MQTT en la variable que creamos anteriormente
-        dato_recibido [event->data_len] = '\0';                 //Aseguramos de que la cadena de texto copiada esté terminada en '\0'
-
-
-        //Pasamos el mensaje copiado en la variable que creamos a la función que trabajará con el dato recibido por MQTT
-        Dato_MQTT(dato_recibido);
-
-/////////////////////////////////////////////////////////////////////////////
-
-        break;
-    case MQTT_EVENT_ERROR:
-        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
-        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-            log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
-            log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
-            log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
-            ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
-
-        }
-        break;
-    default:
-        ESP_LOGI(TAG, "Other event id:%d", event->event_id);
-        break;
-    }
-}
-
-static void mqtt_app_start(void)
-{
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = CONFIG_BROKER_URL,
-    };
-#if CONFIG_BROKER_URL_FROM_STDIN
-    char line[128];
-
-    if (strcmp(mqtt_cfg.broker.address.uri, "FROM_STDIN") == 0) {
-        int count = 0;
-        printf("Please enter url of mqtt broker\n");
-        while (count < 128) {
-            int c = fgetc(stdin);
-            if (c == '\n') {
-                line[count] = '\0';
-                break;
-            } else if (c > 0 && c < 127) {
-                line[count] = c;
-                ++count;
-            }
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-        }
-        mqtt_cfg.broker.address.uri = line;
-        printf("Broker url: %s\n", line);
-    } else {
-        ESP_LOGE(TAG, "Configuration mismatch: wrong broker url");
-        abort();
-    }
-#endif /* CONFIG_BROKER_URL_FROM_STDIN */
-
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
-    /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
-}
-
-void app_main(void)
-{
-    ESP_LOGI(TAG, "[APP] Startup..");
-    ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
-    ESP_LOGI(TAG, "[APP] IDF version: %s", esp_get_idf_version());
-
-    esp_log_level_set("*", ESP_LOG_INFO);
-    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
-    esp_log_level_set("mqtt_example", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport_base", ESP_LOG_VERBOSE);
-    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport", ESP_LOG_VERBOSE);
-    esp_log_level_set("outbox", ESP_LOG_VERBOSE);
-
-    ESP_ERROR_CHECK(nvs_flash_init());
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-
-    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
-     * Read "Establishing Wi-Fi or Ethernet Connection" section in
-     * examples/protocols/README.md for more information about this function.
-     */
-    ESP_ERROR_CHECK(example_connect());
-
-
-    //Llamamos a esta función para conectarnos al broker MQTT
-    mqtt_app_start();
-
-
-    //Llamamos a la función para configurar los GPIOs
-    Configuracion_GPIO();
-
-
-    //Máquina de estado
-    for(;;)
-    {
-        //Estado Init (Estado de reseteo)
-        if (NEXT_STATE == STATE_START)
-        {
-            NEXT_STATE = Funcion_Start();
-        }
-
-        //Estado OPEN
-        if (NEXT_STATE == OPEN)
-        {
-            NEXT_STATE = Funcion_OPEN();
-        }
-
-        //Estado OPENING
-        if (NEXT_STATE == OPENING)
-        {
-            NEXT_STATE = Funcion_OPENING();
-        }
-
-        //Estado CLOSE
-        if (NEXT_STATE == CLOSE)
-        {
-            NEXT_STATE = Funcion_CLOSE();
-        }
-
-        //Estado CLOSING
-        if (NEXT_STATE == CLOSING)
-        {
-            NEXT_STATE = Funcion_CLOSING();
-        }
-
-        //Estado error
-        if (NEXT_STATE == BUG)
-        {
-            NEXT_STATE = Funcion_BUG();
-        }
-        
-    }
-}
-
-
-int Funcion_Start(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE_START;
-    STATE = STATE_START;
-    printf("\nESTADO ACTUAL: ESTADO INIT\n");
-
-    //Actualización de los datos
-    data_io.MA = FALSE;
-    data_io.MC = FALSE;
-    data_io.SPP = FALSE;
-    data_io.COD_ERR = FALSE;
-    data_io.Cont_RT = 0;
-
-    //Prueba de funcionamiento de los leds
-    data_io.Led_A = TRUE;
-    data_io.Led_C = TRUE;
-    data_io.Led_ER = TRUE;
-    vTaskDelay(100/portTICK_PERIOD_MS);
-    data_io.Led_A = FALSE;
-    data_io.Led_C = FALSE;
-    data_io.Led_ER = FALSE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Confirmación de los datos exteriores
-    while (!data_io.DATOS_READY){}
-
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado Init ------>> Estado CLOSE
-        if((data_io.LSC == TRUE) && (data_io.LSA == FALSE))
-        {
-            return CLOSE;
-        }
-
-        //Estado Init ------>> Estado CLOSING
-        if(((data_io.LSC == FALSE) && (data_io.LSA == FALSE)) || ((data_io.LSC == FALSE) && (data_io.LSA == TRUE)))
-        {
-            return CLOSING;
-        }
-
-        //Estado Init ------>> Estado error
-        if((data_io.LSC == TRUE) && (data_io.LSA == TRUE))
-        {
-            data_io.COD_ERR = ERROR_LS;
-            return BUG;
-        }
-    }
-}
-
-
-int Funcion_OPEN(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE;
-    STATE = OPEN;
-    printf("\nESTADO ACTUAL: ESTADO OPEN\n");
-
-    //Actualización de los datos
-    data_io.MA = FALSE;
-    data_io.SPP = FALSE;
-    data_io.Led_A = FALSE;
-    data_io.Led_C = FALSE;
-    data_io.Led_ER = FALSE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado OPEN ------>> Estado CLOSING
-        if (data_io.SPP == TRUE)
-        {
-            data_io.SPP = FALSE;
-            return  CLOSING;
-        }
-    }
-}
-
-
-int Funcion_OPENING(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE;
-    STATE = OPENING;
-    printf("\nESTADO ACTUAL: ESTADO OPENING\n");
-
-    //Actualización de los datos
-    data_io.MA = TRUE;
-    data_io.Cont_RT = 0;
-    data_io.Led_A = TRUE;
-    data_io.Led_C = FALSE;
-    data_io.Led_ER = FALSE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Tiempo de separación del porton de los limit switch
-    vTaskDelay(3000/portTICK_PERIOD_MS);
-
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado OPENING ------>> Estado OPEN
-        if (data_io.LSA == TRUE)
-        {
-            return OPEN;
-        }
-
-        //Incrementamos el valor del contador RT cada 10 milisegundos
-        ++data_io.Cont_RT;
-
-        //Estado OPENING ------>> Estado error
-        if (data_io.Cont_RT > RT_MAX)
-        {
-            data_io.COD_ERR = ERROR_RT;
-            return BUG;
-        }
-    }
-}
-
-
-int Funcion_CLOSE(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE;
-    STATE = CLOSE;
-    printf("\nESTADO ACTUAL: ESTADO CLOSE\n");
-
-    //Actualización de los datos
-    data_io.MC = FALSE;
-    data_io.SPP = FALSE;
-    data_io.Led_A = FALSE;
-    data_io.Led_C = FALSE;
-    data_io.Led_ER = FALSE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado CLOSE ------>> Estado OPENING
-        if (data_io.SPP == TRUE)
-        {
-            data_io.SPP = FALSE;
-            return  OPENING;
-        }  
-    }
-}
-
-
-int Funcion_CLOSING(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE;
-    STATE = CLOSING;
-    printf("\nESTADO ACTUAL: ESTADO CLOSING\n");
-
-    //Actualización de los datos
-    data_io.MC = TRUE;
-    data_io.Cont_RT = 0;
-    data_io.Led_A = FALSE;
-    data_io.Led_C = TRUE;
-    data_io.Led_ER = FALSE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Tiempo de separación del porton de los limit switch
-    vTaskDelay(3000/portTICK_PERIOD_MS);
-
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado CLOSING ------>> Estado CLOSE
-        if (data_io.LSC == TRUE)
-        {
-            return CLOSE;
-        }
-
-        //Incrementamos el valor del contador RT cada 10 milisegundos
-        ++data_io.Cont_RT;
-
-        //Estado CLOSING ------>> Estado error
-        if (data_io.Cont_RT > RT_MAX)
-        {
-            data_io.COD_ERR = ERROR_RT;
-            return BUG;
-        } 
-    }
-}
-
-
-int Funcion_BUG(void)
-{
-    //Actualización de los estados
-    PAST_STATE = STATE;
-    STATE = BUG;
-    printf("\nESTADO ACTUAL: ESTADO ERROR\n");
-
-    //Actualización de los datos
-    data_io.MC = FALSE;
-    data_io.MA = FALSE;
-    data_io.SPP = FALSE;
-    data_io.Led_A = FALSE;
-    data_io.Led_C = FALSE;
-    data_io.Led_ER = TRUE;
-
-    //Actualización de los estados GPIOs y las variables de control
-    Actualización_GPIO();
-
-    //Mensaje indicando al usuario que hubo un error OPENING el porton
-    if ((PAST_STATE == OPENING) && (data_io.COD_ERR == ERROR_RT))
-    {
-        printf("\nERROR OPENING LA PUERTA: REVISE LA POSICION DEL PORTON Y LOS LIMIT SWITCH.\n");
-        printf("\nLLUEGO DE HACER LAS REVISIONES PRESIONE EL BOTON PARA RETORNAR AL FUNCIONAMIENTO NORMAL.\n");
-    }
-
-    //Mensaje indicando al usuario que hubo un error CLOSING el porton
-    if ((PAST_STATE == CLOSING) && (data_io.COD_ERR == ERROR_RT))
-    {
-        printf("\nERROR CLOSING LA PUERTA: REVISE LA POSICION DEL PORTON Y LOS LIMIT SWITCH.\n");
-        printf("\nLUEGO DE HACER LAS REVISIONES PRESIONE EL BOTON PARA RETORNAR AL FUNCIONAMIENTO NORMAL.\n");
-    }
-
-    //Mensaje indicando al usuario que hubo un error inicializando el sistema
-    if ((PAST_STATE == STATE_START) && (data_io.COD_ERR == ERROR_LS))
-    {
-        printf("\nERROR INICIALIZANDO EL SISTEMA: REVISE LAS CONEXIONES DE LOS SENSORES LIMIT SWITCH.\n");
-        printf("\nLUEGO DE ARREGLAR LOS SENSORES PRESIONE EL BOTON PARA REINICIAR EL SISTEMA.\n");
-    }
-    
-    //Loop infinito
-    for(;;)
-    {
-        //Actualización de los estados GPIOs y las variables de control
-        Actualización_GPIO();
-
-        //Estado error ------>> Estado OPENING
-        if ((PAST_STATE == OPENING) && (data_io.SPP == TRUE))
-        {
-            data_io.SPP = FALSE;
-            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA ABRIR LA PUERTA\n");
-            data_io.COD_ERR = ERROR_OK;
-            return OPENING;
-        }
-
-        //Estado error ------>> Estado CLOSING
-        if ((PAST_STATE == CLOSING) && (data_io.SPP == TRUE))
-        {
-            data_io.SPP = FALSE;
-            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA CERRAR LA PUERTA\n");
-            data_io.COD_ERR = ERROR_OK;
-            return CLOSING;
-        }
-
-        //Estado error ------>> Estado Init
-        if ((PAST_STATE == STATE_START) && (data_io.SPP == TRUE))
-        {
-            data_io.SPP = FALSE;
-            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA REINICIAR EL SISTEMA\n");
-            data_io.COD_ERR = ERROR_OK;
-            return STATE_START;
-        }
-    }
-}
+/* MQTT (over TCP) Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/***********************************************************/
+/*                   Microcontroladores                    */
+/*  Nombre:    jose veloz                                  */
+/*  Matricula: 2022-1143                                   */
+/*  Seccion:   jueves                                      */
+/*  Practica:  Maquina de estado                           */
+/*  Fecha:     14/11/2024                                  */
+/***********************************************************/
+
+// Incluyendo Bibliotecas
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+
+#ifdef PORTON_HOST
+//Compilación en la PC para reproducir trazas (ver herramientas/replay_porton.c)
+#include "herramientas/porton_host.h"
+#else
+#include "esp_wifi.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "protocol_examples_common.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+#include "lwip/sockets.h"
+#include "lwip/dns.h"
+#include "lwip/netdb.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "mdns.h"
+#include "mbedtls/md.h"
+#include "mbedtls/sha256.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_mac.h"
+
+#include "driver/gpio.h"
+#endif
+
+#include "perfilador.h"
+#include "outbox.h"
+#include "sesion_tls.h"
+
+
+static const char *TAG = "mqtt_example";
+
+
+//Macros a utilizar para facilitar el entendimiento del código
+#define STATE_START 0
+#define CLOSE 1
+#define OPEN 2
+#define CLOSING 3
+#define OPENING 4
+#define BUG 5
+#define TRUE 1
+#define FALSE 0
+#define RT_MAX 12000
+#define ERROR_OK 0
+#define ERROR_LS 1
+#define ERROR_RT 2
+#define MQTT_CLIENT_PREFIJO "porton-"       //Seguido de la MAC: único por equipo y fijo para que el broker conserve la sesión
+
+////GPIO DEL ESP32
+#define SENSOR_OPEN 34   
+#define SENSOR_CLOSE 35   
+#define MOTOR_ABRIR 13
+#define MOTOR_CERRAR 12
+#define LED_OPEN 14
+#define LED_CLOSE 27
+#define LED_ERROR 26
+#define LED_MQTT 2
+
+
+////PERFIL DE PLANIFICACION
+#define PERFIL_ORIGINAL 0
+#define PERFIL_TIEMPO_REAL 1
+#define PERFIL PERFIL_TIEMPO_REAL     //Cambiar a PERFIL_ORIGINAL para correr la máquina de estados sin núcleo fijo
+
+#if PERFIL == PERFIL_TIEMPO_REAL && !CONFIG_FREERTOS_UNICORE
+//Red (Wi-Fi, lwIP, MQTT) en el núcleo 0; control, entradas y salidas en el núcleo 1
+#define NUCLEO_RED 0
+#define NUCLEO_CONTROL 1
+#define PRIORIDAD_CONTROL 10          //Máquina de estados (lee los limit switch y acciona el motor)
+#define PRIORIDAD_MQTT 6
+#define PRIORIDAD_DIAGNOSTICO 2       //Jitter, métricas, OTA, perfilador y outbox
+
+//Las tareas de Wi-Fi, lwIP y MQTT se fijan desde sdkconfig.defaults, no desde el código
+#if !CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_0 || !CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0 || !CONFIG_MQTT_USE_CORE_0
+#error "Perfil de tiempo real: Wi-Fi, lwIP y MQTT no están fijados al núcleo 0 (ver sdkconfig.defaults)"
+#endif
+#else
+//Misma prioridad que tenía app_main, sin núcleo fijo
+#define NUCLEO_RED tskNO_AFFINITY
+#define NUCLEO_CONTROL tskNO_AFFINITY
+#define PRIORIDAD_CONTROL 1
+#define PRIORIDAD_MQTT 5
+#define PRIORIDAD_DIAGNOSTICO 1
+#endif
+
+
+////CONTROL POR LAN
+#define LAN_PUERTO 3333                     //Puerto UDP del control local
+#define LAN_HOSTNAME "porton-2022-1143"     //Se anuncia como porton-2022-1143.local, servicio _porton._udp
+#define LAN_CLAVE "cambiar-esta-clave"      //Clave compartida para firmar los comandos (HMAC-SHA256)
+#define LAN_CLAVE_EJEMPLO "cambiar-esta-clave"  //Con esta clave el control LAN no arranca
+#define LAN_NVS_ESPACIO "porton"            //Tope de los ids LAN reservados, en la partición NVS por defecto
+#define LAN_NVS_CLAVE "lan_id"
+#define LAN_ID_BLOQUE 100                   //Ids reservados por cada escritura en NVS (10 s con ids en décimas de segundo)
+#define COMANDOS_RECIENTES 16               //Ids aceptados que se recuerdan para juntar LAN y MQTT
+#define COMANDO_VENTANA_US 30000000         //Un mismo id que llega por el otro camino dentro de esta ventana es duplicado
+#define LAN_PAQUETE_MAX 128
+#define TOPIC_ACK "Boton_de_control/ack"   //Confirmación de los comandos con identificador recibidos por MQTT
+
+
+////METRICAS
+#define METRICAS_INTERVALO_MS 60000         //Cada cuánto se publica el resumen de contadores
+#define TOPIC_METRICAS "Porton/metricas"
+#define METRICAS_MAX 512                    //Mensaje de métricas con todos los contadores
+
+
+////OTA POR MQTT
+#define TOPIC_OTA "Porton/ota/"
+#define TOPIC_OTA_INICIO "Porton/ota/inicio"        //Manifiesto firmado, formato en OTA_Inicio
+#define TOPIC_OTA_BLOQUE "Porton/ota/bloque/"       //Seguido del offset del bloque dentro de la transferencia
+#define TOPIC_OTA_ESTADO "Porton/ota/estado"        //"<siguiente offset>", "ok:<ms escribiendo>:<ms total>" o "error:<motivo>"
+#define OTA_BLOQUE_MAX 4096                         //Tamaño máximo de cada bloque, cabe en un solo evento MQTT
+#define OTA_COLA 2                                  //Bloques recibidos pendientes de escribir
+#define OTA_COPIA_PASO 1024                         //Bytes copiados de la imagen actual por escritura
+#define OTA_CONFIRMACION_MS 300000                  //Una imagen nueva que no se conecta al broker en este tiempo se revierte
+#define OTA_CLAVE "cambiar-esta-clave-ota"          //Clave compartida para firmar los manifiestos (HMAC-SHA256)
+#define OTA_CLAVE_EJEMPLO "cambiar-esta-clave-ota"  //Con esta clave no se acepta ninguna OTA
+#define OTA_NVS_ESPACIO "porton"                    //Número del último manifiesto aceptado
+#define OTA_NVS_CLAVE "ota_n"
+#define OTA_ESPERA_CONTROL_MS 100                   //Tiempo para que la máquina de estado vea el bloqueo antes de reiniciar
+
+//Sin rollback en el bootloader una imagen que no llega a confirmarse no vuelve a la anterior
+#if !CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+#error "OTA: habilitar BOOTLOADER_APP_ROLLBACK_ENABLE (ver sdkconfig.defaults)"
+#endif
+
+
+////OUTBOX PERSISTENTE
+#define TOPIC_EVENTOS "Porton/eventos"              //Cambios de estado y fallas, QoS 1
+
+
+////TRAZA DE EVENTOS
+#define TRAZA_EVENTOS 2048                  //Eventos guardados en RAM, 8 bytes cada uno
+#define TOPIC_TRAZA "Porton/traza"          //Al recibir "volcar" se publica la traza en TOPIC_TRAZA_DATOS
+#define TOPIC_TRAZA_DATOS "Porton/traza/datos"
+#define TRAZA_TIMER_SEPARACION 0            //Fin del tiempo de separación de los limit switch
+#define TRAZA_TIMER_RT 1                    //El contador RT superó RT_MAX
+
+
+////MONITOR DE JITTER
+#define PERIODO_CONTROL_US 10000      //Periodo nominal del lazo de Actualización_GPIO
+#define JITTER_DESCARTE_US 50000      //Pausas intencionales (prueba de leds, separación de los limit switch) no cuentan
+#define JITTER_INTERVALO_MS 5000      //Cada cuánto se reporta la variación del periodo
+#define TOPIC_JITTER "Porton/diagnostico/jitter"    //Cada reporte en JSON, lo junta herramientas/carga_mqtt.c
+
+
+////PERFILADOR (perfilador.c)
+#define TOPIC_DIAGNOSTICO "Porton/diagnostico"              //"perfil" o "perfil:<ms>" inicia una medición (también por serial)
+#define TOPIC_PERFIL "Porton/diagnostico/perfil"            //Resultado de la medición en JSON
+
+
+//Inicializamos todos los estados temporales en el estado de reseteo
+int NEXT_STATE    = STATE_START;
+int STATE       = STATE_START;
+int PAST_STATE     = STATE_START;
+
+
+//Estructura de datos
+struct DATA_IO
+{
+    unsigned int LSC:1;             //Limit switch que indica que el porton está CLOSE
+    unsigned int LSA:1;             //Limit switch que indica que el porton está OPEN
+    unsigned int SPP:1;             //Comando pulso-pulso
+    unsigned int MA:1;              //Salida que acciona el motor para abrir el porton
+    unsigned int MC:1;              //Salida que acciona el motor para cerrar el porton
+    unsigned int Cont_RT;           //Contador Run Time en segundos
+    unsigned int Led_A:1;           //Led indicador del porton OPENING
+    unsigned int Led_C:1;           //Led indicador del porton CLOSING
+    unsigned int Led_ER:1;          //Led indicador de error
+    unsigned int COD_ERR;           //Código de error
+    unsigned int DATOS_READY:1;     //Confirmación de recepción de los datos exteriores
+}data_io;
+
+
+//Lo que Actualización_GPIO recuerda de la llamada anterior
+struct GPIO_PREVIO
+{
+    unsigned int motor_abriendo;    //Salidas escritas en la llamada anterior
+    unsigned int motor_cerrando;
+    uint32_t resto_us;              //Fracción de milisegundo pendiente de contar
+    uint8_t sensores_previos;       //Limit switch leídos en la llamada anterior
+}gpio_previo = { .motor_abriendo = FALSE, .motor_cerrando = FALSE, .resto_us = 0, .sensores_previos = 0xFF };
+
+
+//Estadísticas del periodo real del lazo de control, acumuladas entre reportes
+struct JITTER
+{
+    portMUX_TYPE lock;
+    int64_t ultimo_us;              //Momento de la muestra anterior
+    uint32_t muestras;
+    uint32_t descartadas;           //Periodos mayores a JITTER_DESCARTE_US
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t suma_us;
+    uint64_t suma_cuad_us;
+}jitter = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+
+//Tiempos de conexión al broker (TCP + TLS + CONNECT), primera conexión contra reconexiones
+struct CONEXION_MQTT
+{
+    int64_t inicio_us;              //Momento de MQTT_EVENT_BEFORE_CONNECT
+    uint32_t conexiones;
+    int64_t primera_us;             //Duración de la primera conexión (handshake completo)
+    int64_t reconexion_suma_us;     //Suma de las duraciones de las reconexiones
+}conexion_mqtt;
+
+
+//Mensaje de OTA recibido por MQTT, lo procesa OTA_Task
+struct OTA_MENSAJE
+{
+    int inicio;                     //TRUE para TOPIC_OTA_INICIO, FALSE para un bloque
+    uint32_t offset;                //Offset del bloque dentro de la transferencia
+    int largo;
+    char datos[];
+};
+
+//Transferencia OTA en curso
+//Un parche delta es una secuencia de operaciones sobre la imagen en ejecución:
+//  'C' <origen u32> <largo u32>   copia bytes de la imagen actual
+//  'D' <largo u32> <datos>        agrega bytes nuevos
+struct OTA
+{
+    int activa;
+    int delta;                      //TRUE si se reciben parches, FALSE si se recibe la imagen completa
+    uint32_t numero;                //Número del manifiesto, identifica la transferencia para retomarla
+    uint32_t total;                 //Bytes de la transferencia
+    uint32_t recibidos;             //Siguiente offset esperado
+    uint32_t tamano_imagen;
+    uint32_t escritos;              //Bytes escritos en la partición nueva
+    char sha256[65];                //SHA-256 esperado de la imagen, en hexadecimal
+    mbedtls_sha256_context sha;
+    esp_ota_handle_t handle;
+    const esp_partition_t *destino;
+    const esp_partition_t *origen;  //Imagen en ejecución, fuente de las copias del parche
+    uint8_t cabecera[9];            //Cabecera de la operación del parche que se está leyendo
+    uint8_t cabecera_largo;
+    uint32_t literal_restante;      //Bytes que faltan de una operación 'D'
+    int64_t inicio_us;
+    int64_t ocupado_us;             //Tiempo escribiendo en flash y aplicando el parche
+}ota;
+
+//Manifiestos instalados: el número de cada uno tiene que superar al anterior, así uno capturado no se
+//puede repetir ni antes ni después de un reinicio. El número se guarda al terminar la transferencia,
+//así una que se cortó por un reinicio se vuelve a aceptar con el mismo manifiesto
+struct OTA_MANIFIESTO
+{
+    int habilitada;                 //FALSE con la clave de ejemplo o sin NVS
+    nvs_handle_t nvs;
+    uint32_t ultimo;                //Último manifiesto instalado
+}ota_manifiesto;
+
+QueueHandle_t cola_ota;
+
+//Con una imagen nueva lista para arrancar no se aceptan comandos que muevan el motor
+atomic_int reinicio_pendiente;
+
+//Pulso pedido por MQTT o LAN (núcleo 0); solo la máquina de estado lo pasa a data_io.SPP, así los
+//campos de data_io (SPP, MA, MC) los escribe un solo núcleo
+atomic_int spp_pedido;
+
+
+//Tipos de evento de la traza
+enum TRAZA_TIPO
+{
+    TRAZA_GPIO = 1,                 //Cambio de los limit switch: a = LSA | (LSC << 1)
+    TRAZA_COMANDO,                  //Comando pulso-pulso aceptado (LAN o MQTT)
+    TRAZA_TRANSICION,               //Entrada a un estado: a = estado nuevo, b = estado anterior | (COD_ERR << 8)
+    TRAZA_TIMER,                    //Vencimiento de un temporizador: a = TRAZA_TIMER_*, b = Cont_RT
+};
+
+//Evento de la traza, 8 bytes
+struct TRAZA_EVENTO
+{
+    uint32_t t_ms;                  //Milisegundos desde el arranque
+    uint8_t tipo;
+    uint8_t a;
+    uint16_t b;
+};
+
+//Estado de la máquina antes del evento más viejo que sigue en el buffer. Se actualiza con cada
+//evento que se sobrescribe, así la reproducción de una traza que dio la vuelta arranca desde ahí
+struct TRAZA_BASE
+{
+    uint32_t t_ms;                  //Entrada a "estado"
+    uint8_t estado;
+    uint8_t previo;
+    uint8_t sensores;               //LSA | (LSC << 1)
+    uint8_t cod_err;
+};
+
+//Cabecera del volcado, seguida de los eventos en orden cronológico
+struct TRAZA_CABECERA
+{
+    char magia[4];                  //"TRZ2"
+    uint32_t eventos;               //Eventos que siguen a la cabecera
+    uint32_t perdidos;              //Eventos sobrescritos antes del volcado (la traza no empieza en el arranque)
+    struct TRAZA_BASE base;         //Solo tiene sentido con perdidos > 0
+};
+
+//Buffer circular con los últimos TRAZA_EVENTOS eventos
+struct TRAZA
+{
+    portMUX_TYPE lock;
+    uint32_t escritos;              //Total de eventos registrados, el siguiente va en escritos % TRAZA_EVENTOS
+    struct TRAZA_BASE base;
+    struct TRAZA_EVENTO eventos[TRAZA_EVENTOS];
+}traza = { .lock = portMUX_INITIALIZER_UNLOCKED, .base = { .estado = STATE_START, .previo = STATE_START } };
+
+TaskHandle_t tarea_traza = NULL;
+
+
+//Contadores de operación, se incrementan con atómicos relajados desde cualquier tarea
+enum CONTADOR
+{
+    CONT_TRANSICIONES,              //Entradas a un estado de la máquina
+    CONT_BUG_OK,                    //Entradas al estado de error por COD_ERR (CONT_BUG_OK + COD_ERR)
+    CONT_BUG_LS,
+    CONT_BUG_RT,
+    CONT_MA_MS,                     //Tiempo total con el motor abriendo
+    CONT_MC_MS,                     //Tiempo total con el motor cerrando
+    CONT_MQTT_RECIBIDOS,            //Todos los mensajes MQTT recibidos: comandos, OTA, diagnóstico y traza
+    CONT_MQTT_DESCARTADOS,          //Mensajes que no caben en el buffer de recepción
+    CONT_COMANDOS_DUPLICADOS,       //Comandos que ya habían llegado por LAN o MQTT
+    CONT_LAN_RECIBIDOS,
+    CONT_LAN_RECHAZADOS,            //Firma inválida
+    CONT_MQTT_DESCONEXIONES,
+    CONT_WIFI_DESCONEXIONES,
+    CONT_OUTBOX_ENVIADOS,           //Eventos del outbox confirmados por el broker
+    CONT_OUTBOX_TELEMETRIA_DESC,    //Telemetría descartada con el outbox lleno
+    CONT_OUTBOX_EVENTOS_DESC,       //Estados o fallas descartados (outbox lleno de fallas o cola llena)
+    CONT_TOTAL
+};
+
+//Nombres cortos usados en el mensaje de métricas, en el mismo orden que enum CONTADOR
+const char *NOMBRE_CONTADOR[CONT_TOTAL] = {
+    "tr", "bug_ok", "bug_ls", "bug_rt", "ma_ms", "mc_ms",
+    "mqtt_rx", "mqtt_desc", "dup", "lan_rx", "lan_rech", "mqtt_dc", "wifi_dc",
+    "ob_env", "ob_tel_desc", "ob_ev_desc",
+};
+
+atomic_uint_least32_t contadores[CONT_TOTAL];
+esp_mqtt_client_handle_t cliente_mqtt = NULL;
+
+
+//Nombre de la función de cada estado, en el orden de las macros de estado (lo reporta el perfilador)
+const char *const NOMBRE_FUNCION_ESTADO[] = {
+    "Funcion_Start", "Funcion_CLOSE", "Funcion_OPEN", "Funcion_CLOSING", "Funcion_OPENING", "Funcion_BUG",
+};
+
+
+//Comandos con identificador. La aplicación manda el mismo comando por LAN y por MQTT y solo se acepta
+//el primero que llega. Los de LAN van firmados y su id tiene que crecer siempre: ultimo_lan solo lo
+//avanzan paquetes con firma válida y nunca pasa de tope_lan, que está guardado en NVS, así un paquete
+//capturado no se puede repetir ni antes ni después de un reinicio. Los de MQTT no van firmados y no
+//tocan ultimo_lan
+struct COMANDOS
+{
+    portMUX_TYPE lock;
+    uint32_t recientes[COMANDOS_RECIENTES];
+    int64_t recientes_us[COMANDOS_RECIENTES];
+    uint32_t siguiente;
+    uint32_t ultimo_lan;            //Solo lo usa Control_LAN_Task
+    uint32_t tope_lan;              //Ids reservados en NVS hasta aquí, también solo de Control_LAN_Task
+    nvs_handle_t nvs;
+}comandos = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+
+//CA fijada del broker para mqtts://, embebida con EMBED_TXTFILES broker_ca.pem en el CMakeLists del componente
+extern const uint8_t broker_ca_pem_start[] asm("_binary_broker_ca_pem_start");
+
+
+//Prototipos de la funciones que se utilizarán en la máquina de estados
+int Funcion_Start(void);
+int Funcion_OPEN(void);
+int Funcion_OPENING(void);
+int Funcion_CLOSE(void);
+int Funcion_CLOSING(void);
+int Funcion_BUG(void);
+void Maquina_Estado_Task(void *pvParameters);
+
+
+//Función para configurar los GPIOs
+void Configuracion_GPIO(void)
+{
+    gpio_set_direction(SENSOR_OPEN, GPIO_MODE_INPUT);
+    gpio_set_direction(SENSOR_CLOSE, GPIO_MODE_INPUT);
+    gpio_set_direction(MOTOR_ABRIR, GPIO_MODE_OUTPUT);
+    gpio_set_direction(MOTOR_CERRAR, GPIO_MODE_OUTPUT);
+    gpio_set_direction(LED_OPEN, GPIO_MODE_OUTPUT);
+    gpio_set_direction(LED_CLOSE, GPIO_MODE_OUTPUT);
+    gpio_set_direction(LED_ERROR, GPIO_MODE_OUTPUT);
+
+    gpio_set_direction(LED_MQTT, GPIO_MODE_OUTPUT);
+    gpio_set_level(LED_MQTT, FALSE);
+}
+
+
+//Función para incrementar un contador, es segura desde cualquier tarea y no bloquea
+static inline void Contador_Sumar(enum CONTADOR contador, uint32_t valor)
+{
+    atomic_fetch_add_explicit(&contadores[contador], valor, memory_order_relaxed);
+}
+
+
+//Función para agregar un evento a la traza
+void Traza_Registrar(uint8_t tipo, uint8_t a, uint16_t b)
+{
+    struct TRAZA_EVENTO evento = { (uint32_t)(esp_timer_get_time() / 1000), tipo, a, b };
+
+    taskENTER_CRITICAL(&traza.lock);
+    struct TRAZA_EVENTO *lugar = &traza.eventos[traza.escritos % TRAZA_EVENTOS];
+
+    //El evento que se pisa pasa a la base: solo importan las entradas y las transiciones
+    if (traza.escritos >= TRAZA_EVENTOS)
+    {
+        if (lugar->tipo == TRAZA_GPIO)
+        {
+            traza.base.sensores = lugar->a;
+        }
+        else if (lugar->tipo == TRAZA_TRANSICION)
+        {
+            traza.base.t_ms = lugar->t_ms;
+            traza.base.estado = lugar->a;
+            traza.base.previo = lugar->b & 0xFF;
+            traza.base.cod_err = lugar->b >> 8;
+        }
+    }
+    *lugar = evento;
+    ++traza.escritos;
+    taskEXIT_CRITICAL(&traza.lock);
+}
+
+
+//Tarea que publica la traza completa en un solo mensaje binario cuando el handler MQTT se lo pide
+//El volcado se arma en memoria estática (no depende del heap) y sale con QoS 0, así esp-mqtt lo
+//manda desde este buffer sin copiarlo a su outbox
+void Traza_Task(void *pvParameters)
+{
+    static uint8_t volcado[sizeof(struct TRAZA_CABECERA) + sizeof(traza.eventos)];
+    struct TRAZA_CABECERA *cabecera = (struct TRAZA_CABECERA *)volcado;
+    struct TRAZA_EVENTO *eventos = (struct TRAZA_EVENTO *)(cabecera + 1);
+
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        //Copiamos los eventos del más viejo al más nuevo
+        taskENTER_CRITICAL(&traza.lock);
+        uint32_t total = (traza.escritos < TRAZA_EVENTOS) ? traza.escritos : TRAZA_EVENTOS;
+        uint32_t primero = traza.escritos - total;
+        for (uint32_t i = 0; i < total; i++)
+        {
+            eventos[i] = traza.eventos[(primero + i) % TRAZA_EVENTOS];
+        }
+        cabecera->base = traza.base;
+        taskEXIT_CRITICAL(&traza.lock);
+
+        memcpy(cabecera->magia, "TRZ2", 4);
+        cabecera->eventos = total;
+        cabecera->perdidos = primero;
+        esp_mqtt_client_publish(cliente_mqtt, TOPIC_TRAZA_DATOS, (const char *)volcado,
+                                sizeof(struct TRAZA_CABECERA) + total * sizeof(struct TRAZA_EVENTO), 0, 0);
+    }
+}
+
+
+//Función que pasa las cuentas del outbox a los contadores de las métricas
+//CONT_OUTBOX_* está en el mismo orden que enum OUTBOX_CUENTA
+void Contar_Outbox(enum OUTBOX_CUENTA cuenta, uint32_t cantidad)
+{
+    Contador_Sumar(CONT_OUTBOX_ENVIADOS + cuenta, cantidad);
+}
+
+
+//Función para registrar la entrada a un estado en los contadores, en la traza y en el outbox
+void Registrar_Transicion(void)
+{
+    Contador_Sumar(CONT_TRANSICIONES, 1);
+    Traza_Registrar(TRAZA_TRANSICION, STATE, PAST_STATE | (data_io.COD_ERR << 8));
+
+    if (STATE == BUG)
+    {
+        Outbox_Evento(OUTBOX_FALLA, "\"ev\":\"falla\",\"cod\":%u,\"previo\":%d", data_io.COD_ERR, PAST_STATE);
+    }
+    else
+    {
+        Outbox_Evento(OUTBOX_ESTADO, "\"ev\":\"estado\",\"estado\":%d,\"previo\":%d", STATE, PAST_STATE);
+    }
+}
+
+
+//Función para registrar el periodo del lazo de control, se llama en cada Actualización_GPIO
+//Devuelve el tiempo desde la muestra anterior en microsegundos (0 en la primera)
+uint32_t Jitter_Muestra(void)
+{
+    uint32_t periodo = 0;
+    int64_t ahora = esp_timer_get_time();
+
+    if (jitter.ultimo_us != 0)
+    {
+        periodo = (uint32_t)(ahora - jitter.ultimo_us);
+
+        taskENTER_CRITICAL(&jitter.lock);
+        if (periodo > JITTER_DESCARTE_US)
+        {
+            ++jitter.descartadas;
+        }
+        else
+        {
+            if ((jitter.muestras == 0) || (periodo < jitter.min_us))
+            {
+                jitter.min_us = periodo;
+            }
+            if (periodo > jitter.max_us)
+            {
+                jitter.max_us = periodo;
+            }
+            jitter.suma_us += periodo;
+            jitter.suma_cuad_us += (uint64_t)periodo * periodo;
+            ++jitter.muestras;
+        }
+        taskEXIT_CRITICAL(&jitter.lock);
+    }
+    jitter.ultimo_us = ahora;
+    return periodo;
+}
+
+
+//Tarea que reporta periódicamente la variación del periodo del lazo de control
+void Jitter_Task(void *pvParameters)
+{
+    for(;;)
+    {
+        vTaskDelay(JITTER_INTERVALO_MS/portTICK_PERIOD_MS);
+
+        //Copiamos la ventana y la reiniciamos
+        taskENTER_CRITICAL(&jitter.lock);
+        struct JITTER copia = jitter;
+        jitter.muestras = 0;
+        jitter.descartadas = 0;
+        jitter.min_us = 0;
+        jitter.max_us = 0;
+        jitter.suma_us = 0;
+        jitter.suma_cuad_us = 0;
+        taskEXIT_CRITICAL(&jitter.lock);
+
+        if (copia.muestras == 0)
+        {
+            continue;
+        }
+
+        double media = (double)copia.suma_us / copia.muestras;
+        double varianza = (double)copia.suma_cuad_us / copia.muestras - media * media;
+        ESP_LOGI(TAG, "Jitter del lazo de control: n=%" PRIu32 " nominal=%d us media=%.1f us min=%" PRIu32
+                 " us max=%" PRIu32 " us varianza=%.1f us^2 descartadas=%" PRIu32,
+                 copia.muestras, PERIODO_CONTROL_US, media, copia.min_us, copia.max_us,
+                 (varianza > 0) ? varianza : 0.0, copia.descartadas);
+
+        //También por MQTT, para comparar el jitter con y sin tráfico desde la PC
+        if (cliente_mqtt != NULL)
+        {
+            char mensaje[192];
+            snprintf(mensaje, sizeof(mensaje), "{\"lazo\":\"control\",\"n\":%" PRIu32 ",\"nominal_us\":%d,\"media_us\":%.1f,"
+                     "\"min_us\":%" PRIu32 ",\"max_us\":%" PRIu32 ",\"varianza_us2\":%.1f}",
+                     copia.muestras, PERIODO_CONTROL_US, media, copia.min_us, copia.max_us,
+                     (varianza > 0) ? varianza : 0.0);
+            esp_mqtt_client_publish(cliente_mqtt, TOPIC_JITTER, mensaje, 0, 0, 0);
+        }
+    }
+}
+
+
+//Estado en curso para el perfilador, se llama desde la interrupción del muestreo
+int IRAM_ATTR Estado_Perfilador(void)
+{
+    return STATE;
+}
+
+
+//Función para actualizar los valores de los GPIOs y las variables de control
+void Actualización_GPIO(void)
+{
+    data_io.DATOS_READY = FALSE;
+    vTaskDelay(10/portTICK_PERIOD_MS);
+
+    //El pulso pedido desde la red pasa a la máquina de estado
+    if (atomic_exchange(&spp_pedido, FALSE))
+    {
+        data_io.SPP = TRUE;
+    }
+
+    //Un comando que llegó justo antes del bloqueo por OTA no llega a mover el motor
+    if (atomic_load(&reinicio_pendiente))
+    {
+        data_io.SPP = FALSE;
+    }
+
+    //Tiempo de motor encendido desde la llamada anterior
+    uint32_t periodo_us = Jitter_Muestra() + gpio_previo.resto_us;
+    gpio_previo.resto_us = periodo_us % 1000;
+    if (gpio_previo.motor_abriendo)
+    {
+        Contador_Sumar(CONT_MA_MS, periodo_us / 1000);
+    }
+    if (gpio_previo.motor_cerrando)
+    {
+        Contador_Sumar(CONT_MC_MS, periodo_us / 1000);
+    }
+    gpio_previo.motor_abriendo = data_io.MA;
+    gpio_previo.motor_cerrando = data_io.MC;
+
+    data_io.LSA = gpio_get_level(SENSOR_OPEN);
+    data_io.LSC = gpio_get_level(SENSOR_CLOSE);
+    uint8_t sensores = data_io.LSA | (data_io.LSC << 1);
+    if (sensores != gpio_previo.sensores_previos)
+    {
+        Traza_Registrar(TRAZA_GPIO, sensores, 0);
+        gpio_previo.sensores_previos = sensores;
+    }
+    gpio_set_level(MOTOR_ABRIR, data_io.MA);
+    gpio_set_level(MOTOR_CERRAR, data_io.MC);
+    gpio_set_level(LED_OPEN, data_io.Led_A);
+    gpio_set_level(LED_CLOSE, data_io.Led_C);
+    gpio_set_level(LED_ERROR, data_io.Led_ER);
+    data_io.DATOS_READY = TRUE;
+}
+
+
+//Función para trabajar con el dato recibido por MQTT
+void Dato_MQTT(char *mensaje_recibido)
+{
+    if (atomic_load(&reinicio_pendiente))
+    {
+        ESP_LOGW(TAG, "Comando ignorado: reinicio por OTA pendiente");
+        return;
+    }
+
+    if((strcmp(mensaje_recibido, "1")) == 0)
+    {
+        //Imprimimos en pantalla que se ha mandado a cerrar el porton
+        if (STATE == OPEN)
+        {
+            printf("\nMANDATO: CERRAR EL PORTON\n");
+        }
+
+        //Imprimimos en pantalla que se ha mandado a abrir el porton
+        if (STATE == CLOSE)
+        {
+            printf("\nMANDATO: ABRIR EL PORTON\n");
+        }
+        
+        //Actualizamos la variable de control para abrir/cerrar el porton
+        Traza_Registrar(TRAZA_COMANDO, 0, 0);
+        atomic_store(&spp_pedido, TRUE);
+        mensaje_recibido = "0";
+    }
+}
+
+
+//Función para separar el identificador de un comando "<comando>:<id>", devuelve 0 si no trae
+uint32_t Id_Comando(char *mensaje)
+{
+    char *separador = strchr(mensaje, ':');
+
+    if (separador == NULL)
+    {
+        return 0;
+    }
+    *separador = '\0';
+    return strtoul(separador + 1, NULL, 10);
+}
+
+
+//Función que acepta un identificador si no se aceptó hace poco por LAN o por MQTT (descarta duplicados)
+int Comando_Nuevo(uint32_t id)
+{
+    int64_t ahora = esp_timer_get_time();
+    int nuevo = TRUE;
+
+    taskENTER_CRITICAL(&comandos.lock);
+    for (int i = 0; i < COMANDOS_RECIENTES; i++)
+    {
+        if ((comandos.recientes[i] == id) && (comandos.recientes_us[i] != 0) &&
+            (ahora - comandos.recientes_us[i] < COMANDO_VENTANA_US))
+        {
+            nuevo = FALSE;
+        }
+    }
+    if (nuevo)
+    {
+        comandos.recientes[comandos.siguiente] = id;
+        comandos.recientes_us[comandos.siguiente] = ahora;
+        comandos.siguiente = (comandos.siguiente + 1) % COMANDOS_RECIENTES;
+    }
+    taskEXIT_CRITICAL(&comandos.lock);
+    return nuevo;
+}
+
+
+//Función que acepta un id LAN antes de ejecutar el comando, FALSE si no se pudo guardar
+//Solo escribe en NVS cuando el id pasa el tope: reserva LAN_ID_BLOQUE ids más y los siguientes comandos
+//no tocan la flash. Después de un reinicio todo id hasta el tope cuenta como usado, se haya usado o no
+int Comando_LAN_Guardar(uint32_t id)
+{
+    if (id > comandos.tope_lan)
+    {
+        uint32_t tope = (id > UINT32_MAX - LAN_ID_BLOQUE) ? UINT32_MAX : id + LAN_ID_BLOQUE;
+
+        if ((nvs_set_u32(comandos.nvs, LAN_NVS_CLAVE, tope) != ESP_OK) || (nvs_commit(comandos.nvs) != ESP_OK))
+        {
+            return FALSE;
+        }
+        comandos.tope_lan = tope;
+    }
+    comandos.ultimo_lan = id;
+    return TRUE;
+}
+
+
+//Función para pasar bytes a hexadecimal en minúscula
+void Bytes_A_Hex(const unsigned char *bytes, size_t largo, char *hex)
+{
+    for (int i = 0; i < largo; i++)
+    {
+        sprintf(&hex[2 * i], "%02x", bytes[i]);
+    }
+}
+
+
+//Función para verificar la firma HMAC-SHA256 (64 caracteres hexadecimales en minúscula) de un comando LAN o
+//de un manifiesto OTA
+int Firma_Valida(const char *clave, const char *mensaje, size_t largo, const char *firma_hex)
+{
+    unsigned char firma[32];
+    char esperada[2 * sizeof(firma) + 1];
+    unsigned char diferencia = 0;
+
+    if (strlen(firma_hex) != 2 * sizeof(firma))
+    {
+        return FALSE;
+    }
+
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                    (const unsigned char *)clave, strlen(clave),
+                    (const unsigned char *)mensaje, largo, firma);
+    Bytes_A_Hex(firma, sizeof(firma), esperada);
+
+    //Comparación en tiempo constante
+    for (int i = 0; i < 2 * sizeof(firma); i++)
+    {
+        diferencia |= esperada[i] ^ firma_hex[i];
+    }
+    return diferencia == 0;
+}
+
+
+//Función para anunciar el control local por mDNS
+void Configuracion_mDNS(void)
+{
+    ESP_ERROR_CHECK(mdns_init());
+    ESP_ERROR_CHECK(mdns_hostname_set(LAN_HOSTNAME));
+    ESP_ERROR_CHECK(mdns_instance_name_set("Porton 2022-1143"));
+    ESP_ERROR_CHECK(mdns_service_add(NULL, "_porton", "_udp", LAN_PUERTO, NULL, 0));
+}
+
+
+//Tarea que recibe comandos por UDP en la red local y los pasa por el mismo camino que los de MQTT
+//Formato: "<comando>:<id>:<firma>", la firma es HMAC-SHA256 de "<comando>:<id>" con LAN_CLAVE
+//Respuesta: "ACK:<id>" si se aceptó o "DUP:<id>" si ya había llegado, para medir el tiempo de ida y vuelta
+void Control_LAN_Task(void *pvParameters)
+{
+    char paquete[LAN_PAQUETE_MAX + 1];
+    char respuesta[32];
+    struct sockaddr_in origen;
+    socklen_t largo_origen;
+    struct sockaddr_in direccion = {
+        .sin_family = AF_INET,
+        .sin_port = htons(LAN_PUERTO),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    //Sin el último id guardado no se puede saber qué paquetes ya se usaron: no hay control LAN
+    if (nvs_open(LAN_NVS_ESPACIO, NVS_READWRITE, &comandos.nvs) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Control LAN deshabilitado: no se pudo abrir NVS");
+        vTaskDelete(NULL);
+        return;
+    }
+    nvs_get_u32(comandos.nvs, LAN_NVS_CLAVE, &comandos.tope_lan);
+    comandos.ultimo_lan = comandos.tope_lan;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if ((sock < 0) || (bind(sock, (struct sockaddr *)&direccion, sizeof(direccion)) < 0))
+    {
+        ESP_LOGE(TAG, "No se pudo abrir el puerto UDP %d: errno %d", LAN_PUERTO, errno);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Control LAN escuchando en %s.local:%d, ids aceptados desde %" PRIu32, LAN_HOSTNAME, LAN_PUERTO, comandos.ultimo_lan + 1);
+
+    for(;;)
+    {
+        largo_origen = sizeof(origen);
+        int largo = recvfrom(sock, paquete, LAN_PAQUETE_MAX, 0, (struct sockaddr *)&origen, &largo_origen);
+        if (largo <= 0)
+        {
+            continue;
+        }
+        paquete[largo] = '\0';
+
+        //Verificamos la firma antes de tocar el comando
+        char *firma = strrchr(paquete, ':');
+        if ((firma == NULL) || !Firma_Valida(LAN_CLAVE, paquete, firma - paquete, firma + 1))
+        {
+            ESP_LOGW(TAG, "Comando LAN rechazado: firma invalida");
+            Contador_Sumar(CONT_LAN_RECHAZADOS, 1);
+            continue;
+        }
+        *firma = '\0';
+        Contador_Sumar(CONT_LAN_RECIBIDOS, 1);
+
+        //Los comandos LAN siempre traen identificador y tiene que ser mayor que el último, así no se pueden repetir
+        uint32_t id = Id_Comando(paquete);
+        if (id <= comandos.ultimo_lan)
+        {
+            snprintf(respuesta, sizeof(respuesta), "DUP:%" PRIu32, id);
+            Contador_Sumar(CONT_COMANDOS_DUPLICADOS, 1);
+        }
+        else if (!Comando_LAN_Guardar(id))
+        {
+            ESP_LOGE(TAG, "Comando LAN descartado: no se pudo guardar el id en NVS");
+            continue;
+        }
+        else if (Comando_Nuevo(id))
+        {
+            Dato_MQTT(paquete);
+            snprintf(respuesta, sizeof(respuesta), "ACK:%" PRIu32, id);
+        }
+        else
+        {
+            //Ya había llegado por MQTT
+            snprintf(respuesta, sizeof(respuesta), "DUP:%" PRIu32, id);
+            Contador_Sumar(CONT_COMANDOS_DUPLICADOS, 1);
+        }
+        sendto(sock, respuesta, strlen(respuesta), 0, (struct sockaddr *)&origen, largo_origen);
+    }
+}
+
+
+//Función para saber si el topic de un evento MQTT empieza con un prefijo
+int Topic_Empieza(esp_mqtt_event_handle_t event, const char *prefijo)
+{
+    size_t largo = strlen(prefijo);
+    return (event->topic_len >= largo) && (strncmp(event->topic, prefijo, largo) == 0);
+}
+
+
+//Función para publicar el estado de la OTA
+void OTA_Publicar(const char *estado)
+{
+    esp_mqtt_client_publish(cliente_mqtt, TOPIC_OTA_ESTADO, estado, 0, 0, 0);
+}
+
+
+//Función para cancelar la OTA en curso
+void OTA_Error(const char *motivo)
+{
+    char estado[64];
+
+    ESP_LOGE(TAG, "OTA cancelada: %s", motivo);
+    if (ota.activa)
+    {
+        esp_ota_abort(ota.handle);
+        mbedtls_sha256_free(&ota.sha);
+        ota.activa = FALSE;
+    }
+    snprintf(estado, sizeof(estado), "error:%s", motivo);
+    OTA_Publicar(estado);
+}
+
+
+//Función para pasar un mensaje de OTA a OTA_Task sin bloquear al cliente MQTT
+void OTA_Recibir(esp_mqtt_event_handle_t event)
+{
+    char offset[12];
+    int inicio = (event->topic_len == strlen(TOPIC_OTA_INICIO)) && Topic_Empieza(event, TOPIC_OTA_INICIO);
+    int bloque = Topic_Empieza(event, TOPIC_OTA_BLOQUE);
+    int largo_offset = event->topic_len - strlen(TOPIC_OTA_BLOQUE);
+
+    //Los bloques más grandes que el buffer MQTT llegan fragmentados y se descartan
+    if ((!inicio && !bloque) || (event->data_len != event->total_data_len) || (event->data_len > OTA_BLOQUE_MAX))
+    {
+        return;
+    }
+
+    struct OTA_MENSAJE *mensaje = malloc(sizeof(struct OTA_MENSAJE) + event->data_len + 1);
+    if (mensaje == NULL)
+    {
+        return;
+    }
+    mensaje->inicio = inicio;
+    mensaje->offset = 0;
+    if (bloque && (largo_offset > 0) && (largo_offset < sizeof(offset)))
+    {
+        memcpy(offset, event->topic + strlen(TOPIC_OTA_BLOQUE), largo_offset);
+        offset[largo_offset] = '\0';
+        mensaje->offset = strtoul(offset, NULL, 10);
+    }
+    mensaje->largo = event->data_len;
+    memcpy(mensaje->datos, event->data, event->data_len);
+    mensaje->datos[event->data_len] = '\0';
+
+    //Si la cola está llena el emisor reenvía el bloque cuando no recibe confirmación
+    if (xQueueSend(cola_ota, &mensaje, 0) != pdTRUE)
+    {
+        free(mensaje);
+    }
+}
+
+
+//Función para rechazar un manifiesto; con una transferencia en curso solo se anota, así un inicio
+//falso o repetido no la corta
+void OTA_Rechazar(const char *motivo)
+{
+    if (ota.activa)
+    {
+        ESP_LOGW(TAG, "OTA: inicio ignorado (%s)", motivo);
+        return;
+    }
+    OTA_Error(motivo);
+}
+
+
+//Función para calcular el SHA-256 de los primeros "largo" bytes de la imagen en ejecución
+int OTA_Sha_Base(const esp_partition_t *particion, uint32_t largo, char hex[65])
+{
+    static uint8_t buffer[OTA_COPIA_PASO];
+    mbedtls_sha256_context sha;
+    unsigned char resumen[32];
+    int correcto = (particion != NULL) && (largo <= particion->size);
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t leidos = 0; correcto && (leidos < largo); )
+    {
+        uint32_t paso = (largo - leidos < sizeof(buffer)) ? largo - leidos : sizeof(buffer);
+        correcto = (esp_partition_read(particion, leidos, buffer, paso) == ESP_OK);
+        mbedtls_sha256_update(&sha, buffer, paso);
+        leidos += paso;
+    }
+    mbedtls_sha256_finish(&sha, resumen);
+    mbedtls_sha256_free(&sha);
+    Bytes_A_Hex(resumen, sizeof(resumen), hex);
+    return correcto;
+}
+
+
+//Función para empezar (o retomar) una transferencia OTA. El manifiesto es
+//  "<completa|delta>:<bytes a recibir>:<bytes de la imagen>:<sha256 de la imagen>:
+//   <bytes de la base>:<sha256 de la base>:<número>:<HMAC-SHA256 de todo lo anterior con OTA_CLAVE>"
+//La base es la imagen sobre la que se armó el parche (0 y "-" para una imagen completa)
+void OTA_Inicio(const char *texto)
+{
+    char tipo[10];
+    char sha256[65];
+    char base_sha256[65];
+    char base_real[65];
+    char firma[65];
+    char estado[16];
+    uint32_t total;
+    uint32_t tamano_imagen;
+    uint32_t base_bytes;
+    uint32_t numero;
+    int firmado = 0;
+
+    if (!ota_manifiesto.habilitada)
+    {
+        OTA_Error("deshabilitada");
+        return;
+    }
+    if ((sscanf(texto, "%9[^:]:%" SCNu32 ":%" SCNu32 ":%64[^:]:%" SCNu32 ":%64[^:]:%" SCNu32 ":%n%64s",
+                tipo, &total, &tamano_imagen, sha256, &base_bytes, base_sha256, &numero, &firmado, firma) != 8) ||
+        ((strcmp(tipo, "completa") != 0) && (strcmp(tipo, "delta") != 0)))
+    {
+        OTA_Rechazar("inicio invalido");
+        return;
+    }
+    if (!Firma_Valida(OTA_CLAVE, texto, firmado - 1, firma))
+    {
+        OTA_Rechazar("firma");
+        return;
+    }
+
+    //La misma transferencia que ya se estaba recibiendo: se retoma desde el último bloque escrito
+    if (ota.activa && (ota.numero == numero))
+    {
+        snprintf(estado, sizeof(estado), "%" PRIu32, ota.recibidos);
+        OTA_Publicar(estado);
+        return;
+    }
+    //Tampoco se acepta uno anterior al de la transferencia en curso, no la puede cortar
+    if ((numero <= ota_manifiesto.ultimo) || (ota.activa && (numero < ota.numero)))
+    {
+        OTA_Rechazar("manifiesto repetido");
+        return;
+    }
+
+    //Un parche solo sirve sobre la imagen con la que se armó, se compara antes de aceptar bloques
+    if ((strcmp(tipo, "delta") == 0) &&
+        (!OTA_Sha_Base(esp_ota_get_running_partition(), base_bytes, base_real) || (strcmp(base_real, base_sha256) != 0)))
+    {
+        OTA_Error("base distinta");
+        return;
+    }
+
+    if (ota.activa)
+    {
+        esp_ota_abort(ota.handle);
+        mbedtls_sha256_free(&ota.sha);
+        ota.activa = FALSE;
+    }
+
+    memset(&ota, 0, sizeof(ota));
+    ota.delta = (strcmp(tipo, "delta") == 0);
+    ota.numero = numero;
+    ota.total = total;
+    ota.tamano_imagen = tamano_imagen;
+    strcpy(ota.sha256, sha256);
+    ota.origen = esp_ota_get_running_partition();
+    ota.destino = esp_ota_get_next_update_partition(NULL);
+    ota.inicio_us = esp_timer_get_time();
+
+    //Borrado por sectores a medida que se escribe: no se detiene la flash varios segundos de una vez
+    if ((ota.destino == NULL) || (esp_ota_begin(ota.destino, OTA_WITH_SEQUENTIAL_WRITES, &ota.handle) != ESP_OK))
+    {
+        OTA_Error("sin particion");
+        return;
+    }
+    mbedtls_sha256_init(&ota.sha);
+    mbedtls_sha256_starts(&ota.sha, 0);
+    ota.activa = TRUE;
+
+    ESP_LOGI(TAG, "OTA %s %" PRIu32 ": %" PRIu32 " bytes para una imagen de %" PRIu32 " bytes en %s",
+             tipo, numero, total, tamano_imagen, ota.destino->label);
+    OTA_Publicar("0");
+}
+
+
+//Función para escribir bytes de la imagen nueva
+int OTA_Escribir(const void *datos, size_t largo)
+{
+    if ((ota.escritos + largo > ota.tamano_imagen) || (esp_ota_write(ota.handle, datos, largo) != ESP_OK))
+    {
+        return FALSE;
+    }
+    mbedtls_sha256_update(&ota.sha, datos, largo);
+    ota.escritos += largo;
+    return TRUE;
+}
+
+
+//Función para copiar a la imagen nueva un tramo de la imagen en ejecución
+int OTA_Copiar(uint32_t origen, uint32_t largo)
+{
+    static uint8_t buffer[OTA_COPIA_PASO];
+
+    if ((origen + largo < origen) || (origen + largo > ota.origen->size))
+    {
+        return FALSE;
+    }
+    while (largo > 0)
+    {
+        uint32_t paso = (largo < sizeof(buffer)) ? largo : sizeof(buffer);
+        if ((esp_partition_read(ota.origen, origen, buffer, paso) != ESP_OK) || !OTA_Escribir(buffer, paso))
+        {
+            return FALSE;
+        }
+        origen += paso;
+        largo -= paso;
+    }
+    return TRUE;
+}
+
+
+//Función para aplicar un bloque de parche; las operaciones pueden quedar partidas entre bloques
+int OTA_Aplicar_Parche(const uint8_t *datos, size_t largo)
+{
+    while (largo > 0)
+    {
+        //Bytes nuevos de una operación 'D'
+        if (ota.literal_restante > 0)
+        {
+            uint32_t paso = (largo < ota.literal_restante) ? largo : ota.literal_restante;
+            if (!OTA_Escribir(datos, paso))
+            {
+                return FALSE;
+            }
+            ota.literal_restante -= paso;
+            datos += paso;
+            largo -= paso;
+            continue;
+        }
+
+        //Cabecera de la siguiente operación
+        ota.cabecera[ota.cabecera_largo++] = *datos++;
+        --largo;
+        if ((ota.cabecera[0] != 'C') && (ota.cabecera[0] != 'D'))
+        {
+            return FALSE;
+        }
+        if (ota.cabecera_largo < ((ota.cabecera[0] == 'C') ? 9 : 5))
+        {
+            continue;
+        }
+        ota.cabecera_largo = 0;
+
+        uint32_t primero;
+        uint32_t segundo;
+        memcpy(&primero, &ota.cabecera[1], 4);
+        if (ota.cabecera[0] == 'D')
+        {
+            ota.literal_restante = primero;
+        }
+        else
+        {
+            memcpy(&segundo, &ota.cabecera[5], 4);
+            if (!OTA_Copiar(primero, segundo))
+            {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+
+//Función para verificar la imagen recibida y dejarla como la próxima en arrancar
+void OTA_Finalizar(void)
+{
+    unsigned char sha[32];
+    char sha_hex[65];
+    char estado[48];
+
+    mbedtls_sha256_finish(&ota.sha, sha);
+    mbedtls_sha256_free(&ota.sha);
+    Bytes_A_Hex(sha, sizeof(sha), sha_hex);
+
+    if ((ota.escritos != ota.tamano_imagen) || (ota.literal_restante != 0) || (ota.cabecera_largo != 0) ||
+        (strcmp(sha_hex, ota.sha256) != 0))
+    {
+        esp_ota_abort(ota.handle);
+        ota.activa = FALSE;
+        OTA_Error("sha256");
+        return;
+    }
+    ota.activa = FALSE;
+    if ((esp_ota_end(ota.handle) != ESP_OK) || (esp_ota_set_boot_partition(ota.destino) != ESP_OK))
+    {
+        OTA_Error("imagen invalida");
+        return;
+    }
+
+    //Recién con la imagen verificada el manifiesto queda usado. Si no se puede guardar no se instala:
+    //después del reinicio el mismo manifiesto podría volver a instalarla sobre una más nueva
+    if ((nvs_set_u32(ota_manifiesto.nvs, OTA_NVS_CLAVE, ota.numero) != ESP_OK) || (nvs_commit(ota_manifiesto.nvs) != ESP_OK))
+    {
+        esp_ota_set_boot_partition(ota.origen);
+        OTA_Error("nvs");
+        return;
+    }
+    ota_manifiesto.ultimo = ota.numero;
+
+    snprintf(estado, sizeof(estado), "ok:%" PRId64 ":%" PRId64, ota.ocupado_us / 1000,
+             (esp_timer_get_time() - ota.inicio_us) / 1000);
+    OTA_Publicar(estado);
+    ESP_LOGI(TAG, "OTA completa (%s), reiniciando con el motor apagado", estado);
+
+    //No se reinicia con el porton en movimiento: se bloquean los comandos, la máquina de estado descarta
+    //el que haya quedado pendiente y se espera que termine el recorrido en curso
+    atomic_store(&reinicio_pendiente, TRUE);
+    vTaskDelay(OTA_ESPERA_CONTROL_MS/portTICK_PERIOD_MS);
+    while (data_io.MA || data_io.MC)
+    {
+        vTaskDelay(100/portTICK_PERIOD_MS);
+    }
+    vTaskDelay(1000/portTICK_PERIOD_MS);
+    esp_restart();
+}
+
+
+//Función para confirmar una imagen nueva, se llama al conectarse al broker
+void OTA_Confirmar_Imagen(void)
+{
+    esp_ota_img_states_t estado;
+
+    if ((esp_ota_get_state_partition(esp_ota_get_running_partition(), &estado) == ESP_OK) &&
+        (estado == ESP_OTA_IMG_PENDING_VERIFY))
+    {
+        esp_ota_mark_app_valid_cancel_rollback();
+        ESP_LOGI(TAG, "Imagen OTA confirmada");
+    }
+}
+
+
+//Tarea que escribe la OTA en la partición inactiva mientras la máquina de estado sigue corriendo
+void OTA_Task(void *pvParameters)
+{
+    struct OTA_MENSAJE *mensaje;
+    esp_ota_img_states_t estado;
+    char siguiente[16];
+    int pendiente = (esp_ota_get_state_partition(esp_ota_get_running_partition(), &estado) == ESP_OK) &&
+                    (estado == ESP_OTA_IMG_PENDING_VERIFY);
+
+    //Sin clave propia o sin NVS para recordar el último manifiesto no se acepta ninguna OTA
+    if (strcmp(OTA_CLAVE, OTA_CLAVE_EJEMPLO) == 0)
+    {
+        ESP_LOGE(TAG, "OTA deshabilitada: OTA_CLAVE sigue siendo la clave de ejemplo");
+    }
+    else if (nvs_open(OTA_NVS_ESPACIO, NVS_READWRITE, &ota_manifiesto.nvs) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "OTA deshabilitada: sin NVS para el número de manifiesto");
+    }
+    else
+    {
+        nvs_get_u32(ota_manifiesto.nvs, OTA_NVS_CLAVE, &ota_manifiesto.ultimo);
+        ota_manifiesto.habilitada = TRUE;
+    }
+
+    for(;;)
+    {
+        //Una imagen nueva que no llega a conectarse al broker se revierte a la anterior
+        if (pendiente && (esp_timer_get_time() / 1000 > OTA_CONFIRMACION_MS))
+        {
+            esp_ota_get_state_partition(esp_ota_get_running_partition(), &estado);
+            if (estado == ESP_OTA_IMG_PENDING_VERIFY)
+            {
+                ESP_LOGE(TAG, "Imagen OTA sin confirmar, volviendo a la anterior");
+                esp_ota_mark_app_invalid_rollback_and_reboot();
+            }
+            pendiente = FALSE;
+        }
+
+        if (xQueueReceive(cola_ota, &mensaje, 1000/portTICK_PERIOD_MS) != pdTRUE)
+        {
+            continue;
+        }
+
+        if (mensaje->inicio)
+        {
+            OTA_Inicio(mensaje->datos);
+        }
+        else if (ota.activa && (mensaje->offset == ota.recibidos) && (ota.recibidos + mensaje->largo <= ota.total))
+        {
+            int64_t inicio = esp_timer_get_time();
+            int correcto = ota.delta ? OTA_Aplicar_Parche((const uint8_t *)mensaje->datos, mensaje->largo)
+                                     : OTA_Escribir(mensaje->datos, mensaje->largo);
+            ota.ocupado_us += esp_timer_get_time() - inicio;
+
+            if (!correcto)
+            {
+                OTA_Error(ota.delta ? "parche" : "escritura");
+            }
+            else
+            {
+                ota.recibidos += mensaje->largo;
+                if (ota.recibidos == ota.total)
+                {
+                    OTA_Finalizar();
+                }
+                else
+                {
+                    snprintf(siguiente, sizeof(siguiente), "%" PRIu32, ota.recibidos);
+                    OTA_Publicar(siguiente);
+                }
+            }
+        }
+        else if (ota.activa)
+        {
+            //Bloque repetido o fuera de orden: se indica desde dónde seguir
+            snprintf(siguiente, sizeof(siguiente), "%" PRIu32, ota.recibidos);
+            OTA_Publicar(siguiente);
+        }
+        free(mensaje);
+    }
+}
+
+
+static void log_error_if_nonzero(const char *message, int error_code)
+{
+    if (error_code != 0) {
+        ESP_LOGE(TAG, "Last error %s: 0x%x", message, error_code);
+    }
+}
+
+/*
+ * @brief Event handler registered to receive MQTT events
+ *
+ *  This function is called by the MQTT client event loop.
+ *
+ * @param handler_args user data registered to the event.
+ * @param base Event base for the handler(always MQTT Base in this example).
+ * @param event_id The id for the received event.
+ * @param event_data The data for the event, esp_mqtt_event_handle_t.
+ */
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
+    esp_mqtt_event_handle_t event = event_data;
+    esp_mqtt_client_handle_t client = event->client;
+    int msg_id;
+    int64_t duracion_us;
+    struct SESION_TLS_ESTADISTICAS tls;
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        conexion_mqtt.inicio_us = esp_timer_get_time();
+        break;
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+
+        //Medimos cuánto tardó la conexión y la comparamos con la primera
+        duracion_us = esp_timer_get_time() - conexion_mqtt.inicio_us;
+        if (conexion_mqtt.conexiones++ == 0)
+        {
+            conexion_mqtt.primera_us = duracion_us;
+        }
+        else
+        {
+            conexion_mqtt.reconexion_suma_us += duracion_us;
+        }
+        ESP_LOGI(TAG, "Conexion #%" PRIu32 " en %" PRId64 " ms (sesion MQTT %s), primera: %" PRId64 " ms, promedio reconexion: %" PRId64 " ms",
+                 conexion_mqtt.conexiones, duracion_us / 1000, event->session_present ? "conservada" : "nueva",
+                 conexion_mqtt.primera_us / 1000,
+                 (conexion_mqtt.conexiones > 1) ? conexion_mqtt.reconexion_suma_us / (conexion_mqtt.conexiones - 1) / 1000 : (int64_t)0);
+
+        //Con mqtts:// la reconexión reanuda la sesión TLS si el broker la acepta (sesion_tls.c)
+        Sesion_TLS_Estadisticas(&tls);
+        if (tls.completos + tls.reanudados > 0)
+        {
+            ESP_LOGI(TAG, "TLS: %" PRIu32 " handshakes completos (promedio %" PRId64 " ms, max %" PRId64 " ms), %" PRIu32
+                     " reanudados (promedio %" PRId64 " ms, max %" PRId64 " ms), %" PRIu32 " fallidos",
+                     tls.completos, tls.completos ? tls.completo_suma_us / tls.completos / 1000 : (int64_t)0,
+                     tls.completo_max_us / 1000,
+                     tls.reanudados, tls.reanudados ? tls.reanudado_suma_us / tls.reanudados / 1000 : (int64_t)0,
+                     tls.reanudado_max_us / 1000, tls.fallidos);
+        }
+
+        //Se suscribe en cada conexión aunque el broker haya conservado la sesión: es barato y deja
+        //las suscripciones al día si una OTA cambió la lista de topics. Los comandos van con QoS 0
+        //para que el broker no los acumule mientras el porton está desconectado
+        msg_id = esp_mqtt_client_subscribe(client, "Estado_del_porton", 0);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        msg_id = esp_mqtt_client_subscribe(client, "Boton_de_control", 0);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        msg_id = esp_mqtt_client_subscribe(client, TOPIC_TRAZA, 0);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        msg_id = esp_mqtt_client_subscribe(client, TOPIC_OTA "#", 0);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        msg_id = esp_mqtt_client_subscribe(client, TOPIC_DIAGNOSTICO, 0);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        //La imagen arrancó y llegó al broker: ya no se revierte
+        OTA_Confirmar_Imagen();
+
+        //Outbox_Task empieza a vaciar los eventos guardados durante la desconexión
+        Outbox_Conexion(TRUE);
+
+        msg_id = esp_mqtt_client_publish(client, "Boton_de_control", "0", 0, 0, 0);
+        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+       
+
+        /*
+        msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
+        ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+        */
+        
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        Contador_Sumar(CONT_MQTT_DESCONEXIONES, 1);
+        Outbox_Conexion(FALSE);
+        break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+        ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+        msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
+        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+        break;
+    case MQTT_EVENT_UNSUBSCRIBED:
+        ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        Outbox_Publicado(event->msg_id);
+        break;
+    case MQTT_EVENT_DELETED:
+        //esp-mqtt descartó un QoS 1 sin PUBACK; si era del outbox vuelve a salir en otro lote
+        ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+        Outbox_Borrado(event->msg_id);
+        break;
+    case MQTT_EVENT_DATA:
+        //Un mensaje que no entra en el buffer llega partido en varios eventos, se cuenta una vez
+        if (event->current_data_offset == 0)
+        {
+            Contador_Sumar(CONT_MQTT_RECIBIDOS, 1);
+        }
+
+        //Los mensajes de OTA son binarios, se pasan a OTA_Task sin imprimirlos
+        if (Topic_Empieza(event, TOPIC_OTA))
+        {
+            OTA_Recibir(event);
+            break;
+        }
+
+        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
+        printf("DATA=%.*s\r\n", event->data_len, event->data);
+
+/////////////////////////////////////////////////////////////////////////////
+
+        //Pedido del perfilador, lo atiende Perfilador_Task
+        if ((event->topic_len == strlen(TOPIC_DIAGNOSTICO)) && (strncmp(event->topic, TOPIC_DIAGNOSTICO, event->topic_len) == 0))
+        {
+            Perfilador_Pedir(event->data, event->data_len);
+            break;
+        }
+
+        //Pedido de la traza de eventos, no es un comando para el porton
+        if ((event->topic_len == strlen(TOPIC_TRAZA)) && (strncmp(event->topic, TOPIC_TRAZA, event->topic_len) == 0))
+        {
+            if ((event->data_len == 6) && (strncmp(event->data, "volcar", 6) == 0) && (tarea_traza != NULL))
+            {
+                xTaskNotifyGive(tarea_traza);
+            }
+            break;
+        }
+
+        char dato_recibido [100];                               //Creamos la variable que nos almcenará el mesaje recibido por MQTT
+        if (event->data_len >= sizeof(dato_recibido))
+        {
+            Contador_Sumar(CONT_MQTT_DESCARTADOS, 1);
+            break;
+        }
+        strncpy(dato_recibido, event->data, event->data_len);   //Copiamos el dato recibido por MQTT en la variable que creamos anteriormente
+        dato_recibido [event->data_len] = '\0';                 //Aseguramos de que la cadena de texto copiada esté terminada en '\0'
+
+
+        //Los comandos con identificador ("1:<id>") se aceptan una sola vez, lleguen por LAN o por MQTT
+        //Sin firma no se confía en el id: no sirve contra repeticiones, solo para juntar los dos caminos
+        uint32_t id_comando = Id_Comando(dato_recibido);
+        int comando_nuevo = (id_comando == 0) || Comando_Nuevo(id_comando);
+        if (!comando_nuevo)
+        {
+            Contador_Sumar(CONT_COMANDOS_DUPLICADOS, 1);
+        }
+
+        //Pasamos el mensaje copiado en la variable que creamos a la función que trabajará con el dato recibido por MQTT
+        if (comando_nuevo)
+        {
+            Dato_MQTT(dato_recibido);
+        }
+
+        //Confirmamos los comandos con identificador para medir el tiempo de ida y vuelta por la nube
+        if (id_comando != 0)
+        {
+            char respuesta[32];
+            snprintf(respuesta, sizeof(respuesta), "%s:%" PRIu32, comando_nuevo ? "ACK" : "DUP", id_comando);
+            esp_mqtt_client_publish(client, TOPIC_ACK, respuesta, 0, 0, 0);
+        }
+
+/////////////////////////////////////////////////////////////////////////////
+
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+            log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
+            log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
+            log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
+            ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+
+        }
+        break;
+    default:
+        ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+        break;
+    }
+}
+
+static void mqtt_app_start(void)
+{
+    //El identificador sale de la MAC para que dos portones no se roben la sesión en el broker
+    static char client_id[32];
+    uint8_t mac[6];
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(client_id, sizeof(client_id), MQTT_CLIENT_PREFIJO "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = CONFIG_BROKER_URL,
+        .credentials.client_id = client_id,
+        .session.disable_clean_session = true,
+        .task.priority = PRIORIDAD_MQTT,
+        .buffer.size = OTA_BLOQUE_MAX + 256,
+    };
+#if CONFIG_BROKER_URL_FROM_STDIN
+    char line[128];
+
+    if (strcmp(mqtt_cfg.broker.address.uri, "FROM_STDIN") == 0) {
+        int count = 0;
+        printf("Please enter url of mqtt broker\n");
+        while (count < 128) {
+            int c = fgetc(stdin);
+            if (c == '\n') {
+                line[count] = '\0';
+                break;
+            } else if (c > 0 && c < 127) {
+                line[count] = c;
+                ++count;
+            }
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        mqtt_cfg.broker.address.uri = line;
+        printf("Broker url: %s\n", line);
+    } else {
+        ESP_LOGE(TAG, "Configuration mismatch: wrong broker url");
+        abort();
+    }
+#endif /* CONFIG_BROKER_URL_FROM_STDIN */
+
+    //Con mqtts:// el transporte es el de sesion_tls.c: solo acepta el broker firmado por la CA embebida
+    //y reanuda la sesión TLS en cada reconexión
+    if (strncmp(mqtt_cfg.broker.address.uri, "mqtts://", 8) == 0) {
+        struct SESION_TLS_CONFIG config_tls = {
+            .tag = TAG,
+            .ca_pem = (const char *)broker_ca_pem_start,
+        };
+        mqtt_cfg.network.transport = Sesion_TLS_Transporte(&config_tls);
+    }
+
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+    cliente_mqtt = client;
+    Perfilador_Cliente(client);
+    Outbox_Cliente(client);
+}
+
+
+//Función para contar las desconexiones de Wi-Fi (la reconexión la maneja example_connect)
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    Contador_Sumar(CONT_WIFI_DESCONEXIONES, 1);
+}
+
+
+//Tarea que publica todos los contadores en un solo mensaje cada METRICAS_INTERVALO_MS
+//Va con QoS 0 directo al broker, sin pasar por el outbox ni por la flash: los contadores son acumulados,
+//si un mensaje se pierde el siguiente trae lo mismo
+//Formato: {"t":<segundos encendido>,"tr":<n>,"bug_ok":<n>,...}
+void Metricas_Task(void *pvParameters)
+{
+    char mensaje[METRICAS_MAX];
+    size_t libre = sizeof(mensaje) - 1;     //El último byte queda para cerrar la llave
+
+    for(;;)
+    {
+        vTaskDelay(METRICAS_INTERVALO_MS/portTICK_PERIOD_MS);
+
+        size_t largo = snprintf(mensaje, libre, "{\"t\":%" PRId64, esp_timer_get_time() / 1000000);
+        for (int i = 0; (i < CONT_TOTAL) && (largo < libre); i++)
+        {
+            largo += snprintf(&mensaje[largo], libre - largo, ",\"%s\":%" PRIu32, NOMBRE_CONTADOR[i],
+                              (uint32_t)atomic_load_explicit(&contadores[i], memory_order_relaxed));
+        }
+        if (largo >= libre)
+        {
+            ESP_LOGW(TAG, "Metricas: el mensaje no entra en METRICAS_MAX");
+            continue;
+        }
+        strcpy(&mensaje[largo], "}");
+
+        if (cliente_mqtt != NULL)
+        {
+            esp_mqtt_client_publish(cliente_mqtt, TOPIC_METRICAS, mensaje, 0, 0, 0);
+        }
+    }
+}
+
+void app_main(void)
+{
+    ESP_LOGI(TAG, "[APP] Startup..");
+    ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
+    ESP_LOGI(TAG, "[APP] IDF version: %s", esp_get_idf_version());
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
+    esp_log_level_set("mqtt_example", ESP_LOG_VERBOSE);
+    esp_log_level_set("transport_base", ESP_LOG_VERBOSE);
+    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
+    esp_log_level_set("transport", ESP_LOG_VERBOSE);
+    esp_log_level_set("outbox", ESP_LOG_VERBOSE);
+
+    ESP_ERROR_CHECK(nvs_flash_init());
+    struct OUTBOX_CONFIG eventos = {
+        .tag = TAG,
+        .topic_eventos = TOPIC_EVENTOS,
+        .topic_telemetria = TOPIC_METRICAS,
+        .contar = Contar_Outbox,
+    };
+    Outbox_Iniciar(&eventos);
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
+     * Read "Establishing Wi-Fi or Ethernet Connection" section in
+     * examples/protocols/README.md for more information about this function.
+     */
+    ESP_ERROR_CHECK(example_connect());
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &wifi_event_handler, NULL));
+
+
+    //Creamos la tarea de OTA antes de conectarnos, recibe los bloques desde el cliente MQTT
+    cola_ota = xQueueCreate(OTA_COLA, sizeof(struct OTA_MENSAJE *));
+    xTaskCreatePinnedToCore(OTA_Task, "OTA", 6144, NULL, PRIORIDAD_DIAGNOSTICO, NULL, NUCLEO_RED);
+
+    //Creamos la tarea del perfilador, espera pedidos por MQTT o por la consola serial
+    struct PERFILADOR_CONFIG perfil = {
+        .tag = TAG,
+        .topic = TOPIC_PERFIL,
+        .estado = Estado_Perfilador,
+        .nombres = NOMBRE_FUNCION_ESTADO,
+        .estados = sizeof(NOMBRE_FUNCION_ESTADO) / sizeof(NOMBRE_FUNCION_ESTADO[0]),
+    };
+    Perfilador_Iniciar(&perfil);
+    xTaskCreatePinnedToCore(Perfilador_Task, "Perfilador", 4096, NULL, PRIORIDAD_DIAGNOSTICO, NULL, NUCLEO_RED);
+
+
+    //Creamos la tarea del outbox antes que la máquina de estado, que le encola los cambios de estado
+    xTaskCreatePinnedToCore(Outbox_Task, "Outbox", 4096, NULL, PRIORIDAD_DIAGNOSTICO, NULL, NUCLEO_RED);
+
+
+    //Llamamos a esta función para conectarnos al broker MQTT
+    mqtt_app_start();
+
+
+    //Llamamos a la función para configurar los GPIOs
+    Configuracion_GPIO();
+
+
+    //Control local: anunciamos el dispositivo por mDNS y abrimos el puerto UDP, solo con una clave propia
+    if (strcmp(LAN_CLAVE, LAN_CLAVE_EJEMPLO) != 0)
+    {
+        Configuracion_mDNS();
+        xTaskCreatePinnedToCore(Control_LAN_Task, "Control LAN", 4096, NULL, PRIORIDAD_MQTT, NULL, NUCLEO_RED);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Control LAN deshabilitado: LAN_CLAVE sigue siendo la clave de ejemplo");
+    }
+
+
+    //Creamos la tarea de la máquina de estado según el perfil de planificación; el perfilador separa sus muestras por estado
+    TaskHandle_t maquina = NULL;
+    xTaskCreatePinnedToCore(Maquina_Estado_Task, "Maquina de Estado", 4096, NULL, PRIORIDAD_CONTROL, &maquina, NUCLEO_CONTROL);
+    Perfilador_Seguir(maquina);
+
+    //Creamos la tarea que reporta el jitter del lazo de control
+    xTaskCreatePinnedToCore(Jitter_Task, "Jitter", 3072, NULL, PRIORIDAD_DIAGNOSTICO, NULL, NUCLEO_RED);
+
+    //Creamos la tarea que vuelca la traza cuando se pide por MQTT
+    xTaskCreatePinnedToCore(Traza_Task, "Traza", 3072, NULL, PRIORIDAD_DIAGNOSTICO, &tarea_traza, NUCLEO_RED);
+
+    //Creamos la tarea que publica las métricas
+    xTaskCreatePinnedToCore(Metricas_Task, "Metricas", 4096, NULL, PRIORIDAD_DIAGNOSTICO, NULL, NUCLEO_RED);
+}
+
+
+//Tarea que ejecuta la máquina de estado
+void Maquina_Estado_Task(void *pvParameters)
+{
+    for(;;)
+    {
+        //Estado Init (Estado de reseteo)
+        if (NEXT_STATE == STATE_START)
+        {
+            NEXT_STATE = Funcion_Start();
+        }
+
+        //Estado OPEN
+        if (NEXT_STATE == OPEN)
+        {
+            NEXT_STATE = Funcion_OPEN();
+        }
+
+        //Estado OPENING
+        if (NEXT_STATE == OPENING)
+        {
+            NEXT_STATE = Funcion_OPENING();
+        }
+
+        //Estado CLOSE
+        if (NEXT_STATE == CLOSE)
+        {
+            NEXT_STATE = Funcion_CLOSE();
+        }
+
+        //Estado CLOSING
+        if (NEXT_STATE == CLOSING)
+        {
+            NEXT_STATE = Funcion_CLOSING();
+        }
+
+        //Estado error
+        if (NEXT_STATE == BUG)
+        {
+            NEXT_STATE = Funcion_BUG();
+        }
+        
+    }
+}
+
+
+int Funcion_Start(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE_START;
+    STATE = STATE_START;
+    Registrar_Transicion();
+    printf("\nESTADO ACTUAL: ESTADO INIT\n");
+
+    //Actualización de los datos
+    data_io.MA = FALSE;
+    data_io.MC = FALSE;
+    data_io.SPP = FALSE;
+    data_io.COD_ERR = FALSE;
+    data_io.Cont_RT = 0;
+
+    //Prueba de funcionamiento de los leds
+    data_io.Led_A = TRUE;
+    data_io.Led_C = TRUE;
+    data_io.Led_ER = TRUE;
+    vTaskDelay(100/portTICK_PERIOD_MS);
+    data_io.Led_A = FALSE;
+    data_io.Led_C = FALSE;
+    data_io.Led_ER = FALSE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Confirmación de los datos exteriores
+    while (!data_io.DATOS_READY){}
+
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado Init ------>> Estado CLOSE
+        if((data_io.LSC == TRUE) && (data_io.LSA == FALSE))
+        {
+            return CLOSE;
+        }
+
+        //Estado Init ------>> Estado CLOSING
+        if(((data_io.LSC == FALSE) && (data_io.LSA == FALSE)) || ((data_io.LSC == FALSE) && (data_io.LSA == TRUE)))
+        {
+            return CLOSING;
+        }
+
+        //Estado Init ------>> Estado error
+        if((data_io.LSC == TRUE) && (data_io.LSA == TRUE))
+        {
+            data_io.COD_ERR = ERROR_LS;
+            return BUG;
+        }
+    }
+}
+
+
+int Funcion_OPEN(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE;
+    STATE = OPEN;
+    Registrar_Transicion();
+    printf("\nESTADO ACTUAL: ESTADO OPEN\n");
+
+    //Actualización de los datos
+    data_io.MA = FALSE;
+    data_io.SPP = FALSE;
+    data_io.Led_A = FALSE;
+    data_io.Led_C = FALSE;
+    data_io.Led_ER = FALSE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado OPEN ------>> Estado CLOSING
+        if (data_io.SPP == TRUE)
+        {
+            data_io.SPP = FALSE;
+            return  CLOSING;
+        }
+    }
+}
+
+
+int Funcion_OPENING(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE;
+    STATE = OPENING;
+    Registrar_Transicion();
+    printf("\nESTADO ACTUAL: ESTADO OPENING\n");
+
+    //Actualización de los datos
+    data_io.MA = TRUE;
+    data_io.Cont_RT = 0;
+    data_io.Led_A = TRUE;
+    data_io.Led_C = FALSE;
+    data_io.Led_ER = FALSE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Tiempo de separación del porton de los limit switch
+    vTaskDelay(3000/portTICK_PERIOD_MS);
+    Traza_Registrar(TRAZA_TIMER, TRAZA_TIMER_SEPARACION, 0);
+
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado OPENING ------>> Estado OPEN
+        if (data_io.LSA == TRUE)
+        {
+            return OPEN;
+        }
+
+        //Incrementamos el valor del contador RT cada 10 milisegundos
+        ++data_io.Cont_RT;
+
+        //Estado OPENING ------>> Estado error
+        if (data_io.Cont_RT > RT_MAX)
+        {
+            data_io.COD_ERR = ERROR_RT;
+            Traza_Registrar(TRAZA_TIMER, TRAZA_TIMER_RT, data_io.Cont_RT);
+            return BUG;
+        }
+    }
+}
+
+
+int Funcion_CLOSE(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE;
+    STATE = CLOSE;
+    Registrar_Transicion();
+    printf("\nESTADO ACTUAL: ESTADO CLOSE\n");
+
+    //Actualización de los datos
+    data_io.MC = FALSE;
+    data_io.SPP = FALSE;
+    data_io.Led_A = FALSE;
+    data_io.Led_C = FALSE;
+    data_io.Led_ER = FALSE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado CLOSE ------>> Estado OPENING
+        if (data_io.SPP == TRUE)
+        {
+            data_io.SPP = FALSE;
+            return  OPENING;
+        }  
+    }
+}
+
+
+int Funcion_CLOSING(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE;
+    STATE = CLOSING;
+    Registrar_Transicion();
+    printf("\nESTADO ACTUAL: ESTADO CLOSING\n");
+
+    //Actualización de los datos
+    data_io.MC = TRUE;
+    data_io.Cont_RT = 0;
+    data_io.Led_A = FALSE;
+    data_io.Led_C = TRUE;
+    data_io.Led_ER = FALSE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Tiempo de separación del porton de los limit switch
+    vTaskDelay(3000/portTICK_PERIOD_MS);
+    Traza_Registrar(TRAZA_TIMER, TRAZA_TIMER_SEPARACION, 0);
+
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado CLOSING ------>> Estado CLOSE
+        if (data_io.LSC == TRUE)
+        {
+            return CLOSE;
+        }
+
+        //Incrementamos el valor del contador RT cada 10 milisegundos
+        ++data_io.Cont_RT;
+
+        //Estado CLOSING ------>> Estado error
+        if (data_io.Cont_RT > RT_MAX)
+        {
+            data_io.COD_ERR = ERROR_RT;
+            Traza_Registrar(TRAZA_TIMER, TRAZA_TIMER_RT, data_io.Cont_RT);
+            return BUG;
+        } 
+    }
+}
+
+
+int Funcion_BUG(void)
+{
+    //Actualización de los estados
+    PAST_STATE = STATE;
+    STATE = BUG;
+    Registrar_Transicion();
+    if (data_io.COD_ERR <= ERROR_RT)
+    {
+        Contador_Sumar(CONT_BUG_OK + data_io.COD_ERR, 1);
+    }
+    printf("\nESTADO ACTUAL: ESTADO ERROR\n");
+
+    //Actualización de los datos
+    data_io.MC = FALSE;
+    data_io.MA = FALSE;
+    data_io.SPP = FALSE;
+    data_io.Led_A = FALSE;
+    data_io.Led_C = FALSE;
+    data_io.Led_ER = TRUE;
+
+    //Actualización de los estados GPIOs y las variables de control
+    Actualización_GPIO();
+
+    //Mensaje indicando al usuario que hubo un error OPENING el porton
+    if ((PAST_STATE == OPENING) && (data_io.COD_ERR == ERROR_RT))
+    {
+        printf("\nERROR OPENING LA PUERTA: REVISE LA POSICION DEL PORTON Y LOS LIMIT SWITCH.\n");
+        printf("\nLLUEGO DE HACER LAS REVISIONES PRESIONE EL BOTON PARA RETORNAR AL FUNCIONAMIENTO NORMAL.\n");
+    }
+
+    //Mensaje indicando al usuario que hubo un error CLOSING el porton
+    if ((PAST_STATE == CLOSING) && (data_io.COD_ERR == ERROR_RT))
+    {
+        printf("\nERROR CLOSING LA PUERTA: REVISE LA POSICION DEL PORTON Y LOS LIMIT SWITCH.\n");
+        printf("\nLUEGO DE HACER LAS REVISIONES PRESIONE EL BOTON PARA RETORNAR AL FUNCIONAMIENTO NORMAL.\n");
+    }
+
+    //Mensaje indicando al usuario que hubo un error inicializando el sistema
+    if ((PAST_STATE == STATE_START) && (data_io.COD_ERR == ERROR_LS))
+    {
+        printf("\nERROR INICIALIZANDO EL SISTEMA: REVISE LAS CONEXIONES DE LOS SENSORES LIMIT SWITCH.\n");
+        printf("\nLUEGO DE ARREGLAR LOS SENSORES PRESIONE EL BOTON PARA REINICIAR EL SISTEMA.\n");
+    }
+    
+    //Loop infinito
+    for(;;)
+    {
+        //Actualización de los estados GPIOs y las variables de control
+        Actualización_GPIO();
+
+        //Estado error ------>> Estado OPENING
+        if ((PAST_STATE == OPENING) && (data_io.SPP == TRUE))
+        {
+            data_io.SPP = FALSE;
+            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA ABRIR LA PUERTA\n");
+            data_io.COD_ERR = ERROR_OK;
+            return OPENING;
+        }
+
+        //Estado error ------>> Estado CLOSING
+        if ((PAST_STATE == CLOSING) && (data_io.SPP == TRUE))
+        {
+            data_io.SPP = FALSE;
+            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA CERRAR LA PUERTA\n");
+            data_io.COD_ERR = ERROR_OK;
+            return CLOSING;
+        }
+
+        //Estado error ------>> Estado Init
+        if ((PAST_STATE == STATE_START) && (data_io.SPP == TRUE))
+        {
+            data_io.SPP = FALSE;
+            printf("\nDEVUELTA AL FUNCIONAMIENTO PARA REINICIAR EL SISTEMA\n");
+            data_io.COD_ERR = ERROR_OK;
+            return STATE_START;
+        }
+    }
+}
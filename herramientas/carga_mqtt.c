@@ -0,0 +1,275 @@
+/***********************************************************/
+/*  Jitter de los lazos de control bajo carga MQTT         */
+/*                                                         */
+/*  Junta los reportes de jitter que publican los dos      */
+/*  firmwares (TOPIC_JITTER) en tres fases: reposo, carga  */
+/*  y reposo otra vez. Durante la carga publica a la tasa  */
+/*  pedida en el topic de comandos del equipo un comando   */
+/*  que no mueve nada ("0"), así cada mensaje recorre todo */
+/*  el camino de recepción (Wi-Fi, lwIP, esp-mqtt y        */
+/*  mqtt_event_handler) en el núcleo de red mientras el    */
+/*  lazo de control corre en el otro.                      */
+/*                                                         */
+/*  Se compara un firmware compilado con PERFIL_ORIGINAL   */
+/*  contra uno con PERFIL_TIEMPO_REAL corriendo esto mismo */
+/*  contra el mismo broker.                                */
+/*                                                         */
+/*  Compilar:                                              */
+/*    gcc -O2 -o carga_mqtt herramientas/carga_mqtt.c -lm  */
+/*                                                         */
+/*  Uso:                                                   */
+/*    ./carga_mqtt broker[:puerto] porton|led              */
+/*        [mensajes/s] [segundos por fase] [bytes]         */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mqtt_min.h"
+
+#define TASA_DEFECTO 200                //Mensajes por segundo durante la carga
+#define FASE_DEFECTO_S 60
+#define BYTES_DEFECTO 64
+#define BYTES_MAX 1024
+#define PING_S 30                       //Menor que el keepalive de Mqtt_Conectar
+#define INTERVALO_REPORTE_S 5           //JITTER_INTERVALO_MS de los firmwares
+#define FASES 3
+#define LAZOS_MAX 4
+#define NOMBRE_LAZO_MAX 32
+
+
+//Topics de cada firmware: dónde reporta el jitter y a qué topic de comandos está suscripto
+struct EQUIPO
+{
+    const char *nombre;
+    const char *topic_jitter;
+    const char *topic_comandos;
+};
+
+static const struct EQUIPO EQUIPOS[] = {
+    { "porton", "Porton/diagnostico/jitter", "Boton_de_control" },
+    { "led", "/2022-1143/SPP/jitter", "/2022-1143/SPP" },
+};
+
+static const char *NOMBRE_FASE[FASES] = { "reposo", "carga", "reposo" };
+
+//Reportes juntados de un lazo en una fase
+struct ACUMULADO
+{
+    char lazo[NOMBRE_LAZO_MAX];
+    uint32_t reportes;
+    double muestras;
+    double suma;                        //Suma de los periodos (media * n)
+    double suma_cuad;                   //Suma de los cuadrados ((varianza + media^2) * n)
+    double min_us;
+    double max_us;
+};
+
+struct ACUMULADO acumulado[FASES][LAZOS_MAX];
+
+
+static double Segundos(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+//Valor numérico de una clave del JSON del firmware, 0 si no aparece
+static double Campo(const char *json, const char *clave)
+{
+    char buscado[48];
+    snprintf(buscado, sizeof(buscado), "\"%s\":", clave);
+    const char *p = strstr(json, buscado);
+    return (p != NULL) ? strtod(p + strlen(buscado), NULL) : 0;
+}
+
+
+static void Registrar_Reporte(int fase, const char *json)
+{
+    char lazo[NOMBRE_LAZO_MAX] = "";
+    const char *p = strstr(json, "\"lazo\":\"");
+
+    if (p != NULL)
+    {
+        p += strlen("\"lazo\":\"");
+        size_t largo = strcspn(p, "\"");
+        snprintf(lazo, sizeof(lazo), "%.*s", (int)largo, p);
+    }
+
+    struct ACUMULADO *a = NULL;
+    for (int i = 0; i < LAZOS_MAX; i++)
+    {
+        if ((acumulado[fase][i].reportes == 0) || (strcmp(acumulado[fase][i].lazo, lazo) == 0))
+        {
+            a = &acumulado[fase][i];
+            break;
+        }
+    }
+    if (a == NULL)
+    {
+        return;
+    }
+
+    double n = Campo(json, "n");
+    double media = Campo(json, "media_us");
+    double min_us = Campo(json, "min_us");
+    double max_us = Campo(json, "max_us");
+    if (n <= 0)
+    {
+        return;
+    }
+    if ((a->reportes == 0) || (min_us < a->min_us))
+    {
+        a->min_us = min_us;
+    }
+    if (max_us > a->max_us)
+    {
+        a->max_us = max_us;
+    }
+    snprintf(a->lazo, sizeof(a->lazo), "%s", lazo);
+    a->reportes++;
+    a->muestras += n;
+    a->suma += media * n;
+    a->suma_cuad += (Campo(json, "varianza_us2") + media * media) * n;
+}
+
+
+static void Imprimir_Resultados(uint32_t enviados, double segundos_carga)
+{
+    printf("\nFase    Lazo                Reportes  Muestras  Media(us)  Min(us)  Max(us)  Desvio(us)\n");
+    for (int fase = 0; fase < FASES; fase++)
+    {
+        for (int i = 0; (i < LAZOS_MAX) && (acumulado[fase][i].reportes > 0); i++)
+        {
+            struct ACUMULADO *a = &acumulado[fase][i];
+            double media = a->suma / a->muestras;
+            double varianza = a->suma_cuad / a->muestras - media * media;
+            printf("%-7s %-19s %8u %9.0f %10.1f %8.0f %8.0f %11.1f\n", NOMBRE_FASE[fase], a->lazo,
+                   a->reportes, a->muestras, media, a->min_us, a->max_us, (varianza > 0) ? sqrt(varianza) : 0.0);
+        }
+    }
+    printf("\nMensajes publicados durante la carga: %u (%.0f por segundo)\n", enviados,
+           (segundos_carga > 0) ? enviados / segundos_carga : 0.0);
+}
+
+
+int main(int argc, char **argv)
+{
+    static struct MQTT_LECTOR lector;
+    static uint8_t buf[BYTES_MAX + 256];
+    struct MQTT_PAQUETE paquete;
+    char datos[BYTES_MAX];
+    char host[128];
+    int puerto = 1883;
+    const struct EQUIPO *equipo = NULL;
+
+    if ((argc < 3) || (argc > 6))
+    {
+        fprintf(stderr, "Uso: %s broker[:puerto] porton|led [mensajes/s] [segundos por fase] [bytes]\n", argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(EQUIPOS) / sizeof(EQUIPOS[0]); i++)
+    {
+        if (strcmp(argv[2], EQUIPOS[i].nombre) == 0)
+        {
+            equipo = &EQUIPOS[i];
+        }
+    }
+    double tasa = (argc > 3) ? atof(argv[3]) : TASA_DEFECTO;
+    double fase_s = (argc > 4) ? atof(argv[4]) : FASE_DEFECTO_S;
+    size_t bytes = (argc > 5) ? (size_t)atoi(argv[5]) : BYTES_DEFECTO;
+    if ((equipo == NULL) || (tasa <= 0) || (fase_s <= 0) || (bytes < 1) || (bytes > BYTES_MAX))
+    {
+        fprintf(stderr, "Parámetros inválidos\n");
+        return 2;
+    }
+
+    snprintf(host, sizeof(host), "%s", argv[1]);
+    char *separador = strchr(host, ':');
+    if (separador != NULL)
+    {
+        *separador = '\0';
+        puerto = atoi(separador + 1);
+    }
+
+    int fd = Mqtt_Conectar(host, puerto, "carga-mqtt", &lector);
+    if ((fd < 0) || (Mqtt_Enviar(fd, buf, Mqtt_Armar_Subscribe(buf, 1, equipo->topic_jitter)) < 0))
+    {
+        fprintf(stderr, "Sin conexión con %s:%d\n", host, puerto);
+        return 1;
+    }
+
+    //Comando sin efecto, relleno hasta el tamaño pedido
+    memset(datos, ' ', bytes);
+    datos[0] = '0';
+
+    uint32_t enviados = 0;
+    double inicio = Segundos();
+    double proximo_ping = inicio + PING_S;
+    double proximo_envio = inicio + fase_s;
+    int fase_anterior = -1;
+
+    printf("Midiendo %s: %.0f s en reposo, %.0f s con %.0f mensajes/s de %zu bytes en %s, %.0f s en reposo\n",
+           equipo->nombre, fase_s, fase_s, tasa, bytes, equipo->topic_comandos, fase_s);
+
+    for (;;)
+    {
+        double ahora = Segundos();
+        int fase = (int)((ahora - inicio) / fase_s);
+        if (fase >= FASES)
+        {
+            break;
+        }
+        if (fase != fase_anterior)
+        {
+            printf("Fase %d: %s\n", fase + 1, NOMBRE_FASE[fase]);
+            fflush(stdout);
+            fase_anterior = fase;
+        }
+
+        //Publica todo lo que ya debería haber salido a la tasa pedida
+        while ((fase == 1) && (proximo_envio <= ahora))
+        {
+            if (Mqtt_Enviar(fd, buf, Mqtt_Armar_Publish(buf, equipo->topic_comandos, datos, bytes)) < 0)
+            {
+                fprintf(stderr, "Se cerró la conexión con el broker\n");
+                return 1;
+            }
+            enviados++;
+            proximo_envio += 1.0 / tasa;
+        }
+        if (ahora >= proximo_ping)
+        {
+            Mqtt_Enviar(fd, buf, Mqtt_Armar_Pingreq(buf));
+            proximo_ping = ahora + PING_S;
+        }
+
+        int espera_ms = (fase == 1) ? (int)((proximo_envio - ahora) * 1000) : 100;
+        int r = Mqtt_Leer(fd, &lector, &paquete, (espera_ms > 0) ? espera_ms : 0);
+        if (r < 0)
+        {
+            fprintf(stderr, "Se cerró la conexión con el broker\n");
+            return 1;
+        }
+        if ((r == 1) && (paquete.tipo == MQTT_PUBLISH))
+        {
+            //Los reportes del comienzo de cada fase mezclan la ventana anterior, no se cuentan
+            char json[256];
+            snprintf(json, sizeof(json), "%.*s", (int)paquete.largo, (const char *)paquete.datos);
+            if (ahora - (inicio + fase * fase_s) >= INTERVALO_REPORTE_S)
+            {
+                Registrar_Reporte(fase, json);
+            }
+        }
+    }
+
+    close(fd);
+    Imprimir_Resultados(enviados, fase_s);
+    return 0;
+}
@@ -0,0 +1,298 @@
+/***********************************************************/
+/*  Latencia del control del porton: LAN contra la nube    */
+/*                                                         */
+/*  Manda comandos sin efecto ("0:<id>") alternando los    */
+/*  dos caminos y mide el tiempo hasta la confirmación:    */
+/*    LAN:  UDP firmado con HMAC-SHA256 al puerto de       */
+/*          Control_LAN_Task, responde "ACK:<id>".         */
+/*    nube: PUBLISH en Boton_de_control por el broker,     */
+/*          responde "ACK:<id>" en Boton_de_control/ack.   */
+/*                                                         */
+/*  Los ids son décimas de segundo desde 2024, así siguen  */
+/*  creciendo entre corridas como pide el control LAN.     */
+/*                                                         */
+/*  Compilar:                                              */
+/*    gcc -O2 -o latencia_lan herramientas/latencia_lan.c  */
+/*                                                         */
+/*  Uso:                                                   */
+/*    ./latencia_lan broker[:puerto] porton[:puerto] clave */
+/*        [comandos por camino]                            */
+/*  porton es la IP o el nombre mDNS (porton-2022-1143.local) */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "mqtt_min.h"
+#include "sha256_min.h"
+
+#define LAN_PUERTO 3333                 //LAN_PUERTO del firmware
+#define TOPIC_COMANDOS "Boton_de_control"
+#define TOPIC_ACK "Boton_de_control/ack"
+#define COMANDOS_DEFECTO 100
+#define ESPERA_LAN_MS 2000              //Sin respuesta en este tiempo el comando cuenta como perdido
+#define ESPERA_NUBE_MS 5000
+#define PAUSA_MS 100                    //Entre comandos, para que los ids (décimas de segundo) no se adelanten al reloj
+#define EPOCA_2024 1704067200
+
+enum CAMINO
+{
+    CAMINO_LAN,
+    CAMINO_NUBE,
+    CAMINOS,
+};
+
+static const char *NOMBRE_CAMINO[CAMINOS] = { "LAN", "nube" };
+
+struct MEDICION
+{
+    double *ms;
+    uint32_t respondidos;
+    uint32_t perdidos;
+    uint32_t duplicados;
+};
+
+struct MEDICION medicion[CAMINOS];
+
+
+static double Segundos(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+static void Dormir_Ms(int ms)
+{
+    struct timespec t = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+    nanosleep(&t, NULL);
+}
+
+
+//Siguiente id: décimas de segundo desde 2024, siempre mayor que el anterior
+static uint32_t Siguiente_Id(uint32_t anterior)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    uint32_t ahora = (uint32_t)((t.tv_sec - EPOCA_2024) * 10 + t.tv_nsec / 100000000L);
+    return (ahora > anterior) ? ahora : anterior + 1;
+}
+
+
+static void Separar_Puerto(const char *texto, char *host, size_t largo, int *puerto)
+{
+    snprintf(host, largo, "%s", texto);
+    char *separador = strchr(host, ':');
+    if (separador != NULL)
+    {
+        *separador = '\0';
+        *puerto = atoi(separador + 1);
+    }
+}
+
+
+//Espera la respuesta "ACK:<id>" o "DUP:<id>" del camino; devuelve 1, 0 si fue duplicado o -1 si no llegó
+static int Esperar_UDP(int sock, uint32_t id, double limite)
+{
+    char respuesta[64];
+    char esperada[32];
+
+    snprintf(esperada, sizeof(esperada), ":%" PRIu32, id);
+    for (;;)
+    {
+        int espera_ms = (int)((limite - Segundos()) * 1000);
+        struct pollfd espera = { .fd = sock, .events = POLLIN };
+        if ((espera_ms <= 0) || (poll(&espera, 1, espera_ms) <= 0))
+        {
+            return -1;
+        }
+        ssize_t n = recv(sock, respuesta, sizeof(respuesta) - 1, 0);
+        if (n <= 0)
+        {
+            continue;
+        }
+        respuesta[n] = '\0';
+        if (strcmp(respuesta + 3, esperada) == 0)
+        {
+            return strncmp(respuesta, "ACK", 3) == 0;
+        }
+    }
+}
+
+static int Esperar_MQTT(int fd, struct MQTT_LECTOR *lector, uint32_t id, double limite)
+{
+    struct MQTT_PAQUETE paquete;
+    char respuesta[64];
+    char esperada[32];
+
+    snprintf(esperada, sizeof(esperada), ":%" PRIu32, id);
+    for (;;)
+    {
+        int espera_ms = (int)((limite - Segundos()) * 1000);
+        if ((espera_ms <= 0) || (Mqtt_Leer(fd, lector, &paquete, espera_ms) <= 0))
+        {
+            return -1;
+        }
+        if ((paquete.tipo != MQTT_PUBLISH) || (paquete.largo < 4) || (paquete.largo >= sizeof(respuesta)))
+        {
+            continue;
+        }
+        snprintf(respuesta, sizeof(respuesta), "%.*s", (int)paquete.largo, (const char *)paquete.datos);
+        if (strcmp(respuesta + 3, esperada) == 0)
+        {
+            return strncmp(respuesta, "ACK", 3) == 0;
+        }
+    }
+}
+
+
+static void Anotar(enum CAMINO camino, int resultado, double ms)
+{
+    struct MEDICION *m = &medicion[camino];
+
+    if (resultado < 0)
+    {
+        m->perdidos++;
+    }
+    else if (resultado == 0)
+    {
+        m->duplicados++;
+    }
+    else
+    {
+        m->ms[m->respondidos++] = ms;
+    }
+}
+
+
+static int Comparar_Ms(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void Imprimir_Resultados(void)
+{
+    printf("\nCamino  Respondidos  Perdidos  Duplicados  Min(ms)  p50(ms)  p90(ms)  p99(ms)  Max(ms)  Media(ms)\n");
+    for (int c = 0; c < CAMINOS; c++)
+    {
+        struct MEDICION *m = &medicion[c];
+        uint32_t n = m->respondidos;
+        double suma = 0;
+
+        printf("%-7s %11" PRIu32 " %9" PRIu32 " %11" PRIu32, NOMBRE_CAMINO[c], n, m->perdidos, m->duplicados);
+        if (n == 0)
+        {
+            printf("\n");
+            continue;
+        }
+        qsort(m->ms, n, sizeof(double), Comparar_Ms);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            suma += m->ms[i];
+        }
+        printf(" %8.1f %8.1f %8.1f %8.1f %8.1f %10.1f\n", m->ms[0], m->ms[n / 2], m->ms[(n * 9) / 10],
+               m->ms[(n * 99) / 100], m->ms[n - 1], suma / n);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    static struct MQTT_LECTOR lector;
+    uint8_t buf[256];
+    char broker[128];
+    char porton[128];
+    int puerto_broker = 1883;
+    int puerto_lan = LAN_PUERTO;
+
+    if ((argc < 4) || (argc > 5))
+    {
+        fprintf(stderr, "Uso: %s broker[:puerto] porton[:puerto] clave [comandos por camino]\n", argv[0]);
+        return 2;
+    }
+    const char *clave = argv[3];
+    int comandos = (argc > 4) ? atoi(argv[4]) : COMANDOS_DEFECTO;
+    if (comandos <= 0)
+    {
+        fprintf(stderr, "Cantidad de comandos inválida\n");
+        return 2;
+    }
+    Separar_Puerto(argv[1], broker, sizeof(broker), &puerto_broker);
+    Separar_Puerto(argv[2], porton, sizeof(porton), &puerto_lan);
+
+    //Socket UDP conectado al porton, así recv solo devuelve sus respuestas
+    struct addrinfo pista = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *direccion;
+    char servicio[8];
+    snprintf(servicio, sizeof(servicio), "%d", puerto_lan);
+    if (getaddrinfo(porton, servicio, &pista, &direccion) != 0)
+    {
+        fprintf(stderr, "No se encontró %s\n", porton);
+        return 1;
+    }
+    int sock = socket(direccion->ai_family, direccion->ai_socktype, direccion->ai_protocol);
+    if ((sock < 0) || (connect(sock, direccion->ai_addr, direccion->ai_addrlen) < 0))
+    {
+        perror("UDP");
+        return 1;
+    }
+    freeaddrinfo(direccion);
+
+    int fd = Mqtt_Conectar(broker, puerto_broker, "latencia-lan", &lector);
+    if ((fd < 0) || (Mqtt_Enviar(fd, buf, Mqtt_Armar_Subscribe(buf, 1, TOPIC_ACK)) < 0))
+    {
+        fprintf(stderr, "Sin conexión con %s:%d\n", broker, puerto_broker);
+        return 1;
+    }
+
+    for (int c = 0; c < CAMINOS; c++)
+    {
+        medicion[c].ms = calloc(comandos, sizeof(double));
+    }
+
+    printf("%d comandos por camino: LAN %s:%d, nube %s:%d\n", comandos, porton, puerto_lan, broker, puerto_broker);
+    uint32_t id = 0;
+    for (int i = 0; i < comandos; i++)
+    {
+        char mensaje[32];
+        char paquete[128];
+        char firma[SHA256_HEX];
+
+        //LAN: "0:<id>:<HMAC-SHA256 de "0:<id>">"
+        id = Siguiente_Id(id);
+        snprintf(mensaje, sizeof(mensaje), "0:%" PRIu32, id);
+        Hmac_Sha256_Hex(clave, mensaje, strlen(mensaje), firma);
+        snprintf(paquete, sizeof(paquete), "%s:%s", mensaje, firma);
+        double inicio = Segundos();
+        send(sock, paquete, strlen(paquete), 0);
+        int resultado = Esperar_UDP(sock, id, inicio + ESPERA_LAN_MS / 1000.0);
+        Anotar(CAMINO_LAN, resultado, (Segundos() - inicio) * 1000);
+        Dormir_Ms(PAUSA_MS);
+
+        //Nube: el mismo formato sin firma
+        id = Siguiente_Id(id);
+        snprintf(mensaje, sizeof(mensaje), "0:%" PRIu32, id);
+        inicio = Segundos();
+        if (Mqtt_Enviar(fd, buf, Mqtt_Armar_Publish(buf, TOPIC_COMANDOS, mensaje, strlen(mensaje))) < 0)
+        {
+            fprintf(stderr, "Se cerró la conexión con el broker\n");
+            break;
+        }
+        resultado = Esperar_MQTT(fd, &lector, id, inicio + ESPERA_NUBE_MS / 1000.0);
+        Anotar(CAMINO_NUBE, resultado, (Segundos() - inicio) * 1000);
+        Dormir_Ms(PAUSA_MS);
+    }
+
+    close(sock);
+    close(fd);
+    Imprimir_Resultados();
+    return 0;
+}
@@ -0,0 +1,347 @@
+/***********************************************************/
+/*  Cliente MQTT 3.1.1 mínimo para las herramientas de PC  */
+/*                                                         */
+/*  Solo lo necesario para probar el firmware contra un    */
+/*  broker local: CONNECT, SUBSCRIBE, PUBLISH con QoS 0 y  */
+/*  1 (PUBACK), PINGREQ. Los paquetes se arman y se        */
+/*  analizan en buffers, así sirve con sockets bloqueantes */
+/*  o no.                                                  */
+/***********************************************************/
+
+#ifndef MQTT_MIN_H
+#define MQTT_MIN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK 4
+#define MQTT_SUBSCRIBE 8
+#define MQTT_SUBACK 9
+#define MQTT_PINGREQ 12
+#define MQTT_PINGRESP 13
+
+#ifndef MQTT_PAQUETE_MAX
+#define MQTT_PAQUETE_MAX 16384          //Paquete más grande que se acepta al leer, se puede achicar antes del include
+#endif
+
+
+//Paquete recibido; topic y datos apuntan al buffer del lector
+struct MQTT_PAQUETE
+{
+    uint8_t tipo;
+    uint16_t id;                        //Identificador de un PUBACK o de un PUBLISH con QoS 1
+    const char *topic;
+    uint16_t topic_largo;
+    const uint8_t *datos;
+    uint32_t largo;
+};
+
+//Buffer de lectura de una conexión
+struct MQTT_LECTOR
+{
+    uint8_t buf[MQTT_PAQUETE_MAX];
+    size_t largo;
+    size_t consumido;                   //Bytes del último paquete entregado, se descartan en la próxima lectura
+};
+
+
+static inline size_t Mqtt_Poner_Largo(uint8_t *p, uint32_t largo)
+{
+    size_t n = 0;
+
+    do
+    {
+        uint8_t byte = largo % 128;
+        largo /= 128;
+        p[n++] = byte | ((largo > 0) ? 0x80 : 0);
+    } while (largo > 0);
+    return n;
+}
+
+
+static inline size_t Mqtt_Poner_Texto(uint8_t *p, const char *texto, size_t largo)
+{
+    p[0] = largo >> 8;
+    p[1] = largo & 0xFF;
+    memcpy(&p[2], texto, largo);
+    return largo + 2;
+}
+
+
+//Armado de paquetes: devuelven los bytes escritos en buf
+static inline size_t Mqtt_Armar_Connect(uint8_t *buf, const char *client_id, uint16_t keepalive_s)
+{
+    size_t id_largo = strlen(client_id);
+    size_t n = 0;
+
+    buf[n++] = MQTT_CONNECT << 4;
+    n += Mqtt_Poner_Largo(&buf[n], 10 + 2 + id_largo);
+    n += Mqtt_Poner_Texto(&buf[n], "MQTT", 4);
+    buf[n++] = 4;                       //MQTT 3.1.1
+    buf[n++] = 0x02;                    //Sesión limpia
+    buf[n++] = keepalive_s >> 8;
+    buf[n++] = keepalive_s & 0xFF;
+    n += Mqtt_Poner_Texto(&buf[n], client_id, id_largo);
+    return n;
+}
+
+
+static inline size_t Mqtt_Armar_Publish(uint8_t *buf, const char *topic, const void *datos, size_t largo)
+{
+    size_t topic_largo = strlen(topic);
+    size_t n = 0;
+
+    buf[n++] = MQTT_PUBLISH << 4;
+    n += Mqtt_Poner_Largo(&buf[n], 2 + topic_largo + largo);
+    n += Mqtt_Poner_Texto(&buf[n], topic, topic_largo);
+    memcpy(&buf[n], datos, largo);
+    return n + largo;
+}
+
+
+//El broker responde con un PUBACK con el mismo id; la retransmisión va con dup
+static inline size_t Mqtt_Armar_Publish_Qos1(uint8_t *buf, uint16_t id, int dup, const char *topic, const void *datos, size_t largo)
+{
+    size_t topic_largo = strlen(topic);
+    size_t n = 0;
+
+    buf[n++] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | 0x02;
+    n += Mqtt_Poner_Largo(&buf[n], 2 + topic_largo + 2 + largo);
+    n += Mqtt_Poner_Texto(&buf[n], topic, topic_largo);
+    buf[n++] = id >> 8;
+    buf[n++] = id & 0xFF;
+    memcpy(&buf[n], datos, largo);
+    return n + largo;
+}
+
+
+static inline size_t Mqtt_Armar_Subscribe(uint8_t *buf, uint16_t id, const char *topic)
+{
+    size_t topic_largo = strlen(topic);
+    size_t n = 0;
+
+    buf[n++] = (MQTT_SUBSCRIBE << 4) | 0x02;
+    n += Mqtt_Poner_Largo(&buf[n], 2 + 2 + topic_largo + 1);
+    buf[n++] = id >> 8;
+    buf[n++] = id & 0xFF;
+    n += Mqtt_Poner_Texto(&buf[n], topic, topic_largo);
+    buf[n++] = 0;                       //QoS 0
+    return n;
+}
+
+
+static inline size_t Mqtt_Armar_Pingreq(uint8_t *buf)
+{
+    buf[0] = MQTT_PINGREQ << 4;
+    buf[1] = 0;
+    return 2;
+}
+
+
+//Analiza un paquete al inicio de buf
+//Devuelve los bytes que ocupa, 0 si todavía no llegó completo o -1 si es inválido
+static inline int Mqtt_Analizar(const uint8_t *buf, size_t largo, struct MQTT_PAQUETE *paquete)
+{
+    uint32_t restante = 0;
+    uint32_t multiplicador = 1;
+    size_t n = 1;
+
+    if (largo < 2)
+    {
+        return 0;
+    }
+    do
+    {
+        if (n >= largo)
+        {
+            return 0;
+        }
+        if (n > 4)
+        {
+            return -1;
+        }
+        restante += (buf[n] & 0x7F) * multiplicador;
+        multiplicador *= 128;
+    } while (buf[n++] & 0x80);
+
+    if (n + restante > MQTT_PAQUETE_MAX)
+    {
+        return -1;
+    }
+    if (n + restante > largo)
+    {
+        return 0;
+    }
+
+    memset(paquete, 0, sizeof(*paquete));
+    paquete->tipo = buf[0] >> 4;
+    if (paquete->tipo == MQTT_PUBLISH)
+    {
+        int qos = (buf[0] >> 1) & 0x03;
+        uint16_t topic_largo = (buf[n] << 8) | buf[n + 1];
+        size_t cabecera = 2 + topic_largo + ((qos > 0) ? 2 : 0);
+
+        if (cabecera > restante)
+        {
+            return -1;
+        }
+        paquete->topic = (const char *)&buf[n + 2];
+        paquete->topic_largo = topic_largo;
+        if (qos > 0)
+        {
+            paquete->id = (buf[n + 2 + topic_largo] << 8) | buf[n + 3 + topic_largo];
+        }
+        paquete->datos = &buf[n + cabecera];
+        paquete->largo = restante - cabecera;
+    }
+    else
+    {
+        paquete->datos = &buf[n];
+        paquete->largo = restante;
+        if ((paquete->tipo == MQTT_PUBACK) && (restante >= 2))
+        {
+            paquete->id = (buf[n] << 8) | buf[n + 1];
+        }
+    }
+    return n + restante;
+}
+
+
+static inline int Mqtt_Enviar(int fd, const uint8_t *buf, size_t largo)
+{
+    while (largo > 0)
+    {
+        ssize_t n = send(fd, buf, largo, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                struct pollfd espera = { .fd = fd, .events = POLLOUT };
+                poll(&espera, 1, 1000);
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        largo -= n;
+    }
+    return 0;
+}
+
+
+//Lee el siguiente paquete de la conexión esperando hasta timeout_ms (0 = no esperar)
+//Devuelve 1 si hay paquete, 0 si no llegó a tiempo y -1 si la conexión se cerró o hubo error
+static inline int Mqtt_Leer(int fd, struct MQTT_LECTOR *lector, struct MQTT_PAQUETE *paquete, int timeout_ms)
+{
+    if (lector->consumido > 0)
+    {
+        memmove(lector->buf, &lector->buf[lector->consumido], lector->largo - lector->consumido);
+        lector->largo -= lector->consumido;
+        lector->consumido = 0;
+    }
+
+    for (;;)
+    {
+        int n = Mqtt_Analizar(lector->buf, lector->largo, paquete);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n > 0)
+        {
+            lector->consumido = n;
+            return 1;
+        }
+
+        struct pollfd espera = { .fd = fd, .events = POLLIN };
+        if (poll(&espera, 1, timeout_ms) <= 0)
+        {
+            return 0;
+        }
+        ssize_t leidos = recv(fd, &lector->buf[lector->largo], sizeof(lector->buf) - lector->largo, 0);
+        if (leidos == 0)
+        {
+            return -1;
+        }
+        if (leidos < 0)
+        {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+        }
+        lector->largo += leidos;
+    }
+}
+
+
+//Abre la conexión TCP y envía CONNECT; la respuesta CONNACK se lee con Mqtt_Leer
+static inline int Mqtt_Abrir(const char *host, int puerto, const char *client_id, uint16_t keepalive_s)
+{
+    struct addrinfo pista = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *direccion;
+    char servicio[8];
+    uint8_t paquete_connect[300];
+    int uno = 1;
+
+    snprintf(servicio, sizeof(servicio), "%d", puerto);
+    if (getaddrinfo(host, servicio, &pista, &direccion) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(direccion->ai_family, direccion->ai_socktype, direccion->ai_protocol);
+    if ((fd < 0) || (connect(fd, direccion->ai_addr, direccion->ai_addrlen) < 0))
+    {
+        freeaddrinfo(direccion);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    freeaddrinfo(direccion);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &uno, sizeof(uno));
+
+    if (Mqtt_Enviar(fd, paquete_connect, Mqtt_Armar_Connect(paquete_connect, client_id, keepalive_s)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+//Conexión bloqueante: abre, espera CONNACK aceptado y devuelve el socket, o -1
+static inline int Mqtt_Conectar(const char *host, int puerto, const char *client_id, struct MQTT_LECTOR *lector)
+{
+    struct MQTT_PAQUETE paquete;
+    int fd = Mqtt_Abrir(host, puerto, client_id, 60);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    lector->largo = 0;
+    lector->consumido = 0;
+    if ((Mqtt_Leer(fd, lector, &paquete, 5000) != 1) || (paquete.tipo != MQTT_CONNACK) ||
+        (paquete.largo < 2) || (paquete.datos[1] != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif /* MQTT_MIN_H */
@@ -0,0 +1,449 @@
+/***********************************************************/
+/*  OTA por MQTT para el firmware del porton               */
+/*                                                         */
+/*  crear:  arma un parche delta entre la imagen que corre */
+/*          en el porton y la imagen nueva.                */
+/*  enviar: manda la imagen completa o el parche por MQTT  */
+/*          en bloques, retomando desde donde quedó el     */
+/*          porton si se corta la conexión, y mide tamaño, */
+/*          tiempo y CPU de la transferencia.              */
+/*                                                         */
+/*  Formato del parche (lo aplica OTA_Aplicar_Parche):     */
+/*    'C' <origen u32> <largo u32>  copia de la imagen vieja */
+/*    'D' <largo u32> <datos>       bytes nuevos           */
+/*                                                         */
+/*  Compilar:                                              */
+/*    gcc -O2 -o ota_delta herramientas/ota_delta.c        */
+/*                                                         */
+/*  El manifiesto del inicio va firmado con la OTA_CLAVE   */
+/*  del firmware y lleva un número que siempre crece       */
+/*  (segundos desde 2024). Con un parche lleva además el   */
+/*  SHA-256 de la imagen vieja, el porton lo compara con   */
+/*  la que está corriendo antes de aceptar bloques.        */
+/*                                                         */
+/*  Uso:                                                   */
+/*    ./ota_delta crear vieja.bin nueva.bin parche.bin     */
+/*    ./ota_delta enviar localhost[:1883] clave nueva.bin  */
+/*        [vieja.bin parche.bin]                           */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "mqtt_min.h"
+#include "sha256_min.h"
+
+#define BLOQUE_HASH 32                  //Bytes comparados para encontrar una coincidencia
+#define PASO_INDICE 16                  //Cada cuántos bytes de la imagen vieja se indexa un bloque
+#define COPIA_MINIMA 24                 //Coincidencias más cortas van como datos nuevos
+#define TABLA_BITS 20
+#define MULTIPLICADOR 0x01000193u
+
+#define OTA_BLOQUE 4096                 //Igual a OTA_BLOQUE_MAX del firmware
+#define ESPERA_ESTADO_MS 10000          //Sin respuesta del porton en este tiempo se reenvía el inicio
+#define TOPIC_OTA_INICIO "Porton/ota/inicio"
+#define TOPIC_OTA_BLOQUE "Porton/ota/bloque/"
+#define TOPIC_OTA_ESTADO "Porton/ota/estado"
+#define EPOCA_2024 1704067200
+
+
+struct ARCHIVO
+{
+    uint8_t *datos;
+    size_t largo;
+};
+
+
+static int Leer_Archivo(const char *ruta, struct ARCHIVO *archivo)
+{
+    FILE *f = fopen(ruta, "rb");
+    if (f == NULL)
+    {
+        perror(ruta);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    archivo->largo = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    archivo->datos = malloc(archivo->largo ? archivo->largo : 1);
+    int correcto = (archivo->datos != NULL) && (fread(archivo->datos, 1, archivo->largo, f) == archivo->largo);
+    fclose(f);
+    if (!correcto)
+    {
+        fprintf(stderr, "%s: no se pudo leer\n", ruta);
+    }
+    return correcto;
+}
+
+
+//*************************** Parche ***************************//
+
+struct SALIDA
+{
+    uint8_t *datos;
+    size_t largo;
+    size_t capacidad;
+    uint32_t copias;
+    uint32_t literales;
+    size_t bytes_copiados;
+};
+
+static void Salida_Agregar(struct SALIDA *salida, const void *datos, size_t largo)
+{
+    if (salida->largo + largo > salida->capacidad)
+    {
+        salida->capacidad = 2 * (salida->largo + largo);
+        salida->datos = realloc(salida->datos, salida->capacidad);
+    }
+    memcpy(&salida->datos[salida->largo], datos, largo);
+    salida->largo += largo;
+}
+
+static void Emitir_Literal(struct SALIDA *salida, const uint8_t *datos, uint32_t largo)
+{
+    if (largo == 0)
+    {
+        return;
+    }
+    Salida_Agregar(salida, "D", 1);
+    Salida_Agregar(salida, &largo, 4);
+    Salida_Agregar(salida, datos, largo);
+    salida->literales++;
+}
+
+static void Emitir_Copia(struct SALIDA *salida, uint32_t origen, uint32_t largo)
+{
+    Salida_Agregar(salida, "C", 1);
+    Salida_Agregar(salida, &origen, 4);
+    Salida_Agregar(salida, &largo, 4);
+    salida->copias++;
+    salida->bytes_copiados += largo;
+}
+
+static uint32_t Hash_Bloque(const uint8_t *p)
+{
+    uint32_t h = 0;
+
+    for (int i = 0; i < BLOQUE_HASH; i++)
+    {
+        h = h * MULTIPLICADOR + p[i];
+    }
+    return h;
+}
+
+//Busca tramos de la imagen nueva que ya están en la vieja (hash rodante sobre la nueva,
+//bloques de la vieja indexados cada PASO_INDICE bytes) y los extiende en ambos sentidos
+static void Crear_Parche(const struct ARCHIVO *vieja, const struct ARCHIVO *nueva, struct SALIDA *salida)
+{
+    size_t tabla_largo = (size_t)1 << TABLA_BITS;
+    int64_t *tabla = malloc(tabla_largo * sizeof(int64_t));
+    uint32_t potencia = 1;
+    size_t literal_inicio = 0;
+    size_t p = 0;
+
+    for (size_t i = 0; i < tabla_largo; i++)
+    {
+        tabla[i] = -1;
+    }
+    for (size_t o = 0; o + BLOQUE_HASH <= vieja->largo; o += PASO_INDICE)
+    {
+        tabla[Hash_Bloque(&vieja->datos[o]) & (tabla_largo - 1)] = o;
+    }
+    for (int i = 1; i < BLOQUE_HASH; i++)
+    {
+        potencia *= MULTIPLICADOR;
+    }
+
+    uint32_t h = (nueva->largo >= BLOQUE_HASH) ? Hash_Bloque(nueva->datos) : 0;
+    while (p + BLOQUE_HASH <= nueva->largo)
+    {
+        int64_t o = tabla[h & (tabla_largo - 1)];
+        if ((o >= 0) && (memcmp(&vieja->datos[o], &nueva->datos[p], BLOQUE_HASH) == 0))
+        {
+            size_t inicio_n = p;
+            size_t inicio_o = o;
+            size_t fin_n = p + BLOQUE_HASH;
+            size_t fin_o = o + BLOQUE_HASH;
+
+            while ((inicio_n > literal_inicio) && (inicio_o > 0) && (nueva->datos[inicio_n - 1] == vieja->datos[inicio_o - 1]))
+            {
+                inicio_n--;
+                inicio_o--;
+            }
+            while ((fin_n < nueva->largo) && (fin_o < vieja->largo) && (nueva->datos[fin_n] == vieja->datos[fin_o]))
+            {
+                fin_n++;
+                fin_o++;
+            }
+
+            if (fin_n - inicio_n >= COPIA_MINIMA)
+            {
+                Emitir_Literal(salida, &nueva->datos[literal_inicio], inicio_n - literal_inicio);
+                Emitir_Copia(salida, inicio_o, fin_n - inicio_n);
+                p = fin_n;
+                literal_inicio = p;
+                if (p + BLOQUE_HASH <= nueva->largo)
+                {
+                    h = Hash_Bloque(&nueva->datos[p]);
+                }
+                continue;
+            }
+        }
+
+        if (p + BLOQUE_HASH < nueva->largo)
+        {
+            h = (h - nueva->datos[p] * potencia) * MULTIPLICADOR + nueva->datos[p + BLOQUE_HASH];
+        }
+        p++;
+    }
+    Emitir_Literal(salida, &nueva->datos[literal_inicio], nueva->largo - literal_inicio);
+    free(tabla);
+}
+
+//Aplica el parche como lo hace el porton, para verificarlo antes de enviarlo
+static int Aplicar_Parche(const struct ARCHIVO *vieja, const struct SALIDA *parche, const struct ARCHIVO *esperada)
+{
+    struct SALIDA resultado = { 0 };
+    size_t p = 0;
+    uint32_t a;
+    uint32_t b;
+    int correcto = 1;
+
+    while (correcto && (p < parche->largo))
+    {
+        uint8_t op = parche->datos[p++];
+        memcpy(&a, &parche->datos[p], 4);
+        p += 4;
+        if (op == 'D')
+        {
+            Salida_Agregar(&resultado, &parche->datos[p], a);
+            p += a;
+        }
+        else
+        {
+            memcpy(&b, &parche->datos[p], 4);
+            p += 4;
+            correcto = (a + (size_t)b <= vieja->largo);
+            if (correcto)
+            {
+                Salida_Agregar(&resultado, &vieja->datos[a], b);
+            }
+        }
+    }
+    correcto = correcto && (resultado.largo == esperada->largo) && (memcmp(resultado.datos, esperada->datos, esperada->largo) == 0);
+    free(resultado.datos);
+    return correcto;
+}
+
+static int Comando_Crear(const char *ruta_vieja, const char *ruta_nueva, const char *ruta_parche)
+{
+    struct ARCHIVO vieja;
+    struct ARCHIVO nueva;
+    struct SALIDA parche = { 0 };
+
+    if (!Leer_Archivo(ruta_vieja, &vieja) || !Leer_Archivo(ruta_nueva, &nueva))
+    {
+        return 2;
+    }
+
+    clock_t inicio = clock();
+    Crear_Parche(&vieja, &nueva, &parche);
+    double segundos = (double)(clock() - inicio) / CLOCKS_PER_SEC;
+
+    if (!Aplicar_Parche(&vieja, &parche, &nueva))
+    {
+        fprintf(stderr, "El parche no reproduce la imagen nueva\n");
+        return 1;
+    }
+
+    FILE *f = fopen(ruta_parche, "wb");
+    if ((f == NULL) || (fwrite(parche.datos, 1, parche.largo, f) != parche.largo))
+    {
+        perror(ruta_parche);
+        return 2;
+    }
+    fclose(f);
+
+    printf("Imagen nueva: %zu bytes, parche: %zu bytes (%.1f%%)\n", nueva.largo, parche.largo,
+           nueva.largo ? 100.0 * parche.largo / nueva.largo : 0.0);
+    printf("Copias: %" PRIu32 " (%zu bytes), bloques nuevos: %" PRIu32 ", CPU: %.3f s\n",
+           parche.copias, parche.bytes_copiados, parche.literales, segundos);
+    return 0;
+}
+
+
+//*************************** Envío ***************************//
+
+static int Publicar(int fd, const char *topic, const void *datos, size_t largo)
+{
+    static uint8_t buf[OTA_BLOQUE + 256];
+    return Mqtt_Enviar(fd, buf, Mqtt_Armar_Publish(buf, topic, datos, largo));
+}
+
+static int Conectar(const char *host, int puerto, struct MQTT_LECTOR *lector)
+{
+    uint8_t buf[128];
+    int fd = Mqtt_Conectar(host, puerto, "ota-delta", lector);
+
+    if ((fd >= 0) && (Mqtt_Enviar(fd, buf, Mqtt_Armar_Subscribe(buf, 1, TOPIC_OTA_ESTADO)) < 0))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static double Segundos(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int Comando_Enviar(const char *broker, const char *clave, const char *ruta_nueva, const char *ruta_vieja,
+                          const char *ruta_parche)
+{
+    static struct MQTT_LECTOR lector;
+    struct MQTT_PAQUETE paquete;
+    struct ARCHIVO nueva;
+    struct ARCHIVO vieja = { 0 };
+    struct ARCHIVO envio;
+    char host[128];
+    char inicio[256];
+    char sha[SHA256_HEX];
+    char base_sha[SHA256_HEX] = "-";
+    char firma[SHA256_HEX];
+    char topic[64];
+    char estado[64];
+    int puerto = 1883;
+    size_t bytes_enviados = 0;
+    uint32_t bloques = 0;
+    uint32_t reconexiones = 0;
+
+    snprintf(host, sizeof(host), "%s", broker);
+    char *separador = strchr(host, ':');
+    if (separador != NULL)
+    {
+        *separador = '\0';
+        puerto = atoi(separador + 1);
+    }
+    if (!Leer_Archivo(ruta_nueva, &nueva) ||
+        ((ruta_parche != NULL) && (!Leer_Archivo(ruta_vieja, &vieja) || !Leer_Archivo(ruta_parche, &envio))))
+    {
+        return 2;
+    }
+    if (ruta_parche == NULL)
+    {
+        envio = nueva;
+    }
+    else
+    {
+        Sha256_Hex(vieja.datos, vieja.largo, base_sha);
+    }
+
+    //Manifiesto: "<tipo>:<bytes a recibir>:<bytes de la imagen>:<sha256>:<bytes de la base>:<sha256 de la base>:<número>"
+    //seguido de ":<HMAC-SHA256 de todo lo anterior>"
+    Sha256_Hex(nueva.datos, nueva.largo, sha);
+    snprintf(inicio, sizeof(inicio), "%s:%zu:%zu:%s:%zu:%s:%ld", (ruta_parche != NULL) ? "delta" : "completa",
+             envio.largo, nueva.largo, sha, vieja.largo, base_sha, (long)(time(NULL) - EPOCA_2024));
+    Hmac_Sha256_Hex(clave, inicio, strlen(inicio), firma);
+    snprintf(inicio + strlen(inicio), sizeof(inicio) - strlen(inicio), ":%s", firma);
+
+    double t_inicio = Segundos();
+    clock_t cpu_inicio = clock();
+    int fd = -1;
+    double ultimo_estado = 0;
+
+    for (;;)
+    {
+        //Conexión (o reconexión): el inicio le pide al porton desde qué offset seguir
+        if (fd < 0)
+        {
+            fd = Conectar(host, puerto, &lector);
+            if (fd < 0)
+            {
+                fprintf(stderr, "Sin conexión con %s:%d, reintentando\n", host, puerto);
+                sleep(1);
+                continue;
+            }
+            Publicar(fd, TOPIC_OTA_INICIO, inicio, strlen(inicio));
+            ultimo_estado = Segundos();
+        }
+
+        int r = Mqtt_Leer(fd, &lector, &paquete, 1000);
+        if (r < 0)
+        {
+            close(fd);
+            fd = -1;
+            reconexiones++;
+            continue;
+        }
+        if ((r == 0) || (paquete.tipo != MQTT_PUBLISH))
+        {
+            if (Segundos() - ultimo_estado > ESPERA_ESTADO_MS / 1000.0)
+            {
+                Publicar(fd, TOPIC_OTA_INICIO, inicio, strlen(inicio));
+                ultimo_estado = Segundos();
+            }
+            continue;
+        }
+
+        snprintf(estado, sizeof(estado), "%.*s", (int)paquete.largo, (const char *)paquete.datos);
+        ultimo_estado = Segundos();
+
+        if (strncmp(estado, "error:", 6) == 0)
+        {
+            fprintf(stderr, "El porton rechazó la OTA: %s\n", estado + 6);
+            return 1;
+        }
+        if (strncmp(estado, "ok:", 3) == 0)
+        {
+            double segundos = Segundos() - t_inicio;
+            printf("Transferencia %s: %zu bytes de %zu (imagen), %" PRIu32 " bloques, %zu bytes por MQTT\n",
+                   (ruta_parche != NULL) ? "delta" : "completa", envio.largo, nueva.largo, bloques, bytes_enviados);
+            printf("Tiempo: %.2f s (%.1f kB/s), CPU en la PC: %.3f s, reconexiones: %" PRIu32 "\n",
+                   segundos, envio.largo / 1024.0 / segundos, (double)(clock() - cpu_inicio) / CLOCKS_PER_SEC, reconexiones);
+            printf("Porton (ms escribiendo:ms total): %s\n", estado + 3);
+            close(fd);
+            return 0;
+        }
+
+        //El porton pide el bloque que empieza en este offset
+        size_t offset = strtoul(estado, NULL, 10);
+        if (offset >= envio.largo)
+        {
+            continue;
+        }
+        size_t largo = (envio.largo - offset < OTA_BLOQUE) ? envio.largo - offset : OTA_BLOQUE;
+        snprintf(topic, sizeof(topic), TOPIC_OTA_BLOQUE "%zu", offset);
+        if (Publicar(fd, topic, &envio.datos[offset], largo) < 0)
+        {
+            close(fd);
+            fd = -1;
+            reconexiones++;
+            continue;
+        }
+        bloques++;
+        bytes_enviados += largo;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    if ((argc == 5) && (strcmp(argv[1], "crear") == 0))
+    {
+        return Comando_Crear(argv[2], argv[3], argv[4]);
+    }
+    if (((argc == 5) || (argc == 7)) && (strcmp(argv[1], "enviar") == 0))
+    {
+        return Comando_Enviar(argv[2], argv[3], argv[4], (argc == 7) ? argv[5] : NULL, (argc == 7) ? argv[6] : NULL);
+    }
+    fprintf(stderr, "uso: %s crear vieja.bin nueva.bin parche.bin\n", argv[0]);
+    fprintf(stderr, "     %s enviar broker[:puerto] clave nueva.bin [vieja.bin parche.bin]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,105 @@
+/***********************************************************/
+/*  Plataforma inerte de PORTON_HOST                       */
+/*                                                         */
+/*  Lo que los firmwares llaman y que en la PC no hace     */
+/*  nada: Wi-Fi, NVS, OTA, mDNS, HMAC, el arranque del     */
+/*  cliente MQTT, la sesión TLS y los mutex (el firmware   */
+/*  corre de a una tarea por vez). Cada herramienta lo     */
+/*  incluye una vez después de los firmwares y pone por    */
+/*  su cuenta el reloj (vTaskDelay, xTaskDelayUntil,       */
+/*  esp_timer), los GPIO, las colas y la publicación y     */
+/*  suscripción MQTT. Con PORTON_HOST_NVS también pone la  */
+/*  NVS de las particiones (la del outbox).                */
+/***********************************************************/
+
+#include "porton_host.h"
+#include "../sesion_tls.h"
+
+#include <string.h>
+
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+void esp_log_level_set(const char *tag, esp_log_level_t nivel) {}
+uint32_t esp_get_free_heap_size(void) { return 0; }
+const char *esp_get_idf_version(void) { return "host"; }
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t tarea, const char *nombre, uint32_t pila, void *parametro,
+                                   UBaseType_t prioridad, TaskHandle_t *handle, BaseType_t nucleo) { return pdTRUE; }
+void vTaskDelete(TaskHandle_t tarea) {}
+BaseType_t xTaskNotifyGive(TaskHandle_t tarea) { return pdTRUE; }
+uint32_t ulTaskNotifyTake(BaseType_t limpiar, TickType_t espera) { return 0; }
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { static int mutex; return &mutex; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaforo, TickType_t espera) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaforo) { return pdTRUE; }
+EventGroupHandle_t xEventGroupCreate(void) { return NULL; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t grupo, EventBits_t bits) { return 0; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t grupo, EventBits_t bits) { return 0; }
+EventBits_t xEventGroupGetBits(EventGroupHandle_t grupo) { return 0; }
+esp_err_t gpio_reset_pin(gpio_num_t gpio) { return ESP_OK; }
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t modo) { return ESP_OK; }
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t modo) { return ESP_OK; }
+esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg) { return ESP_OK; }
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg,
+                                              esp_event_handler_instance_t *instancia) { return ESP_OK; }
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+esp_netif_t *esp_netif_create_default_wifi_sta(void) { return NULL; }
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t modo) { return ESP_OK; }
+esp_err_t esp_wifi_set_config(wifi_interface_t interfaz, wifi_config_t *config) { return ESP_OK; }
+esp_err_t esp_wifi_start(void) { return ESP_OK; }
+esp_err_t esp_wifi_connect(void) { return ESP_OK; }
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+esp_err_t nvs_open(const char *espacio, nvs_open_mode_t modo, nvs_handle_t *handle) { return ESP_FAIL; }
+#ifndef PORTON_HOST_NVS
+esp_err_t nvs_flash_init_partition(const char *particion) { return ESP_FAIL; }
+esp_err_t nvs_flash_erase_partition(const char *particion) { return ESP_OK; }
+esp_err_t nvs_open_from_partition(const char *particion, const char *espacio, nvs_open_mode_t modo, nvs_handle_t *handle) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *clave, void *datos, size_t *largo) { return ESP_ERR_NVS_NOT_FOUND; }
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *clave, const void *datos, size_t largo) { return ESP_FAIL; }
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *clave, uint32_t *valor) { return ESP_ERR_NVS_NOT_FOUND; }
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *clave, uint32_t valor) { return ESP_FAIL; }
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *clave) { return ESP_OK; }
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+#endif
+const char *esp_err_to_name(esp_err_t codigo) { return "ESP_FAIL"; }
+esp_err_t example_connect(void) { return ESP_OK; }
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t tipo) { memset(mac, 0, 6); return ESP_OK; }
+const uint8_t broker_ca_pem_start[] asm("_binary_broker_ca_pem_start") = "";
+esp_transport_handle_t Sesion_TLS_Transporte(const struct SESION_TLS_CONFIG *config) { return NULL; }
+void Sesion_TLS_Estadisticas(struct SESION_TLS_ESTADISTICAS *estadisticas) { memset(estadisticas, 0, sizeof(*estadisticas)); }
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) { return NULL; }
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t evento,
+                                         esp_event_handler_t handler, void *arg) { return ESP_OK; }
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) { return ESP_OK; }
+esp_err_t mdns_init(void) { return ESP_OK; }
+esp_err_t mdns_hostname_set(const char *nombre) { return ESP_OK; }
+esp_err_t mdns_instance_name_set(const char *nombre) { return ESP_OK; }
+esp_err_t mdns_service_add(const char *instancia, const char *servicio, const char *protocolo, uint16_t puerto,
+                           void *txt, size_t txt_largo) { return ESP_OK; }
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t tipo) { return NULL; }
+int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *clave, size_t clave_largo,
+                    const unsigned char *entrada, size_t largo, unsigned char *salida) { return -1; }
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {}
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {}
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int es224) { return -1; }
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *entrada, size_t largo) { return -1; }
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char salida[32]) { return -1; }
+void esp_restart(void) {}
+const esp_partition_t *esp_ota_get_running_partition(void) { return NULL; }
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *desde) { return NULL; }
+esp_err_t esp_ota_begin(const esp_partition_t *particion, size_t tamano, esp_ota_handle_t *handle) { return ESP_FAIL; }
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *datos, size_t largo) { return ESP_FAIL; }
+esp_err_t esp_ota_end(esp_ota_handle_t handle) { return ESP_FAIL; }
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) { return ESP_OK; }
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *particion) { return ESP_FAIL; }
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *particion, esp_ota_img_states_t *estado) { return ESP_FAIL; }
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void) { return ESP_OK; }
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void) { return ESP_OK; }
+esp_err_t esp_partition_read(const esp_partition_t *particion, size_t offset, void *destino, size_t largo) { return ESP_FAIL; }
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tareas, UBaseType_t cantidad, configRUN_TIME_COUNTER_TYPE *total) { return 0; }
+TaskHandle_t xTaskGetCurrentTaskHandleForCore(BaseType_t nucleo) { return NULL; }
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer) { return ESP_OK; }
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodo_us) { return ESP_OK; }
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) { return ESP_OK; }
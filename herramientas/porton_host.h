@@ -0,0 +1,298 @@
+/***********************************************************/
+/*  Sustituto de ESP-IDF y FreeRTOS para compilar          */
+/*  "Maquina de etado mircro.c" y "MQTT proyecto final.c"  */
+/*  en la PC (PORTON_HOST).                                */
+/*                                                         */
+/*  Solo declara lo que usan los firmwares. Lo que no hace */
+/*  nada en la PC está en porton_host.c; el reloj, los     */
+/*  GPIO, las colas y el cliente MQTT los pone cada        */
+/*  herramienta.                                           */
+/***********************************************************/
+
+#ifndef PORTON_HOST_H
+#define PORTON_HOST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+//Configuración de la compilación (sdkconfig)
+#define CONFIG_FREERTOS_UNICORE 0
+#define CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_0 1
+#define CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0 1
+#define CONFIG_MQTT_USE_CORE_0 1
+#define CONFIG_BROKER_URL "mqtt://localhost"
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 1
+#define CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD 1
+#define CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE 1
+#define CONFIG_MQTT_REPORT_DELETED_MESSAGES 1
+
+
+//Errores y registro
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERROR_CHECK(x) (void)(x)
+#define ESP_LOGE(tag, formato, ...) printf("E (%s) " formato "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, formato, ...) printf("W (%s) " formato "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, formato, ...) printf("I (%s) " formato "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, formato, ...) do {} while (0)
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+void esp_log_level_set(const char *tag, esp_log_level_t nivel);
+uint32_t esp_get_free_heap_size(void);
+const char *esp_get_idf_version(void);
+
+
+//FreeRTOS: un tick es un milisegundo del reloj virtual
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+#define pdTRUE 1
+#define pdFALSE 0
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+typedef struct { int reservado; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define taskENTER_CRITICAL(mux) (void)(mux)
+#define taskEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_SAFE(mux) (void)(mux)
+#define portEXIT_CRITICAL_SAFE(mux) (void)(mux)
+#define portNUM_PROCESSORS 1
+#define IRAM_ATTR
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskDelayUntil(TickType_t *previo, TickType_t incremento);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t tarea, const char *nombre, uint32_t pila, void *parametro,
+                                   UBaseType_t prioridad, TaskHandle_t *handle, BaseType_t nucleo);
+void vTaskDelete(TaskHandle_t tarea);
+BaseType_t xTaskNotifyGive(TaskHandle_t tarea);
+uint32_t ulTaskNotifyTake(BaseType_t limpiar, TickType_t espera);
+typedef void *QueueHandle_t;
+QueueHandle_t xQueueCreate(UBaseType_t largo, UBaseType_t tamano);
+BaseType_t xQueueSend(QueueHandle_t cola, const void *elemento, TickType_t espera);
+BaseType_t xQueueReceive(QueueHandle_t cola, void *elemento, TickType_t espera);
+typedef void *SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaforo, TickType_t espera);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaforo);
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+typedef struct
+{
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    configRUN_TIME_COUNTER_TYPE ulRunTimeCounter;
+    uint32_t usStackHighWaterMark;
+} TaskStatus_t;
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tareas, UBaseType_t cantidad, configRUN_TIME_COUNTER_TYPE *total);
+TaskHandle_t xTaskGetCurrentTaskHandleForCore(BaseType_t nucleo);
+int64_t esp_timer_get_time(void);
+typedef struct esp_timer *esp_timer_handle_t;
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+typedef struct
+{
+    void (*callback)(void *arg);
+    void *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char *name;
+} esp_timer_create_args_t;
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodo_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+typedef void *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+#define BIT0 0x00000001
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t grupo, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t grupo, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t grupo);
+
+
+//GPIO
+typedef int gpio_num_t;
+#define GPIO_NUM_2 2
+#define GPIO_NUM_23 23
+typedef enum { GPIO_MODE_INPUT, GPIO_MODE_OUTPUT } gpio_mode_t;
+typedef enum { GPIO_PULLUP_ONLY, GPIO_PULLDOWN_ONLY, GPIO_PULLUP_PULLDOWN, GPIO_FLOATING } gpio_pull_mode_t;
+esp_err_t gpio_reset_pin(gpio_num_t gpio);
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t modo);
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t modo);
+int gpio_get_level(gpio_num_t gpio);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t nivel);
+
+
+//Eventos, Wi-Fi y NVS
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *datos);
+typedef void *esp_event_handler_instance_t;
+extern esp_event_base_t WIFI_EVENT;
+extern esp_event_base_t IP_EVENT;
+#define ESP_EVENT_ANY_ID -1
+#define WIFI_EVENT_STA_START 2
+#define WIFI_EVENT_STA_DISCONNECTED 5
+#define IP_EVENT_STA_GOT_IP 0
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg);
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg,
+                                              esp_event_handler_instance_t *instancia);
+typedef struct esp_netif_obj esp_netif_t;
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+typedef struct { esp_ip4_addr_t ip; esp_ip4_addr_t netmask; esp_ip4_addr_t gw; } esp_netif_ip_info_t;
+typedef struct { int if_index; esp_netif_t *esp_netif; esp_netif_ip_info_t ip_info; bool ip_changed; } ip_event_got_ip_t;
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ip) (int)((ip)->addr & 0xFF), (int)(((ip)->addr >> 8) & 0xFF), (int)(((ip)->addr >> 16) & 0xFF), (int)(((ip)->addr >> 24) & 0xFF)
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; int8_t rssi; } wifi_event_sta_disconnected_t;
+typedef struct { int reservado; } wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA } wifi_mode_t;
+typedef enum { WIFI_IF_STA } wifi_interface_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK } wifi_auth_mode_t;
+typedef union
+{
+    struct
+    {
+        uint8_t ssid[32];
+        uint8_t password[64];
+        struct { wifi_auth_mode_t authmode; } threshold;
+    } sta;
+} wifi_config_t;
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_set_mode(wifi_mode_t modo);
+esp_err_t esp_wifi_set_config(wifi_interface_t interfaz, wifi_config_t *config);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1110
+esp_err_t nvs_flash_init_partition(const char *particion);
+esp_err_t nvs_flash_erase_partition(const char *particion);
+esp_err_t nvs_open_from_partition(const char *particion, const char *espacio, nvs_open_mode_t modo, nvs_handle_t *handle);
+esp_err_t nvs_open(const char *espacio, nvs_open_mode_t modo, nvs_handle_t *handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *clave, void *datos, size_t *largo);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *clave, const void *datos, size_t largo);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *clave, uint32_t *valor);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *clave, uint32_t valor);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *clave);
+esp_err_t nvs_commit(nvs_handle_t handle);
+#define NVS_KEY_NAME_MAX_SIZE 16
+const char *esp_err_to_name(esp_err_t codigo);
+esp_err_t example_connect(void);
+void esp_restart(void);
+typedef enum { ESP_MAC_WIFI_STA } esp_mac_type_t;
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t tipo);
+
+
+//Cliente MQTT; con mqtts:// el transporte lo pone sesion_tls.c
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+typedef struct esp_transport_item_t *esp_transport_handle_t;
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+typedef enum { MQTT_ERROR_TYPE_NONE, MQTT_ERROR_TYPE_TCP_TRANSPORT } esp_mqtt_error_type_t;
+typedef struct
+{
+    esp_err_t esp_tls_last_esp_err;
+    int esp_tls_stack_err;
+    esp_mqtt_error_type_t error_type;
+    int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    esp_mqtt_error_codes_t *error_handle;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef struct
+{
+    struct
+    {
+        struct { const char *uri; } address;
+    } broker;
+    struct { const char *client_id; } credentials;
+    struct { bool disable_clean_session; int keepalive; } session;
+    struct { esp_transport_handle_t transport; } network;
+    struct { int priority; } task;
+    struct { int size; } buffer;
+} esp_mqtt_client_config_t;
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t evento,
+                                         esp_event_handler_t handler, void *arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *datos, int largo,
+                            int qos, int retain);
+
+
+//mDNS, HMAC y SHA-256
+esp_err_t mdns_init(void);
+esp_err_t mdns_hostname_set(const char *nombre);
+esp_err_t mdns_instance_name_set(const char *nombre);
+esp_err_t mdns_service_add(const char *instancia, const char *servicio, const char *protocolo, uint16_t puerto,
+                           void *txt, size_t txt_largo);
+typedef enum { MBEDTLS_MD_SHA256 = 6 } mbedtls_md_type_t;
+typedef struct mbedtls_md_info_t mbedtls_md_info_t;
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t tipo);
+int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *clave, size_t clave_largo,
+                    const unsigned char *entrada, size_t largo, unsigned char *salida);
+
+typedef struct { uint32_t estado[8]; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int es224);
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *entrada, size_t largo);
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char salida[32]);
+
+
+//OTA y particiones
+typedef uint32_t esp_ota_handle_t;
+typedef struct { uint32_t address; uint32_t size; char label[17]; } esp_partition_t;
+typedef enum { ESP_OTA_IMG_NEW, ESP_OTA_IMG_PENDING_VERIFY, ESP_OTA_IMG_VALID } esp_ota_img_states_t;
+#define OTA_WITH_SEQUENTIAL_WRITES 0xFFFFFFFE
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *desde);
+esp_err_t esp_ota_begin(const esp_partition_t *particion, size_t tamano, esp_ota_handle_t *handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *datos, size_t largo);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *particion);
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *particion, esp_ota_img_states_t *estado);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void);
+esp_err_t esp_partition_read(const esp_partition_t *particion, size_t offset, void *destino, size_t largo);
+
+#endif /* PORTON_HOST_H */
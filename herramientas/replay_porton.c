@@ -0,0 +1,362 @@
+/***********************************************************/
+/*  Reproducción de trazas de la máquina de estado         */
+/*                                                         */
+/*  Compila el firmware del porton en la PC y lo alimenta  */
+/*  con una traza grabada (Porton/traza/datos) usando un   */
+/*  reloj virtual: un día de operación se reproduce en     */
+/*  segundos. Compara las transiciones y temporizadores    */
+/*  de la reproducción con los grabados.                   */
+/*                                                         */
+/*  Compilar (desde la raíz del repositorio):              */
+/*    gcc -O2 -o replay_porton herramientas/replay_porton.c */
+/*                                                         */
+/*  Uso:                                                   */
+/*    mosquitto_sub -t Porton/traza/datos -C 1 > traza.bin */
+/*    mosquitto_pub -t Porton/traza -m volcar              */
+/*    ./replay_porton traza.bin [-v] [-d ms]               */
+/*                                                         */
+/*  Si la traza dio la vuelta al buffer no se arranca en   */
+/*  Funcion_Start: la máquina entra directo al estado de   */
+/*  la primera transición conservada, con las entradas     */
+/*  que da el estado base de la cabecera.                  */
+/*                                                         */
+/*  Una salida coincide si es el mismo evento y ocurre a   */
+/*  no más de DESFASE_ACEPTADO_MS (o -d ms) del grabado.   */
+/*                                                         */
+/*  Devuelve 0 si la reproducción coincide con la traza,   */
+/*  1 si diverge y 2 si la traza no se pudo leer.          */
+/*  "make -C herramientas check" reproduce las trazas de   */
+/*  herramientas/trazas, grabadas con el firmware original */
+/*  (traza_base.c), contra el firmware actual.             */
+/***********************************************************/
+
+#define PORTON_HOST
+#include "../Maquina de etado mircro.c"
+#include "../perfilador.c"
+#include "../outbox.c"
+#include "porton_host.c"
+
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define FIN_MARGEN_MS 5000          //Tiempo virtual que se sigue corriendo después del último evento
+#define DESFASE_ACEPTADO_MS 100     //Diez periodos del lazo de control
+
+
+//Estado de la reproducción
+struct REPLAY
+{
+    struct TRAZA_EVENTO *grabados;  //Eventos de la traza, en orden
+    uint32_t total;
+    uint32_t siguiente_entrada;     //Próximo evento GPIO/COMANDO a inyectar
+    uint32_t siguiente_esperado;    //Próxima transición/temporizador grabado a comparar
+    uint32_t leidos;                //Eventos de la traza del firmware ya comparados
+    uint32_t ignorar_entrada;       //1 si la primera transición reproducida no está en la traza
+    int64_t ahora_us;               //Reloj virtual
+    int64_t fin_us;
+    int niveles;                    //Limit switch actuales: LSA | (LSC << 1)
+    uint32_t comparados;
+    uint32_t divergencias;
+    int64_t desfase_max_ms;
+    int64_t desfase_aceptado_ms;
+    jmp_buf salida;
+}replay;
+
+
+//Eventos que produce la máquina de estado y que se comparan contra la traza
+static int Es_Salida(const struct TRAZA_EVENTO *evento)
+{
+    return (evento->tipo == TRAZA_TRANSICION) || (evento->tipo == TRAZA_TIMER);
+}
+
+
+static void Imprimir_Evento(const char *prefijo, const struct TRAZA_EVENTO *evento)
+{
+    fprintf(stderr, "%s t=%" PRIu32 " ms tipo=%u a=%u b=%u\n", prefijo, evento->t_ms, evento->tipo, evento->a, evento->b);
+}
+
+
+//Compara las salidas nuevas del firmware contra las grabadas
+static void Comparar_Salidas(void)
+{
+    for (; replay.leidos < traza.escritos; replay.leidos++)
+    {
+        struct TRAZA_EVENTO *obtenido = &traza.eventos[replay.leidos % TRAZA_EVENTOS];
+        if (!Es_Salida(obtenido))
+        {
+            continue;
+        }
+        if (replay.ignorar_entrada)
+        {
+            replay.ignorar_entrada = 0;
+            continue;
+        }
+
+        while ((replay.siguiente_esperado < replay.total) && !Es_Salida(&replay.grabados[replay.siguiente_esperado]))
+        {
+            replay.siguiente_esperado++;
+        }
+        if (replay.siguiente_esperado == replay.total)
+        {
+            //Salida que no está en la traza: es divergencia si ocurrió antes del último evento grabado
+            if (obtenido->t_ms <= replay.grabados[replay.total - 1].t_ms)
+            {
+                if (replay.divergencias++ == 0)
+                {
+                    fprintf(stderr, "Primera divergencia:\n");
+                    Imprimir_Evento("  sobrante:   ", obtenido);
+                }
+            }
+            continue;
+        }
+
+        struct TRAZA_EVENTO *esperado = &replay.grabados[replay.siguiente_esperado++];
+        int64_t desfase = (int64_t)obtenido->t_ms - esperado->t_ms;
+        int iguales = (obtenido->tipo == esperado->tipo) && (obtenido->a == esperado->a) &&
+                      (obtenido->b == esperado->b) && (llabs(desfase) <= replay.desfase_aceptado_ms);
+
+        replay.comparados++;
+        if (llabs(desfase) > replay.desfase_max_ms)
+        {
+            replay.desfase_max_ms = llabs(desfase);
+        }
+        if (!iguales)
+        {
+            if (replay.divergencias++ == 0)
+            {
+                fprintf(stderr, "Primera divergencia:\n");
+                Imprimir_Evento("  grabado:    ", esperado);
+                Imprimir_Evento("  reproducido:", obtenido);
+            }
+        }
+    }
+}
+
+
+//Inyecta las entradas grabadas hasta el instante virtual "hasta_us"
+static void Avanzar_Reloj(int64_t hasta_us)
+{
+    while (replay.siguiente_entrada < replay.total)
+    {
+        struct TRAZA_EVENTO *evento = &replay.grabados[replay.siguiente_entrada];
+        int64_t t_us = (int64_t)evento->t_ms * 1000;
+
+        if (t_us > hasta_us)
+        {
+            break;
+        }
+        replay.siguiente_entrada++;
+        if (t_us > replay.ahora_us)
+        {
+            replay.ahora_us = t_us;
+        }
+
+        if (evento->tipo == TRAZA_GPIO)
+        {
+            replay.niveles = evento->a;
+        }
+        else if (evento->tipo == TRAZA_COMANDO)
+        {
+            char comando[] = "1";
+            Dato_MQTT(comando);
+        }
+    }
+    replay.ahora_us = hasta_us;
+}
+
+
+//FreeRTOS virtual: la única tarea que corre es la máquina de estado
+void vTaskDelay(TickType_t ticks)
+{
+    Avanzar_Reloj(replay.ahora_us + (int64_t)ticks * 1000);
+    Comparar_Salidas();
+
+    if (replay.ahora_us >= replay.fin_us)
+    {
+        longjmp(replay.salida, 1);
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return replay.ahora_us;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    if (gpio == SENSOR_OPEN)
+    {
+        return replay.niveles & 1;
+    }
+    if (gpio == SENSOR_CLOSE)
+    {
+        return (replay.niveles >> 1) & 1;
+    }
+    return 0;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t nivel) { return ESP_OK; }
+
+
+//La red no se usa durante la reproducción, el resto de la plataforma está en porton_host.c
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos) { return 0; }
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *datos, int largo,
+                            int qos, int retain) { return 0; }
+QueueHandle_t xQueueCreate(UBaseType_t largo, UBaseType_t tamano) { return NULL; }
+BaseType_t xQueueSend(QueueHandle_t cola, const void *elemento, TickType_t espera) { return pdFALSE; }
+BaseType_t xQueueReceive(QueueHandle_t cola, void *elemento, TickType_t espera) { return pdFALSE; }
+
+//Lee la traza: cabecera TRZ2 (o TRZ1, sin estado base) seguida de los eventos
+static int Leer_Traza(const char *ruta, struct TRAZA_CABECERA *cabecera)
+{
+    const size_t largo_trz1 = offsetof(struct TRAZA_CABECERA, base);
+
+    memset(cabecera, 0, sizeof(*cabecera));
+    FILE *archivo = fopen(ruta, "rb");
+    if (archivo == NULL)
+    {
+        perror(ruta);
+        return FALSE;
+    }
+    if ((fread(cabecera, largo_trz1, 1, archivo) != 1) ||
+        ((memcmp(cabecera->magia, "TRZ1", 4) != 0) && (memcmp(cabecera->magia, "TRZ2", 4) != 0)) ||
+        ((cabecera->magia[3] == '2') && (fread(&cabecera->base, sizeof(cabecera->base), 1, archivo) != 1)))
+    {
+        fprintf(stderr, "%s: no es una traza TRZ1/TRZ2\n", ruta);
+        fclose(archivo);
+        return FALSE;
+    }
+
+    replay.grabados = calloc(cabecera->eventos ? cabecera->eventos : 1, sizeof(struct TRAZA_EVENTO));
+    replay.total = fread(replay.grabados, sizeof(struct TRAZA_EVENTO), cabecera->eventos, archivo);
+    fclose(archivo);
+
+    if (replay.total != cabecera->eventos)
+    {
+        fprintf(stderr, "%s: traza incompleta (%" PRIu32 " de %" PRIu32 " eventos)\n", ruta, replay.total, cabecera->eventos);
+        return FALSE;
+    }
+    return replay.total > 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct TRAZA_CABECERA cabecera;
+    int detallado = FALSE;
+
+    replay.desfase_aceptado_ms = DESFASE_ACEPTADO_MS;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+        {
+            detallado = TRUE;
+        }
+        else if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc))
+        {
+            replay.desfase_aceptado_ms = atoll(argv[++i]);
+        }
+        else
+        {
+            argc = 0;
+        }
+    }
+    if (argc < 2)
+    {
+        fprintf(stderr, "uso: %s traza.bin [-v] [-d ms]\n", argv[0]);
+        return 2;
+    }
+    if (!Leer_Traza(argv[1], &cabecera))
+    {
+        return 2;
+    }
+
+    //El reloj virtual arranca en el primer evento y sigue un rato después del último
+    replay.ahora_us = (int64_t)replay.grabados[0].t_ms * 1000;
+    replay.fin_us = ((int64_t)replay.grabados[replay.total - 1].t_ms + FIN_MARGEN_MS) * 1000;
+
+    if ((cabecera.perdidos > 0) && (cabecera.magia[3] == '1'))
+    {
+        fprintf(stderr, "Aviso: se perdieron %" PRIu32 " eventos y la traza TRZ1 no trae el estado base\n", cabecera.perdidos);
+    }
+    else if (cabecera.perdidos > 0)
+    {
+        //La traza dio la vuelta. Lo que pasó dentro del estado antes del primer evento conservado se
+        //perdió, así que se arranca en la primera transición conservada: trae el estado, el anterior
+        //y COD_ERR, y los sensores salen de la base más los eventos GPIO previos a ella
+        uint32_t primera = 0;
+        replay.niveles = cabecera.base.sensores;
+        for (; (primera < replay.total) && (replay.grabados[primera].tipo != TRAZA_TRANSICION); primera++)
+        {
+            if (replay.grabados[primera].tipo == TRAZA_GPIO)
+            {
+                replay.niveles = replay.grabados[primera].a;
+            }
+        }
+
+        if (primera < replay.total)
+        {
+            struct TRAZA_EVENTO *transicion = &replay.grabados[primera];
+            NEXT_STATE = transicion->a;
+            STATE = transicion->b & 0xFF;
+            data_io.COD_ERR = transicion->b >> 8;
+            replay.ahora_us = (int64_t)transicion->t_ms * 1000;
+            replay.siguiente_entrada = primera + 1;
+            replay.siguiente_esperado = primera;
+        }
+        else
+        {
+            //Sin transiciones conservadas: se vuelve a entrar al estado base y los tiempos dentro
+            //de él (separación, RT) quedan corridos
+            fprintf(stderr, "Aviso: la traza no conserva ninguna transición, se arranca desde el estado base\n");
+            NEXT_STATE = cabecera.base.estado;
+            STATE = cabecera.base.previo;
+            data_io.COD_ERR = cabecera.base.cod_err;
+            replay.niveles = cabecera.base.sensores;
+            replay.siguiente_entrada = primera;
+            replay.ignorar_entrada = 1;
+        }
+        printf("Se perdieron %" PRIu32 " eventos, se reproduce desde el evento %" PRIu32 "\n", cabecera.perdidos,
+               replay.siguiente_esperado);
+    }
+    int64_t inicio_us = replay.ahora_us;
+
+    //Sin -v se ocultan los mensajes del firmware
+    fflush(stdout);
+    int salida_original = dup(STDOUT_FILENO);
+    if (!detallado)
+    {
+        int nulo = open("/dev/null", O_WRONLY);
+        dup2(nulo, STDOUT_FILENO);
+        close(nulo);
+    }
+
+    clock_t inicio = clock();
+    if (setjmp(replay.salida) == 0)
+    {
+        Maquina_Estado_Task(NULL);
+    }
+    double segundos = (double)(clock() - inicio) / CLOCKS_PER_SEC;
+
+    fflush(stdout);
+    dup2(salida_original, STDOUT_FILENO);
+    close(salida_original);
+
+    //Salidas grabadas que la reproducción nunca produjo
+    uint32_t faltantes = 0;
+    for (; replay.siguiente_esperado < replay.total; replay.siguiente_esperado++)
+    {
+        faltantes += Es_Salida(&replay.grabados[replay.siguiente_esperado]);
+    }
+
+    double virtuales = (double)(replay.fin_us - inicio_us) / 1e6;
+    printf("Eventos grabados: %" PRIu32 "\n", replay.total);
+    printf("Tiempo virtual: %.1f s en %.3f s reales (%.0fx)\n", virtuales, segundos,
+           (segundos > 0) ? virtuales / segundos : 0.0);
+    printf("Salidas comparadas: %" PRIu32 ", divergencias: %" PRIu32 ", faltantes: %" PRIu32 ", desfase maximo: %" PRId64 " ms\n",
+           replay.comparados, replay.divergencias, faltantes, replay.desfase_max_ms);
+
+    return ((replay.divergencias == 0) && (faltantes == 0)) ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/***********************************************************/
+/*  SHA-256 y HMAC-SHA256 para las herramientas de PC      */
+/*                                                         */
+/*  Los mismos resúmenes que calcula el firmware con       */
+/*  mbedtls: el SHA-256 de las imágenes OTA y las firmas   */
+/*  de los comandos LAN y de los manifiestos OTA.          */
+/***********************************************************/
+
+#ifndef SHA256_MIN_H
+#define SHA256_MIN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SHA256_BYTES 32
+#define SHA256_HEX (2 * SHA256_BYTES + 1)
+
+struct SHA256
+{
+    uint32_t h[8];
+    uint8_t bloque[64];
+    size_t en_bloque;
+    uint64_t total;
+};
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROTAR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static inline void Sha256_Bloque(uint32_t h[8], const uint8_t bloque[64])
+{
+    uint32_t w[64];
+    uint32_t v[8];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)bloque[4 * i] << 24) | (bloque[4 * i + 1] << 16) | (bloque[4 * i + 2] << 8) | bloque[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = SHA256_ROTAR(w[i - 15], 7) ^ SHA256_ROTAR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTAR(w[i - 2], 17) ^ SHA256_ROTAR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(v, h, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = SHA256_ROTAR(v[4], 6) ^ SHA256_ROTAR(v[4], 11) ^ SHA256_ROTAR(v[4], 25);
+        uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + ch + SHA256_K[i] + w[i];
+        uint32_t s0 = SHA256_ROTAR(v[0], 2) ^ SHA256_ROTAR(v[0], 13) ^ SHA256_ROTAR(v[0], 22);
+        uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + s0 + maj;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        h[i] += v[i];
+    }
+}
+
+
+static inline void Sha256_Iniciar(struct SHA256 *sha)
+{
+    static const uint32_t INICIAL[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(sha->h, INICIAL, sizeof(sha->h));
+    sha->en_bloque = 0;
+    sha->total = 0;
+}
+
+
+static inline void Sha256_Agregar(struct SHA256 *sha, const void *datos, size_t largo)
+{
+    const uint8_t *p = datos;
+
+    sha->total += largo;
+    while (largo > 0)
+    {
+        size_t n = sizeof(sha->bloque) - sha->en_bloque;
+        if (n > largo)
+        {
+            n = largo;
+        }
+        memcpy(&sha->bloque[sha->en_bloque], p, n);
+        sha->en_bloque += n;
+        p += n;
+        largo -= n;
+        if (sha->en_bloque == sizeof(sha->bloque))
+        {
+            Sha256_Bloque(sha->h, sha->bloque);
+            sha->en_bloque = 0;
+        }
+    }
+}
+
+
+static inline void Sha256_Terminar(struct SHA256 *sha, uint8_t resumen[SHA256_BYTES])
+{
+    uint64_t bits = sha->total * 8;
+    uint8_t relleno[72] = { 0x80 };
+    size_t relleno_largo = ((sha->en_bloque < 56) ? 56 : 120) - sha->en_bloque;
+
+    for (int i = 0; i < 8; i++)
+    {
+        relleno[relleno_largo + i] = bits >> (56 - 8 * i);
+    }
+    Sha256_Agregar(sha, relleno, relleno_largo + 8);
+    for (int i = 0; i < 8; i++)
+    {
+        resumen[4 * i] = sha->h[i] >> 24;
+        resumen[4 * i + 1] = sha->h[i] >> 16;
+        resumen[4 * i + 2] = sha->h[i] >> 8;
+        resumen[4 * i + 3] = sha->h[i];
+    }
+}
+
+
+//Bytes en hexadecimal en minúscula, como los compara el firmware
+static inline void Sha256_A_Hex(const uint8_t resumen[SHA256_BYTES], char hex[SHA256_HEX])
+{
+    for (int i = 0; i < SHA256_BYTES; i++)
+    {
+        sprintf(&hex[2 * i], "%02x", resumen[i]);
+    }
+}
+
+
+static inline void Sha256_Hex(const void *datos, size_t largo, char hex[SHA256_HEX])
+{
+    struct SHA256 sha;
+    uint8_t resumen[SHA256_BYTES];
+
+    Sha256_Iniciar(&sha);
+    Sha256_Agregar(&sha, datos, largo);
+    Sha256_Terminar(&sha, resumen);
+    Sha256_A_Hex(resumen, hex);
+}
+
+
+//HMAC-SHA256 (RFC 2104) en hexadecimal, igual a mbedtls_md_hmac con MBEDTLS_MD_SHA256
+static inline void Hmac_Sha256_Hex(const char *clave, const void *datos, size_t largo, char hex[SHA256_HEX])
+{
+    struct SHA256 sha;
+    uint8_t bloque_clave[64] = { 0 };
+    uint8_t relleno[64];
+    uint8_t resumen[SHA256_BYTES];
+    size_t clave_largo = strlen(clave);
+
+    if (clave_largo > sizeof(bloque_clave))
+    {
+        Sha256_Iniciar(&sha);
+        Sha256_Agregar(&sha, clave, clave_largo);
+        Sha256_Terminar(&sha, bloque_clave);
+    }
+    else
+    {
+        memcpy(bloque_clave, clave, clave_largo);
+    }
+
+    for (int i = 0; i < 64; i++)
+    {
+        relleno[i] = bloque_clave[i] ^ 0x36;
+    }
+    Sha256_Iniciar(&sha);
+    Sha256_Agregar(&sha, relleno, sizeof(relleno));
+    Sha256_Agregar(&sha, datos, largo);
+    Sha256_Terminar(&sha, resumen);
+
+    for (int i = 0; i < 64; i++)
+    {
+        relleno[i] = bloque_clave[i] ^ 0x5c;
+    }
+    Sha256_Iniciar(&sha);
+    Sha256_Agregar(&sha, relleno, sizeof(relleno));
+    Sha256_Agregar(&sha, resumen, sizeof(resumen));
+    Sha256_Terminar(&sha, resumen);
+    Sha256_A_Hex(resumen, hex);
+}
+
+#endif /* SHA256_MIN_H */
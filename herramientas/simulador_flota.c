@@ -0,0 +1,1483 @@
+/***********************************************************/
+/*  Simulador de flota                                     */
+/*                                                         */
+/*  Corre miles de instancias del firmware del porton      */
+/*  ("Maquina de etado mircro.c") y del control del LED    */
+/*  ("MQTT proyecto final.c") en un solo proceso, cada     */
+/*  una con su propia conexión MQTT a un broker local,     */
+/*  para probar la carga del broker y del backend.         */
+/*                                                         */
+/*  Los firmwares se compilan tal cual con PORTON_HOST     */
+/*  (simulador_porton.c y simulador_led.c). Las tareas de  */
+/*  cada instancia corren en su propia pila y ceden en     */
+/*  vTaskDelay y xTaskDelayUntil; el tiempo es virtual y   */
+/*  avanza por rondas. En cada ronda un pool de hilos con  */
+/*  robo de trabajo procesa todas las instancias: la red   */
+/*  (lectura, reconexión, comandos de la aplicación) va en */
+/*  paralelo; el firmware corre con un lock, porque sus    */
+/*  globales son una sola copia que se restaura y se       */
+/*  guarda por instancia. Los firmwares van entonces de a  */
+/*  una instancia por vez: los pasos por segundo no        */
+/*  escalan con los hilos, y la columna lock(%) dice qué   */
+/*  parte de la corrida estuvo tomado.                     */
+/*                                                         */
+/*  Cada instancia publica sus propios comandos en su      */
+/*  topic, como lo haría la aplicación. La latencia es     */
+/*  tiempo virtual desde la publicación hasta el paso en   */
+/*  que la máquina de estado aplica el comando; la espera  */
+/*  del broker entra redondeada a rondas, por eso la       */
+/*  latencia se mide con -x fijo: con -x 0 las rondas son  */
+/*  tan cortas que el viaje al broker se estira en tiempo  */
+/*  virtual. Los comandos que la máquina descarta (el      */
+/*  porton en movimiento) se cuentan aparte.               */
+/*                                                         */
+/*  Una conexión que se cae se reintenta con espera        */
+/*  exponencial, en tiempo real, y el firmware recibe los  */
+/*  eventos de desconexión y reconexión de esp-mqtt.       */
+/*                                                         */
+/*  Outbox_Task corre como una tarea más de cada instancia,*/
+/*  con su cola y la partición del outbox en RAM. Lo que   */
+/*  se publica con QoS 1 queda, como en el outbox de       */
+/*  esp-mqtt, hasta que llega el PUBACK: se retransmite al */
+/*  reconectar y pasado OUTBOX_VENCE_US se borra con       */
+/*  MQTT_EVENT_DELETED.                                    */
+/*                                                         */
+/*  Compilar:                                              */
+/*    make -C herramientas simulador_flota                 */
+/*                                                         */
+/*  Uso:                                                   */
+/*    ./simulador_flota [-b broker[:puerto]] [-n portones] */
+/*        [-l leds] [-t segundos virtuales] [-j 1,2,4,8]   */
+/*        [-x velocidad] [-c segundos entre comandos]      */
+/*        [-f probabilidad de falla] [-r ms por ronda]     */
+/*        [-v]                                             */
+/*                                                         */
+/*  -j corre la misma flota con cada cantidad de hilos,    */
+/*  para ver cuánto aporta repartir la red. -x 0 avanza el */
+/*  tiempo virtual lo más rápido posible, -x 1 en tiempo   */
+/*  real. -v muestra los mensajes de los firmwares.        */
+/***********************************************************/
+
+#define _GNU_SOURCE
+#define PORTON_HOST
+#define PORTON_HOST_NVS                 //La NVS del outbox la pone el simulador, por instancia
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define MQTT_PAQUETE_MAX 512            //Los mensajes que reciben las instancias son cortos
+#include "mqtt_min.h"
+#include "simulador_flota.h"
+
+//El perfilador, el outbox y la plataforma inerte van una sola vez, los usan los dos firmwares
+#include "../perfilador.c"
+#include "../outbox.c"
+#include "porton_host.c"
+
+#define TRUE 1
+#define FALSE 0
+
+//Simulación
+#define FIRMWARES 2
+#define INSTANCIAS_POR_TAREA 32         //Unidad de trabajo del pool
+#define HILOS_MAX 64
+#define PILA_TAREA (64 * 1024)          //Pila de cada tarea del firmware, alcanza para printf
+#define BANDEJA 16                      //Eventos por instancia y ronda para el handler MQTT del firmware
+#define BANDEJA_LIBRE 4                 //Lugar reservado para los eventos de conexión
+#define TOPIC_MAX 96
+#define DATOS_MAX 128                   //Comandos y ecos; lo más largo no es para la máquina de estado y no se entrega
+#define PUBLICACION_MAX 640             //Cabe el evento más largo del outbox
+#define SIN_PUBACK_MAX 16               //Publicaciones QoS 1 esperando PUBACK por instancia (outbox de esp-mqtt)
+#define OUTBOX_VENCE_US 30000000LL      //Como MQTT_OUTBOX_EXPIRED_TIMEOUT_MS: sin PUBACK en este tiempo virtual se borra
+#define NVS_OUTBOX 1                    //Handle de la partición del outbox; los de la NVS del firmware siguen inertes
+#define PING_NS 30000000000LL           //Sin publicar en este tiempo se envía PINGREQ
+#define CONNACK_NS 5000000000LL         //Espera del CONNACK de una reconexión
+#define RECONEXION_MIN_NS 500000000LL   //Espera antes de reconectar, se duplica con cada intento fallido
+#define RECONEXION_MAX_NS 10000000000LL //Como reconnect_timeout_ms de esp-mqtt
+#define COMANDO_PERDIDO_US 10000000LL   //Un comando que no llega al firmware en este tiempo virtual
+#define COMANDO_PERDIDO_NS 10000000000LL //y en este tiempo real se da por perdido
+#define LATENCIA_BIN_US 100
+#define LATENCIA_BINS 100000            //Histograma hasta 10 s virtuales, lo demás va al último bin
+
+#define CLIENTE_SIM ((esp_mqtt_client_handle_t)&sim)    //Handle que ven los firmwares, la conexión sale de la instancia
+
+
+//Evento para el handler del firmware; se junta sin el lock y se entrega con él
+struct EVENTO_SIM
+{
+    esp_mqtt_event_id_t id;
+    int msg_id;
+    int sesion;                         //session_present del CONNACK
+    int error;                          //errno de la conexión para MQTT_EVENT_ERROR
+    int topic_largo;
+    int largo;
+    char topic[TOPIC_MAX];
+    char datos[DATOS_MAX];
+};
+
+//Publicación QoS 1 sin PUBACK, armada para retransmitirla tal cual
+struct PUBLICACION_SIM
+{
+    uint16_t msg_id;
+    uint16_t largo;
+    int64_t creada_us;
+    uint8_t paquete[PUBLICACION_MAX];
+};
+
+//Partición del outbox de una instancia: las claves "ev<slot>" y "sec" de outbox.c
+struct NVS_SIM
+{
+    uint32_t secuencia;
+    int hay_secuencia;
+    size_t largo[OUTBOX_EVENTOS];   //0 si la clave no existe
+    struct OUTBOX_EVENTO eventos[OUTBOX_EVENTOS];
+};
+
+//Tarea del firmware en una instancia: corre en su propia pila y vuelve al hilo del pool al dormir
+struct TAREA_SIM
+{
+    ucontext_t contexto;
+    void *pila;
+    int64_t despertar_us;
+};
+
+struct HILO;
+
+//Una instancia simulada: conexión propia, las globales de su firmware y sus tareas
+struct INSTANCIA
+{
+    const struct FIRMWARE_SIM *firmware;
+    const struct OUTBOX_CONFIG *outbox;
+    uint32_t numero;
+    void *estado;                       //Globales del firmware y modelo físico (FIRMWARE_SIM.estado_largo)
+    struct TAREA_SIM tareas[FIRMWARE_TAREAS_MAX + 1];  //Las del firmware y al final Outbox_Task
+    int tarea_actual;                   //-1 fuera de las tareas (handler MQTT)
+    ucontext_t *volver;                 //Hilo del pool que la está corriendo
+    struct HILO *hilo;
+    int64_t ahora_us;                   //Reloj virtual
+    int64_t fin_us;                     //Fin de la ronda en curso
+    struct OUTBOX estado_outbox;        //Las globales outbox y perfilador de la instancia
+    struct PERFILADOR estado_perfilador;
+    struct OUTBOX_EVENTO cola[OUTBOX_COLA];     //Cola de Outbox_Task
+    int cola_inicio;
+    int cola_cantidad;
+    int cola_esperando;                 //Outbox_Task está dormida en xQueueReceive
+    struct NVS_SIM nvs;
+    uint16_t msg_id;
+    uint64_t aleatorio;
+    char prefijo[32];                   //Sus topics van bajo flota/<firmware>/<n>/
+    char topic_comando[TOPIC_MAX];
+
+    //Conexión
+    int fd;                             //-1 sin conexión
+    int conectada;                      //Llegó el CONNACK
+    int intentos;                       //Intentos fallidos desde la última conexión
+    int64_t intento_ns;                 //Inicio del intento en curso o momento del próximo
+    int64_t espera_ns;                  //Espera antes del próximo intento
+    int64_t ultimo_envio_ns;
+    struct MQTT_LECTOR lector;
+    struct EVENTO_SIM bandeja[BANDEJA];
+    int eventos;
+    struct PUBLICACION_SIM sin_puback[SIN_PUBACK_MAX];     //En orden de publicación
+    int cantidad_sin_puback;
+
+    //Comando propio en vuelo
+    int64_t proximo_comando_us;
+    uint32_t id_comando;
+    int en_vuelo;
+    int64_t enviado_us;
+    int64_t enviado_ns;
+    int tomado;                         //El handler lo dejó pendiente en el firmware
+    int estado_tomado;                  //Estado de la máquina cuando lo tomó
+};
+
+//Hilo del pool con su deque de tareas (índices de bloques de instancias)
+struct HILO
+{
+    pthread_t id;
+    int indice;
+    pthread_mutex_t lock;
+    uint32_t *tareas;
+    uint32_t inicio;                    //Los ladrones toman desde aquí
+    uint32_t fin;                       //El dueño toma desde aquí
+    uint64_t aleatorio;
+
+    //Estadísticas de la corrida
+    uint64_t pasos;                     //Vueltas de las tareas de los firmwares (una por vTaskDelay)
+    uint64_t enviados;
+    uint64_t recibidos;
+    uint64_t robos;
+    uint64_t comandos;
+    uint64_t descartados;
+    uint64_t perdidos;
+    uint64_t desconexiones;
+    uint64_t reconexiones;
+    uint64_t fallidas;
+    uint64_t qos1;                      //Publicaciones QoS 1 aceptadas por el cliente
+    uint64_t confirmadas;               //PUBACK recibidos
+    uint64_t vencidas;                  //Borradas sin PUBACK (MQTT_EVENT_DELETED)
+    int64_t lock_ns;                    //Tiempo con lock_firmware tomado
+    uint32_t *latencias;                //Histograma en bins de LATENCIA_BIN_US
+};
+
+struct SIMULADOR
+{
+    const char *host;
+    int puerto;
+    uint32_t portones;
+    uint32_t leds;
+    uint32_t total;
+    double segundos;
+    double velocidad;
+    double comando_s;
+    double falla;
+    uint32_t ronda_ms;
+    struct OUTBOX_CONFIG outbox[FIRMWARES];
+
+    struct INSTANCIA *instancias;
+    uint32_t tareas;
+    struct HILO hilos[HILOS_MAX];
+    int cantidad_hilos;
+    pthread_barrier_t inicio_ronda;
+    pthread_barrier_t fin_ronda;
+    atomic_int pendientes;
+    int terminar;
+    int64_t t_ronda_us;                 //Inicio de la ronda en tiempo virtual
+}sim = {
+    .host = "localhost", .puerto = 1883, .portones = 1000, .leds = 500, .segundos = 120,
+    .velocidad = 0, .comando_s = 30, .falla = 0.01, .ronda_ms = 100,
+};
+
+//Las globales de los firmwares son una sola copia: solo una instancia a la vez las tiene restauradas
+static pthread_mutex_t lock_firmware = PTHREAD_MUTEX_INITIALIZER;
+static struct INSTANCIA *instancia_actual;
+static int colas_creadas;
+
+
+static int64_t Ahora_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t Aleatorio(uint64_t *estado)
+{
+    *estado ^= *estado >> 12;
+    *estado ^= *estado << 25;
+    *estado ^= *estado >> 27;
+    return *estado * 0x2545F4914F6CDD1DULL;
+}
+
+double Simulador_Uniforme(uint64_t *estado)
+{
+    return (Aleatorio(estado) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void Programar_Comando(struct INSTANCIA *inst, int64_t ahora_us)
+{
+    inst->proximo_comando_us = ahora_us + (int64_t)(-log(1.0 - Simulador_Uniforme(&inst->aleatorio)) * sim.comando_s * 1e6);
+}
+
+
+//*************************** Conexión de una instancia ***************************//
+
+//Agrega un evento para el handler; los mensajes dejan lugar a los de conexión
+static struct EVENTO_SIM *Bandeja_Agregar(struct INSTANCIA *inst, esp_mqtt_event_id_t id)
+{
+    if (inst->eventos == BANDEJA)
+    {
+        return NULL;
+    }
+    struct EVENTO_SIM *evento = &inst->bandeja[inst->eventos++];
+    memset(evento, 0, offsetof(struct EVENTO_SIM, topic));
+    evento->id = id;
+    evento->topic[0] = '\0';
+    evento->datos[0] = '\0';
+    return evento;
+}
+
+//Un intento fallido o una conexión caída: esp-mqtt avisa MQTT_EVENT_ERROR y MQTT_EVENT_DISCONNECTED
+static void Instancia_Cerrar(struct INSTANCIA *inst, int error)
+{
+    struct EVENTO_SIM *evento = Bandeja_Agregar(inst, MQTT_EVENT_ERROR);
+
+    if (evento != NULL)
+    {
+        evento->error = error;
+    }
+    Bandeja_Agregar(inst, MQTT_EVENT_DISCONNECTED);
+
+    if (inst->fd >= 0)
+    {
+        close(inst->fd);
+    }
+    inst->fd = -1;
+    inst->intento_ns = Ahora_ns() + inst->espera_ns;
+}
+
+static void Instancia_Caida(struct INSTANCIA *inst, int error)
+{
+    inst->hilo->desconexiones++;
+    inst->conectada = FALSE;
+    Instancia_Cerrar(inst, error);
+}
+
+static void Instancia_Fallida(struct INSTANCIA *inst, int error)
+{
+    inst->hilo->fallidas++;
+    inst->intentos++;
+    Instancia_Cerrar(inst, error);
+    inst->espera_ns = (2 * inst->espera_ns < RECONEXION_MAX_NS) ? 2 * inst->espera_ns : RECONEXION_MAX_NS;
+}
+
+static int Instancia_Enviar(struct INSTANCIA *inst, const uint8_t *buf, size_t largo)
+{
+    if (!inst->conectada)
+    {
+        return -1;
+    }
+    if (Mqtt_Enviar(inst->fd, buf, largo) < 0)
+    {
+        Instancia_Caida(inst, errno);
+        return -1;
+    }
+    inst->ultimo_envio_ns = Ahora_ns();
+    inst->hilo->enviados++;
+    return 0;
+}
+
+static int Instancia_Publicar(struct INSTANCIA *inst, const char *topic, const char *datos, size_t largo)
+{
+    uint8_t buf[PUBLICACION_MAX];
+
+    if (strlen(topic) + largo + 8 > sizeof(buf))
+    {
+        return -1;
+    }
+    return Instancia_Enviar(inst, buf, Mqtt_Armar_Publish(buf, topic, datos, largo));
+}
+
+//Al reconectar se retransmite todo lo que no tuvo PUBACK, como esp-mqtt, con el mismo msg_id
+static void Instancia_Reenviar(struct INSTANCIA *inst)
+{
+    for (int i = 0; i < inst->cantidad_sin_puback; i++)
+    {
+        struct PUBLICACION_SIM *publicacion = &inst->sin_puback[i];
+        publicacion->paquete[0] |= 0x08;
+        if (Instancia_Enviar(inst, publicacion->paquete, publicacion->largo) < 0)
+        {
+            return;
+        }
+    }
+}
+
+static void Instancia_Quitar_Publicacion(struct INSTANCIA *inst, int i)
+{
+    memmove(&inst->sin_puback[i], &inst->sin_puback[i + 1], (inst->cantidad_sin_puback - i - 1) * sizeof(struct PUBLICACION_SIM));
+    inst->cantidad_sin_puback--;
+}
+
+static void Instancia_Puback(struct INSTANCIA *inst, uint16_t msg_id)
+{
+    for (int i = 0; i < inst->cantidad_sin_puback; i++)
+    {
+        if (inst->sin_puback[i].msg_id == msg_id)
+        {
+            Instancia_Quitar_Publicacion(inst, i);
+            Bandeja_Agregar(inst, MQTT_EVENT_PUBLISHED)->msg_id = msg_id;
+            inst->hilo->confirmadas++;
+            return;
+        }
+    }
+}
+
+//Las publicaciones sin PUBACK que vencieron se borran y el firmware recibe MQTT_EVENT_DELETED
+static void Instancia_Vencer(struct INSTANCIA *inst, int64_t ahora_us)
+{
+    while ((inst->cantidad_sin_puback > 0) && (ahora_us - inst->sin_puback[0].creada_us > OUTBOX_VENCE_US))
+    {
+        struct EVENTO_SIM *evento = Bandeja_Agregar(inst, MQTT_EVENT_DELETED);
+        if (evento == NULL)
+        {
+            return;
+        }
+        evento->msg_id = inst->sin_puback[0].msg_id;
+        Instancia_Quitar_Publicacion(inst, 0);
+        inst->hilo->vencidas++;
+    }
+}
+
+static void Instancia_Client_Id(const struct INSTANCIA *inst, char *client_id, size_t largo)
+{
+    snprintf(client_id, largo, "%s-sim-%" PRIu32, inst->firmware->nombre, inst->numero);
+}
+
+//Recibe lo que haya sin esperar; sin conexión, reintenta cuando venció la espera
+static void Instancia_Red(struct INSTANCIA *inst, int64_t ahora_ns)
+{
+    struct MQTT_PAQUETE paquete;
+    char client_id[32];
+    size_t prefijo = strlen(inst->prefijo);
+
+    if (inst->fd < 0)
+    {
+        if (ahora_ns < inst->intento_ns)
+        {
+            return;
+        }
+        Bandeja_Agregar(inst, MQTT_EVENT_BEFORE_CONNECT);
+        Instancia_Client_Id(inst, client_id, sizeof(client_id));
+        inst->fd = Mqtt_Abrir(sim.host, sim.puerto, client_id, 60);
+        if (inst->fd < 0)
+        {
+            Instancia_Fallida(inst, errno);
+            return;
+        }
+        fcntl(inst->fd, F_SETFL, fcntl(inst->fd, F_GETFL) | O_NONBLOCK);
+        inst->lector.largo = 0;
+        inst->lector.consumido = 0;
+        inst->intento_ns = ahora_ns;
+    }
+
+    while (inst->eventos < BANDEJA - BANDEJA_LIBRE)
+    {
+        int r = Mqtt_Leer(inst->fd, &inst->lector, &paquete, 0);
+        if (r < 0)
+        {
+            if (inst->conectada)
+            {
+                Instancia_Caida(inst, ECONNRESET);
+            }
+            else
+            {
+                Instancia_Fallida(inst, ECONNRESET);
+            }
+            return;
+        }
+        if (r == 0)
+        {
+            break;
+        }
+
+        if (paquete.tipo == MQTT_CONNACK)
+        {
+            //La primera conexión es bloqueante (Instancia_Conectar): aquí solo llegan las reconexiones
+            if ((paquete.largo < 2) || (paquete.datos[1] != 0))
+            {
+                Instancia_Fallida(inst, ECONNREFUSED);
+                return;
+            }
+            Bandeja_Agregar(inst, MQTT_EVENT_CONNECTED)->sesion = paquete.datos[0] & 0x01;
+            inst->conectada = TRUE;
+            inst->ultimo_envio_ns = ahora_ns;
+            inst->espera_ns = RECONEXION_MIN_NS;
+            inst->intentos = 0;
+            inst->hilo->reconexiones++;
+            Instancia_Reenviar(inst);
+            if (inst->fd < 0)
+            {
+                return;
+            }
+        }
+        else if ((paquete.tipo == MQTT_PUBACK) && (paquete.largo >= 2))
+        {
+            Instancia_Puback(inst, paquete.id);
+        }
+        else if ((paquete.tipo == MQTT_SUBACK) && (paquete.largo >= 2))
+        {
+            Bandeja_Agregar(inst, MQTT_EVENT_SUBSCRIBED)->msg_id = (paquete.datos[0] << 8) | paquete.datos[1];
+        }
+        else if (paquete.tipo == MQTT_PUBLISH)
+        {
+            //Solo llegan los topics propios: se le quita el prefijo, como si el firmware fuera el único en el broker
+            inst->hilo->recibidos++;
+            if ((paquete.topic_largo <= prefijo) || (paquete.topic_largo - prefijo - 1 >= TOPIC_MAX) ||
+                (paquete.largo >= DATOS_MAX) || (memcmp(paquete.topic, inst->prefijo, prefijo) != 0))
+            {
+                continue;
+            }
+            struct EVENTO_SIM *evento = Bandeja_Agregar(inst, MQTT_EVENT_DATA);
+            evento->topic_largo = paquete.topic_largo - prefijo - 1;
+            memcpy(evento->topic, &paquete.topic[prefijo + 1], evento->topic_largo);
+            evento->topic[evento->topic_largo] = '\0';
+            evento->largo = paquete.largo;
+            memcpy(evento->datos, paquete.datos, paquete.largo);
+            evento->datos[paquete.largo] = '\0';
+        }
+    }
+
+    if (!inst->conectada && (ahora_ns - inst->intento_ns > CONNACK_NS))
+    {
+        Instancia_Fallida(inst, ETIMEDOUT);
+    }
+}
+
+
+//*************************** Plataforma de los firmwares ***************************//
+
+//Tareas del firmware más Outbox_Task, que tiene la menor prioridad
+static int Cantidad_Tareas(const struct INSTANCIA *inst)
+{
+    return inst->firmware->cantidad_tareas + 1;
+}
+
+//Elige la tarea que despierta primero; con el mismo despertar, la de mayor prioridad
+static int Siguiente_Tarea(const struct INSTANCIA *inst)
+{
+    int siguiente = 0;
+
+    for (int t = 1; t < Cantidad_Tareas(inst); t++)
+    {
+        if (inst->tareas[t].despertar_us < inst->tareas[siguiente].despertar_us)
+        {
+            siguiente = t;
+        }
+    }
+    return siguiente;
+}
+
+//El comando que tomó el handler se aplicó o se descartó cuando la máquina lo consumió
+static void Revisar_Comando(struct INSTANCIA *inst)
+{
+    const struct FIRMWARE_SIM *firmware = inst->firmware;
+
+    if (!inst->tomado || firmware->comando_pendiente())
+    {
+        return;
+    }
+    int actual = firmware->estado_actual();
+    if ((actual != inst->estado_tomado) && firmware->comando_aplicado(inst->estado_tomado, actual))
+    {
+        uint64_t bin = (inst->ahora_us - inst->enviado_us) / LATENCIA_BIN_US;
+        inst->hilo->latencias[(bin < LATENCIA_BINS) ? bin : LATENCIA_BINS - 1]++;
+        inst->hilo->comandos++;
+    }
+    else
+    {
+        inst->hilo->descartados++;
+    }
+    inst->tomado = FALSE;
+    inst->en_vuelo = FALSE;
+    Programar_Comando(inst, inst->ahora_us);
+}
+
+//Duerme la tarea en curso hasta hasta_us. Si sigue siendo la primera en despertar dentro de la
+//ronda continúa sin cambiar de pila; si no, vuelve al hilo del pool
+static BaseType_t Dormir_Hasta(int64_t hasta_us)
+{
+    struct INSTANCIA *inst = instancia_actual;
+    BaseType_t a_tiempo = pdTRUE;
+
+    if ((inst == NULL) || (inst->tarea_actual < 0))
+    {
+        return pdFALSE;
+    }
+    struct TAREA_SIM *tarea = &inst->tareas[inst->tarea_actual];
+
+    inst->hilo->pasos++;
+    Revisar_Comando(inst);
+    if (hasta_us < inst->ahora_us)
+    {
+        hasta_us = inst->ahora_us;
+        a_tiempo = pdFALSE;
+    }
+    tarea->despertar_us = hasta_us;
+    if ((hasta_us < inst->fin_us) && (Siguiente_Tarea(inst) == inst->tarea_actual))
+    {
+        inst->ahora_us = hasta_us;
+        return a_tiempo;
+    }
+    swapcontext(&tarea->contexto, inst->volver);
+    return a_tiempo;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    Dormir_Hasta(instancia_actual->ahora_us + (int64_t)ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(instancia_actual->ahora_us / 1000);
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previo, TickType_t incremento)
+{
+    *previo += incremento;
+    return Dormir_Hasta((int64_t)*previo * 1000);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (instancia_actual != NULL) ? instancia_actual->ahora_us : 0;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    return instancia_actual->firmware->gpio_leer(instancia_actual->estado, gpio, instancia_actual->ahora_us);
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t nivel)
+{
+    if (instancia_actual->firmware->gpio_escribir != NULL)
+    {
+        instancia_actual->firmware->gpio_escribir(instancia_actual->estado, gpio, nivel, instancia_actual->ahora_us);
+    }
+    return ESP_OK;
+}
+
+//Los topics del firmware van bajo el prefijo de la instancia
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    struct INSTANCIA *inst = instancia_actual;
+    char completo[TOPIC_MAX + 32];
+    uint8_t buf[TOPIC_MAX + 48];
+
+    snprintf(completo, sizeof(completo), "%s/%s", inst->prefijo, topic);
+    if (++inst->msg_id == 0)
+    {
+        inst->msg_id = 1;
+    }
+    return (Instancia_Enviar(inst, buf, Mqtt_Armar_Subscribe(buf, inst->msg_id, completo)) == 0) ? inst->msg_id : -1;
+}
+
+//QoS 1 (QoS 2 se trata igual) queda esperando el PUBACK, como en el outbox de esp-mqtt: sin conexión se
+//acepta igual y sale al reconectar. Con SIN_PUBACK_MAX publicaciones pendientes devuelve -1
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *datos, int largo,
+                            int qos, int retain)
+{
+    struct INSTANCIA *inst = instancia_actual;
+    char completo[TOPIC_MAX + 32];
+    size_t largo_datos = (largo > 0) ? (size_t)largo : strlen(datos);
+
+    snprintf(completo, sizeof(completo), "%s/%s", inst->prefijo, topic);
+    if (qos == 0)
+    {
+        return (Instancia_Publicar(inst, completo, datos, largo_datos) < 0) ? -1 : 0;
+    }
+    if ((inst->cantidad_sin_puback == SIN_PUBACK_MAX) || (strlen(completo) + largo_datos + 10 > PUBLICACION_MAX))
+    {
+        return -1;
+    }
+    if (++inst->msg_id == 0)
+    {
+        inst->msg_id = 1;
+    }
+    struct PUBLICACION_SIM *publicacion = &inst->sin_puback[inst->cantidad_sin_puback++];
+    publicacion->msg_id = inst->msg_id;
+    publicacion->creada_us = inst->ahora_us;
+    publicacion->largo = Mqtt_Armar_Publish_Qos1(publicacion->paquete, publicacion->msg_id, FALSE, completo, datos, largo_datos);
+    inst->hilo->qos1++;
+    if (inst->conectada)
+    {
+        Instancia_Enviar(inst, publicacion->paquete, publicacion->largo);
+    }
+    return publicacion->msg_id;
+}
+
+//Solo la cola del outbox tiene datos, una por instancia; las demás colas de los firmwares no reciben nada
+QueueHandle_t xQueueCreate(UBaseType_t largo, UBaseType_t tamano)
+{
+    return (QueueHandle_t)(uintptr_t)++colas_creadas;
+}
+
+//Despierta a Outbox_Task si estaba esperando en la cola
+BaseType_t xQueueSend(QueueHandle_t cola, const void *elemento, TickType_t espera)
+{
+    struct INSTANCIA *inst = instancia_actual;
+
+    if ((cola == NULL) || (cola != cola_outbox) || (inst == NULL) || (inst->cola_cantidad == OUTBOX_COLA))
+    {
+        return pdFALSE;
+    }
+    inst->cola[(inst->cola_inicio + inst->cola_cantidad++) % OUTBOX_COLA] = *(const struct OUTBOX_EVENTO *)elemento;
+    if (inst->cola_esperando)
+    {
+        inst->tareas[inst->firmware->cantidad_tareas].despertar_us = inst->ahora_us;
+    }
+    return pdTRUE;
+}
+
+//Outbox_Task duerme hasta que llega un evento o vence la espera
+BaseType_t xQueueReceive(QueueHandle_t cola, void *elemento, TickType_t espera)
+{
+    struct INSTANCIA *inst = instancia_actual;
+
+    if ((cola == NULL) || (cola != cola_outbox) || (inst == NULL) || (inst->tarea_actual < 0))
+    {
+        return pdFALSE;
+    }
+    int64_t limite_us = inst->ahora_us + (int64_t)espera * 1000;
+    while (inst->cola_cantidad == 0)
+    {
+        if (inst->ahora_us >= limite_us)
+        {
+            return pdFALSE;
+        }
+        inst->cola_esperando = TRUE;
+        Dormir_Hasta(limite_us);
+        inst->cola_esperando = FALSE;
+    }
+    *(struct OUTBOX_EVENTO *)elemento = inst->cola[inst->cola_inicio];
+    inst->cola_inicio = (inst->cola_inicio + 1) % OUTBOX_COLA;
+    inst->cola_cantidad--;
+    return pdTRUE;
+}
+
+//Partición del outbox de la instancia en curso. Outbox_Iniciar corre una vez, sin instancia: la encuentra
+//vacía y su estado inicial se copia a todas
+static int Nvs_Slot(nvs_handle_t handle, const char *clave)
+{
+    int slot;
+
+    if ((handle != NVS_OUTBOX) || (instancia_actual == NULL) || (sscanf(clave, "ev%d", &slot) != 1) ||
+        (slot < 0) || (slot >= OUTBOX_EVENTOS))
+    {
+        return -1;
+    }
+    return slot;
+}
+
+esp_err_t nvs_flash_init_partition(const char *particion)
+{
+    return (strcmp(particion, OUTBOX_PARTICION) == 0) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_flash_erase_partition(const char *particion)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open_from_partition(const char *particion, const char *espacio, nvs_open_mode_t modo, nvs_handle_t *handle)
+{
+    if (strcmp(particion, OUTBOX_PARTICION) != 0)
+    {
+        return ESP_FAIL;
+    }
+    *handle = NVS_OUTBOX;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *clave, void *datos, size_t *largo)
+{
+    int slot = Nvs_Slot(handle, clave);
+
+    if ((slot < 0) || (instancia_actual->nvs.largo[slot] == 0))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (*largo < instancia_actual->nvs.largo[slot])
+    {
+        return ESP_FAIL;
+    }
+    *largo = instancia_actual->nvs.largo[slot];
+    memcpy(datos, &instancia_actual->nvs.eventos[slot], *largo);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *clave, const void *datos, size_t largo)
+{
+    int slot = Nvs_Slot(handle, clave);
+
+    if ((slot < 0) || (largo == 0) || (largo > sizeof(struct OUTBOX_EVENTO)))
+    {
+        return ESP_FAIL;
+    }
+    memcpy(&instancia_actual->nvs.eventos[slot], datos, largo);
+    instancia_actual->nvs.largo[slot] = largo;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *clave, uint32_t *valor)
+{
+    if ((handle != NVS_OUTBOX) || (instancia_actual == NULL) || (strcmp(clave, "sec") != 0) || !instancia_actual->nvs.hay_secuencia)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *valor = instancia_actual->nvs.secuencia;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *clave, uint32_t valor)
+{
+    if ((handle != NVS_OUTBOX) || (instancia_actual == NULL) || (strcmp(clave, "sec") != 0))
+    {
+        return ESP_FAIL;
+    }
+    instancia_actual->nvs.secuencia = valor;
+    instancia_actual->nvs.hay_secuencia = TRUE;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *clave)
+{
+    int slot = Nvs_Slot(handle, clave);
+
+    if (slot < 0)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    instancia_actual->nvs.largo[slot] = 0;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+
+//*************************** Instancias ***************************//
+
+static void Tarea_Arrancar(void)
+{
+    struct INSTANCIA *inst = instancia_actual;
+
+    if (inst->tarea_actual == inst->firmware->cantidad_tareas)
+    {
+        Outbox_Task(NULL);
+    }
+    else
+    {
+        inst->firmware->tareas[inst->tarea_actual].funcion(NULL);
+    }
+}
+
+//Con el lock tomado: las globales del firmware, del outbox y del perfilador pasan a ser las de la instancia
+static void Instancia_Entrar(struct INSTANCIA *inst)
+{
+    instancia_actual = inst;
+    inst->firmware->restaurar(inst->estado);
+    configuracion_outbox = *inst->outbox;
+    outbox = inst->estado_outbox;
+    perfilador = inst->estado_perfilador;
+}
+
+static void Instancia_Salir(struct INSTANCIA *inst)
+{
+    inst->firmware->guardar(inst->estado);
+    inst->estado_outbox = outbox;
+    inst->estado_perfilador = perfilador;
+    instancia_actual = NULL;
+}
+
+//Entrega los eventos juntados al handler MQTT del firmware
+static void Instancia_Entregar(struct INSTANCIA *inst)
+{
+    const struct FIRMWARE_SIM *firmware = inst->firmware;
+    size_t largo_comando = strlen(firmware->topic_comando);
+
+    for (int i = 0; i < inst->eventos; i++)
+    {
+        struct EVENTO_SIM *evento = &inst->bandeja[i];
+        esp_mqtt_error_codes_t error = {
+            .error_type = MQTT_ERROR_TYPE_TCP_TRANSPORT,
+            .esp_transport_sock_errno = evento->error,
+        };
+        esp_mqtt_event_t event = {
+            .event_id = evento->id,
+            .client = CLIENTE_SIM,
+            .data = evento->datos,
+            .data_len = evento->largo,
+            .total_data_len = evento->largo,
+            .topic = evento->topic,
+            .topic_len = evento->topic_largo,
+            .msg_id = evento->msg_id,
+            .session_present = evento->sesion,
+            .error_handle = &error,
+        };
+
+        firmware->evento(&event);
+
+        //El comando propio quedó pendiente en el firmware: se sigue hasta que la máquina lo consuma
+        if ((evento->id == MQTT_EVENT_DATA) && inst->en_vuelo && !inst->tomado && ((size_t)evento->topic_largo == largo_comando) &&
+            (memcmp(evento->topic, firmware->topic_comando, largo_comando) == 0) && firmware->comando_pendiente())
+        {
+            inst->tomado = TRUE;
+            inst->estado_tomado = firmware->estado_actual();
+        }
+    }
+    inst->eventos = 0;
+}
+
+//Corre las tareas de la instancia hasta fin_us
+static void Instancia_Correr(struct INSTANCIA *inst, int64_t fin_us)
+{
+    ucontext_t hilo_contexto;
+
+    inst->fin_us = fin_us;
+    inst->volver = &hilo_contexto;
+    for (;;)
+    {
+        int t = Siguiente_Tarea(inst);
+        if (inst->tareas[t].despertar_us >= fin_us)
+        {
+            break;
+        }
+        inst->tarea_actual = t;
+        if (inst->tareas[t].despertar_us > inst->ahora_us)
+        {
+            inst->ahora_us = inst->tareas[t].despertar_us;
+        }
+        swapcontext(&hilo_contexto, &inst->tareas[t].contexto);
+    }
+    inst->tarea_actual = -1;
+    inst->ahora_us = fin_us;
+}
+
+//Avanza una instancia desde t_us hasta t_us + ronda_ms
+static void Instancia_Ronda(struct HILO *hilo, struct INSTANCIA *inst, int64_t t_us)
+{
+    char texto[32];
+    int64_t fin_us = t_us + (int64_t)sim.ronda_ms * 1000;
+
+    inst->hilo = hilo;
+    Instancia_Red(inst, Ahora_ns());
+    Instancia_Vencer(inst, t_us);
+
+    pthread_mutex_lock(&lock_firmware);
+    int64_t lock_ns = Ahora_ns();
+    Instancia_Entrar(inst);
+    Instancia_Entregar(inst);
+    Instancia_Correr(inst, fin_us);
+    Instancia_Entregar(inst);
+    Instancia_Salir(inst);
+    hilo->lock_ns += Ahora_ns() - lock_ns;
+    pthread_mutex_unlock(&lock_firmware);
+
+    //Comando de la aplicación
+    if (inst->en_vuelo && !inst->tomado && (fin_us - inst->enviado_us > COMANDO_PERDIDO_US) &&
+        (Ahora_ns() - inst->enviado_ns > COMANDO_PERDIDO_NS))
+    {
+        hilo->perdidos++;
+        inst->en_vuelo = FALSE;
+        Programar_Comando(inst, fin_us);
+    }
+    if (!inst->en_vuelo && inst->conectada && (fin_us >= inst->proximo_comando_us))
+    {
+        if (inst->firmware->comando_con_id)
+        {
+            snprintf(texto, sizeof(texto), "1:%" PRIu32, ++inst->id_comando);
+        }
+        else
+        {
+            snprintf(texto, sizeof(texto), "1");
+        }
+        if (Instancia_Publicar(inst, inst->topic_comando, texto, strlen(texto)) == 0)
+        {
+            inst->en_vuelo = TRUE;
+            inst->enviado_us = fin_us;
+            inst->enviado_ns = Ahora_ns();
+        }
+    }
+
+    if (inst->conectada && (Ahora_ns() - inst->ultimo_envio_ns > PING_NS))
+    {
+        uint8_t ping[2];
+        Instancia_Enviar(inst, ping, Mqtt_Armar_Pingreq(ping));
+    }
+}
+
+//Primera conexión, bloqueante; si falla queda para los reintentos de las rondas
+static int Instancia_Conectar(struct INSTANCIA *inst)
+{
+    char client_id[32];
+
+    Bandeja_Agregar(inst, MQTT_EVENT_BEFORE_CONNECT);
+    Instancia_Client_Id(inst, client_id, sizeof(client_id));
+    inst->fd = Mqtt_Conectar(sim.host, sim.puerto, client_id, &inst->lector);
+    if (inst->fd < 0)
+    {
+        inst->intentos = 1;
+        inst->intento_ns = Ahora_ns() + inst->espera_ns;
+        return 0;
+    }
+    fcntl(inst->fd, F_SETFL, fcntl(inst->fd, F_GETFL) | O_NONBLOCK);
+    Bandeja_Agregar(inst, MQTT_EVENT_CONNECTED);
+    inst->conectada = TRUE;
+    inst->ultimo_envio_ns = Ahora_ns();
+    return 1;
+}
+
+static void Instancia_Iniciar(struct INSTANCIA *inst, int firmware, uint32_t numero)
+{
+    memset(inst, 0, sizeof(*inst));
+    inst->firmware = (firmware == 0) ? &FIRMWARE_PORTON : &FIRMWARE_LED;
+    inst->outbox = &sim.outbox[firmware];
+    inst->numero = numero;
+    inst->fd = -1;
+    inst->tarea_actual = -1;
+    inst->espera_ns = RECONEXION_MIN_NS;
+    inst->aleatorio = 0x9E3779B97F4A7C15ULL * (2 * numero + firmware + 1);
+    snprintf(inst->prefijo, sizeof(inst->prefijo), "flota/%s/%" PRIu32, inst->firmware->nombre, numero);
+    snprintf(inst->topic_comando, sizeof(inst->topic_comando), "%s/%s", inst->prefijo, inst->firmware->topic_comando);
+
+    inst->estado = malloc(inst->firmware->estado_largo);
+    inst->estado_outbox = outbox;
+    inst->estado_perfilador = perfilador;
+    inst->firmware->iniciar(inst->estado, Aleatorio(&inst->aleatorio), sim.falla);
+    for (int t = 0; t < Cantidad_Tareas(inst); t++)
+    {
+        struct TAREA_SIM *tarea = &inst->tareas[t];
+        uint32_t dispersion_ms = (t < inst->firmware->cantidad_tareas) ? inst->firmware->tareas[t].dispersion_ms : 0;
+
+        tarea->pila = malloc(PILA_TAREA);
+        getcontext(&tarea->contexto);
+        tarea->contexto.uc_stack.ss_sp = tarea->pila;
+        tarea->contexto.uc_stack.ss_size = PILA_TAREA;
+        tarea->contexto.uc_link = NULL;
+        makecontext(&tarea->contexto, Tarea_Arrancar, 0);
+        tarea->despertar_us = dispersion_ms ? (int64_t)(Aleatorio(&inst->aleatorio) % dispersion_ms) * 1000 : 0;
+    }
+    Programar_Comando(inst, 0);
+}
+
+
+//*************************** Pool con robo de trabajo ***************************//
+
+static int Tomar_Propia(struct HILO *hilo, uint32_t *tarea)
+{
+    int hay = FALSE;
+
+    pthread_mutex_lock(&hilo->lock);
+    if (hilo->fin > hilo->inicio)
+    {
+        *tarea = hilo->tareas[--hilo->fin];
+        hay = TRUE;
+    }
+    pthread_mutex_unlock(&hilo->lock);
+    return hay;
+}
+
+//inicio y fin de la víctima solo se leen con su lock tomado
+static int Robar(struct HILO *hilo, uint32_t *tarea)
+{
+    int primero = Aleatorio(&hilo->aleatorio) % sim.cantidad_hilos;
+
+    for (int i = 0; i < sim.cantidad_hilos; i++)
+    {
+        struct HILO *victima = &sim.hilos[(primero + i) % sim.cantidad_hilos];
+        if (victima == hilo)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&victima->lock);
+        int hay = (victima->fin > victima->inicio);
+        if (hay)
+        {
+            *tarea = victima->tareas[victima->inicio++];
+        }
+        pthread_mutex_unlock(&victima->lock);
+        if (hay)
+        {
+            hilo->robos++;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void *Hilo_Pool(void *arg)
+{
+    struct HILO *hilo = arg;
+    uint32_t tarea;
+
+    for (;;)
+    {
+        pthread_barrier_wait(&sim.inicio_ronda);
+        if (sim.terminar)
+        {
+            return NULL;
+        }
+
+        while (atomic_load_explicit(&sim.pendientes, memory_order_acquire) > 0)
+        {
+            if (!Tomar_Propia(hilo, &tarea) && !Robar(hilo, &tarea))
+            {
+                sched_yield();
+                continue;
+            }
+            uint32_t primera = tarea * INSTANCIAS_POR_TAREA;
+            uint32_t ultima = (primera + INSTANCIAS_POR_TAREA < sim.total) ? primera + INSTANCIAS_POR_TAREA : sim.total;
+            for (uint32_t i = primera; i < ultima; i++)
+            {
+                Instancia_Ronda(hilo, &sim.instancias[i], sim.t_ronda_us);
+            }
+            atomic_fetch_sub_explicit(&sim.pendientes, 1, memory_order_release);
+        }
+        pthread_barrier_wait(&sim.fin_ronda);
+    }
+}
+
+
+//*************************** Corridas ***************************//
+
+struct RESULTADO
+{
+    double segundos;
+    double cpu_s;
+    uint64_t pasos;
+    uint64_t mensajes;
+    uint64_t robos;
+    uint64_t comandos;
+    uint64_t descartados;
+    uint64_t perdidos;
+    uint64_t desconexiones;
+    uint64_t reconexiones;
+    uint64_t fallidas;
+    uint64_t qos1;
+    uint64_t confirmadas;
+    uint64_t vencidas;
+    double lock_pct;                    //Parte de la corrida con lock_firmware tomado
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double p999_ms;
+};
+
+static double Percentil(const uint64_t *histograma, uint64_t total, double fraccion)
+{
+    uint64_t objetivo = (uint64_t)ceil(total * fraccion);
+    uint64_t acumulado = 0;
+
+    for (uint32_t i = 0; i < LATENCIA_BINS; i++)
+    {
+        acumulado += histograma[i];
+        if ((acumulado >= objetivo) && (acumulado > 0))
+        {
+            return (i + 1) * LATENCIA_BIN_US / 1000.0;
+        }
+    }
+    return 0;
+}
+
+static double Cpu_Proceso(void)
+{
+    struct rusage uso;
+    getrusage(RUSAGE_SELF, &uso);
+    return uso.ru_utime.tv_sec + uso.ru_stime.tv_sec + (uso.ru_utime.tv_usec + uso.ru_stime.tv_usec) / 1e6;
+}
+
+static void Correr(int cantidad_hilos, struct RESULTADO *resultado)
+{
+    static uint64_t histograma[LATENCIA_BINS];
+    uint32_t rondas = (uint32_t)(sim.segundos * 1000 / sim.ronda_ms);
+
+    sim.cantidad_hilos = cantidad_hilos;
+    sim.terminar = FALSE;
+    pthread_barrier_init(&sim.inicio_ronda, NULL, cantidad_hilos + 1);
+    pthread_barrier_init(&sim.fin_ronda, NULL, cantidad_hilos + 1);
+    for (int h = 0; h < cantidad_hilos; h++)
+    {
+        struct HILO *hilo = &sim.hilos[h];
+        uint32_t *tareas = hilo->tareas;
+        uint32_t *latencias = hilo->latencias;
+        memset(hilo, 0, sizeof(*hilo));
+        hilo->indice = h;
+        hilo->tareas = tareas ? tareas : malloc(sim.tareas * sizeof(uint32_t));
+        hilo->latencias = latencias ? latencias : malloc(LATENCIA_BINS * sizeof(uint32_t));
+        memset(hilo->latencias, 0, LATENCIA_BINS * sizeof(uint32_t));
+        hilo->aleatorio = 0x853C49E6748FEA9BULL + h;
+        pthread_mutex_init(&hilo->lock, NULL);
+        pthread_create(&hilo->id, NULL, Hilo_Pool, hilo);
+    }
+
+    //Los comandos en vuelo de la corrida anterior no se miden
+    for (uint32_t i = 0; i < sim.total; i++)
+    {
+        sim.instancias[i].en_vuelo = FALSE;
+        sim.instancias[i].tomado = FALSE;
+        Programar_Comando(&sim.instancias[i], sim.t_ronda_us);
+    }
+
+    double cpu_inicio = Cpu_Proceso();
+    int64_t inicio_ns = Ahora_ns();
+    for (uint32_t r = 0; r < rondas; r++)
+    {
+        //Cada bloque de instancias vuelve al mismo hilo (sus datos siguen en su caché); el robo reparte lo que sobre
+        for (int h = 0; h < cantidad_hilos; h++)
+        {
+            sim.hilos[h].inicio = 0;
+            sim.hilos[h].fin = 0;
+        }
+        for (uint32_t t = 0; t < sim.tareas; t++)
+        {
+            struct HILO *hilo = &sim.hilos[t % cantidad_hilos];
+            hilo->tareas[hilo->fin++] = t;
+        }
+        atomic_store_explicit(&sim.pendientes, sim.tareas, memory_order_release);
+
+        pthread_barrier_wait(&sim.inicio_ronda);
+        pthread_barrier_wait(&sim.fin_ronda);
+        sim.t_ronda_us += (int64_t)sim.ronda_ms * 1000;
+
+        //Con velocidad fija se espera a que el reloj real alcance al virtual
+        if (sim.velocidad > 0)
+        {
+            int64_t objetivo_ns = inicio_ns + (int64_t)((r + 1) * sim.ronda_ms * 1e6 / sim.velocidad);
+            int64_t falta_ns = objetivo_ns - Ahora_ns();
+            if (falta_ns > 0)
+            {
+                struct timespec espera = { falta_ns / 1000000000, falta_ns % 1000000000 };
+                nanosleep(&espera, NULL);
+            }
+        }
+    }
+    memset(resultado, 0, sizeof(*resultado));
+    resultado->segundos = (Ahora_ns() - inicio_ns) / 1e9;
+    resultado->cpu_s = Cpu_Proceso() - cpu_inicio;
+
+    sim.terminar = TRUE;
+    pthread_barrier_wait(&sim.inicio_ronda);
+
+    memset(histograma, 0, sizeof(histograma));
+    for (int h = 0; h < cantidad_hilos; h++)
+    {
+        struct HILO *hilo = &sim.hilos[h];
+        pthread_join(hilo->id, NULL);
+        pthread_mutex_destroy(&hilo->lock);
+        resultado->pasos += hilo->pasos;
+        resultado->mensajes += hilo->enviados + hilo->recibidos;
+        resultado->robos += hilo->robos;
+        resultado->comandos += hilo->comandos;
+        resultado->descartados += hilo->descartados;
+        resultado->perdidos += hilo->perdidos;
+        resultado->desconexiones += hilo->desconexiones;
+        resultado->reconexiones += hilo->reconexiones;
+        resultado->fallidas += hilo->fallidas;
+        resultado->qos1 += hilo->qos1;
+        resultado->confirmadas += hilo->confirmadas;
+        resultado->vencidas += hilo->vencidas;
+        resultado->lock_pct += hilo->lock_ns / 1e9;
+        for (uint32_t i = 0; i < LATENCIA_BINS; i++)
+        {
+            histograma[i] += hilo->latencias[i];
+        }
+    }
+    pthread_barrier_destroy(&sim.inicio_ronda);
+    pthread_barrier_destroy(&sim.fin_ronda);
+
+    resultado->lock_pct = 100 * resultado->lock_pct / resultado->segundos;
+    resultado->p50_ms = Percentil(histograma, resultado->comandos, 0.50);
+    resultado->p90_ms = Percentil(histograma, resultado->comandos, 0.90);
+    resultado->p99_ms = Percentil(histograma, resultado->comandos, 0.99);
+    resultado->p999_ms = Percentil(histograma, resultado->comandos, 0.999);
+}
+
+
+static int Leer_Hilos(const char *texto, int *lista)
+{
+    int cantidad = 0;
+    const char *p = texto;
+
+    while ((*p != '\0') && (cantidad < 16))
+    {
+        int n = atoi(p);
+        if ((n < 1) || (n > HILOS_MAX))
+        {
+            return 0;
+        }
+        lista[cantidad++] = n;
+        p = strchr(p, ',');
+        if (p == NULL)
+        {
+            break;
+        }
+        p++;
+    }
+    return cantidad;
+}
+
+
+int main(int argc, char **argv)
+{
+    int lista_hilos[16];
+    int corridas = 0;
+    int detallado = FALSE;
+    char host[128];
+    int opcion;
+
+    while ((opcion = getopt(argc, argv, "b:n:l:t:j:x:c:f:r:v")) != -1)
+    {
+        switch (opcion)
+        {
+        case 'b':
+            snprintf(host, sizeof(host), "%s", optarg);
+            if (strchr(host, ':') != NULL)
+            {
+                sim.puerto = atoi(strchr(host, ':') + 1);
+                *strchr(host, ':') = '\0';
+            }
+            sim.host = host;
+            break;
+        case 'n': sim.portones = strtoul(optarg, NULL, 10); break;
+        case 'l': sim.leds = strtoul(optarg, NULL, 10); break;
+        case 't': sim.segundos = atof(optarg); break;
+        case 'j': corridas = Leer_Hilos(optarg, lista_hilos); break;
+        case 'x': sim.velocidad = atof(optarg); break;
+        case 'c': sim.comando_s = atof(optarg); break;
+        case 'f': sim.falla = atof(optarg); break;
+        case 'r': sim.ronda_ms = strtoul(optarg, NULL, 10); break;
+        case 'v': detallado = TRUE; break;
+        default:
+            fprintf(stderr, "uso: %s [-b broker[:puerto]] [-n portones] [-l leds] [-t segundos virtuales] [-j 1,2,4,8]\n"
+                            "       [-x velocidad] [-c segundos entre comandos] [-f probabilidad de falla] [-r ms por ronda] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (corridas == 0)
+    {
+        //Por defecto: 1, 2, 4... hasta la cantidad de núcleos
+        long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int n = 1; (n <= nucleos) && (n <= HILOS_MAX) && (corridas < 16); n *= 2)
+        {
+            lista_hilos[corridas++] = n;
+        }
+        if ((lista_hilos[corridas - 1] != nucleos) && (nucleos <= HILOS_MAX) && (corridas < 16))
+        {
+            lista_hilos[corridas++] = nucleos;
+        }
+    }
+    sim.total = sim.portones + sim.leds;
+    if ((sim.total == 0) || (sim.ronda_ms == 0) || (sim.comando_s <= 0))
+    {
+        fprintf(stderr, "Parámetros inválidos\n");
+        return 2;
+    }
+    sim.tareas = (sim.total + INSTANCIAS_POR_TAREA - 1) / INSTANCIAS_POR_TAREA;
+
+    //Una conexión por instancia
+    struct rlimit limite;
+    getrlimit(RLIMIT_NOFILE, &limite);
+    if (limite.rlim_cur < sim.total + 64)
+    {
+        limite.rlim_cur = (limite.rlim_max < sim.total + 64) ? limite.rlim_max : sim.total + 64;
+        setrlimit(RLIMIT_NOFILE, &limite);
+        if (limite.rlim_cur < sim.total + 64)
+        {
+            fprintf(stderr, "Aviso: el límite de archivos abiertos (%lu) no alcanza para %" PRIu32 " conexiones\n",
+                    (unsigned long)limite.rlim_cur, sim.total);
+        }
+    }
+
+    //Sin -v se ocultan los mensajes de los firmwares; el reporte sale por la salida original
+    fflush(stdout);
+    FILE *reporte = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(reporte, NULL, _IOLBF, 0);
+    if (!detallado)
+    {
+        int nulo = open("/dev/null", O_WRONLY);
+        dup2(nulo, STDOUT_FILENO);
+        close(nulo);
+    }
+
+    //El outbox arranca vacío en todas las instancias; cada una lo usa con la configuración de su firmware
+    FIRMWARE_PORTON.outbox(&sim.outbox[0]);
+    FIRMWARE_LED.outbox(&sim.outbox[1]);
+    Outbox_Iniciar(&sim.outbox[0]);
+    Outbox_Cliente(CLIENTE_SIM);
+    FIRMWARE_PORTON.cliente(CLIENTE_SIM);
+    FIRMWARE_LED.cliente(CLIENTE_SIM);
+
+    sim.instancias = malloc(sim.total * sizeof(struct INSTANCIA));
+    uint32_t conectadas = 0;
+    int64_t inicio_ns = Ahora_ns();
+    for (uint32_t i = 0; i < sim.total; i++)
+    {
+        struct INSTANCIA *inst = &sim.instancias[i];
+        if (i < sim.portones)
+        {
+            Instancia_Iniciar(inst, 0, i);
+        }
+        else
+        {
+            Instancia_Iniciar(inst, 1, i - sim.portones);
+        }
+        conectadas += Instancia_Conectar(inst);
+    }
+    fprintf(reporte, "Flota: %" PRIu32 " portones + %" PRIu32 " controladores LED, %" PRIu32 " conectados a %s:%d en %.2f s\n",
+            sim.portones, sim.leds, conectadas, sim.host, sim.puerto, (Ahora_ns() - inicio_ns) / 1e9);
+    if (conectadas == 0)
+    {
+        return 1;
+    }
+    fprintf(reporte, "%.0f s virtuales por corrida, rondas de %" PRIu32 " ms, %s, un comando cada %.0f s por instancia, falla %.1f%%\n\n",
+            sim.segundos, sim.ronda_ms, (sim.velocidad > 0) ? "velocidad fija" : "lo más rápido posible", sim.comando_s, sim.falla * 100);
+
+    fprintf(reporte, "Los firmwares corren de a una instancia por vez (lock_firmware): los hilos solo reparten la red\n\n");
+    fprintf(reporte, "hilos  tiempo(s)  x virtual  pasos/s    msgs/s    CPU(%%)  lock(%%)  robos   comandos  p50(ms)  p90(ms)  p99(ms)  p99.9(ms)\n");
+    for (int c = 0; c < corridas; c++)
+    {
+        struct RESULTADO resultado;
+        Correr(lista_hilos[c], &resultado);
+        fprintf(reporte, "%5d  %9.2f  %9.1f  %9.0f  %8.0f  %6.0f  %7.0f  %6" PRIu64 "  %8" PRIu64 "  %7.2f  %7.2f  %7.2f  %9.2f\n",
+                lista_hilos[c], resultado.segundos, sim.segundos / resultado.segundos, resultado.pasos / resultado.segundos,
+                resultado.mensajes / resultado.segundos, 100 * resultado.cpu_s / resultado.segundos, resultado.lock_pct,
+                resultado.robos, resultado.comandos, resultado.p50_ms, resultado.p90_ms, resultado.p99_ms, resultado.p999_ms);
+        if (resultado.descartados || resultado.perdidos)
+        {
+            fprintf(reporte, "       comandos descartados por la máquina de estado: %" PRIu64 ", perdidos: %" PRIu64 "\n",
+                    resultado.descartados, resultado.perdidos);
+        }
+        if (resultado.qos1)
+        {
+            fprintf(reporte, "       publicaciones QoS 1: %" PRIu64 ", confirmadas con PUBACK: %" PRIu64 ", borradas sin PUBACK: %" PRIu64 "\n",
+                    resultado.qos1, resultado.confirmadas, resultado.vencidas);
+        }
+        if (resultado.desconexiones || resultado.fallidas)
+        {
+            fprintf(reporte, "       desconexiones: %" PRIu64 ", reconexiones: %" PRIu64 ", intentos fallidos: %" PRIu64 "\n",
+                    resultado.desconexiones, resultado.reconexiones, resultado.fallidas);
+        }
+    }
+
+    //Estado final de la flota, para revisar que las máquinas de estado avanzaron y que nadie quedó afuera
+    const struct FIRMWARE_SIM *firmwares[FIRMWARES] = { &FIRMWARE_PORTON, &FIRMWARE_LED };
+    uint32_t sin_conexion = 0;
+    fprintf(reporte, "\n");
+    for (int f = 0; f < FIRMWARES; f++)
+    {
+        uint32_t por_estado[16] = { 0 };
+        int estados = (firmwares[f]->estados < 16) ? firmwares[f]->estados : 16;
+
+        for (uint32_t i = 0; i < sim.total; i++)
+        {
+            struct INSTANCIA *inst = &sim.instancias[i];
+            if (inst->firmware != firmwares[f])
+            {
+                continue;
+            }
+            Instancia_Entrar(inst);
+            int estado = inst->firmware->estado_actual();
+            Instancia_Salir(inst);
+            if ((estado >= 0) && (estado < estados))
+            {
+                por_estado[estado]++;
+            }
+            sin_conexion += !inst->conectada;
+        }
+        fprintf(reporte, "Estado final %s:", firmwares[f]->nombre);
+        for (int e = 0; e < estados; e++)
+        {
+            fprintf(reporte, " %s=%" PRIu32, firmwares[f]->nombres[e], por_estado[e]);
+        }
+        fprintf(reporte, "\n");
+    }
+    if (sin_conexion > 0)
+    {
+        fprintf(reporte, "Sin conexión al terminar: %" PRIu32 " instancias (no aportan comandos mientras tanto)\n", sin_conexion);
+    }
+    fclose(reporte);
+    return (sin_conexion < sim.total) ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+/***********************************************************/
+/*  Firmwares del simulador de flota                       */
+/*                                                         */
+/*  simulador_porton.c y simulador_led.c compilan cada     */
+/*  firmware con PORTON_HOST, igual que replay_porton.c,   */
+/*  y le dan a simulador_flota.c lo que necesita para      */
+/*  correr muchas instancias del mismo código: las tareas, */
+/*  el handler MQTT, las globales de una instancia y el    */
+/*  modelo de sus GPIO.                                    */
+/*                                                         */
+/*  Las globales de un firmware son una sola copia: el     */
+/*  simulador restaura las de una instancia, la corre y    */
+/*  las vuelve a guardar, siempre con el lock de los       */
+/*  firmwares tomado.                                      */
+/***********************************************************/
+
+#ifndef SIMULADOR_FLOTA_H
+#define SIMULADOR_FLOTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "porton_host.h"
+#include "../outbox.h"
+
+#define FIRMWARE_TAREAS_MAX 2
+
+
+//Tarea del firmware que corre en cada instancia
+struct FIRMWARE_TAREA
+{
+    TaskFunction_t funcion;
+    uint32_t dispersion_ms;         //Arranca al azar dentro de este intervalo, así las tareas periódicas de la flota no van juntas
+};
+
+struct FIRMWARE_SIM
+{
+    const char *nombre;             //Los topics de la instancia van bajo flota/<nombre>/<n>/
+    size_t estado_largo;            //Globales guardadas y modelo físico de una instancia
+    struct FIRMWARE_TAREA tareas[FIRMWARE_TAREAS_MAX];     //En orden de prioridad: con el mismo despertar corre primero la anterior
+    int cantidad_tareas;
+    const char *topic_comando;      //Topic del firmware donde la aplicación manda el pulso
+    int comando_con_id;             //TRUE: "1:<id>", FALSE: "1"
+    const char *const *nombres;     //Nombre de cada estado, para el resumen final
+    int estados;
+
+    //La misma configuración que app_main le pasa a Outbox_Iniciar
+    void (*outbox)(struct OUTBOX_CONFIG *config);
+
+    //El cliente que el firmware guarda en cliente_mqtt al arrancar MQTT, para lo que publica sin el outbox
+    void (*cliente)(esp_mqtt_client_handle_t cliente);
+
+    //Estado de encendido de las globales y del modelo físico
+    void (*iniciar)(void *estado, uint64_t semilla, double falla);
+    void (*restaurar)(const void *estado);
+    void (*guardar)(void *estado);
+
+    //Evento del cliente MQTT al handler del firmware
+    void (*evento)(esp_mqtt_event_handle_t event);
+
+    //Entradas y salidas físicas de la instancia en el instante ahora_us; gpio_escribir puede ser NULL
+    int (*gpio_leer)(void *estado, gpio_num_t gpio, int64_t ahora_us);
+    void (*gpio_escribir)(void *estado, gpio_num_t gpio, uint32_t nivel, int64_t ahora_us);
+
+    //Con las globales de la instancia restauradas
+    int (*estado_actual)(void);
+    int (*comando_pendiente)(void); //El pulso llegó y la máquina todavía no lo tomó
+    int (*comando_aplicado)(int previo, int actual);   //Tomarlo llevando de previo a actual lo ejecuta (si no, lo descartó)
+};
+
+extern const struct FIRMWARE_SIM FIRMWARE_PORTON;
+extern const struct FIRMWARE_SIM FIRMWARE_LED;
+
+
+//Número uniforme en [0, 1) del generador de una instancia (simulador_flota.c)
+double Simulador_Uniforme(uint64_t *estado);
+
+#endif /* SIMULADOR_FLOTA_H */
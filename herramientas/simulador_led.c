@@ -0,0 +1,134 @@
+/***********************************************************/
+/*  El control del LED dentro del simulador de flota       */
+/*  (ver simulador_flota.h)                                */
+/*                                                         */
+/*  Se compila "MQTT proyecto final.c" tal cual, con       */
+/*  PORTON_HOST. Nadie aprieta el botón físico: el estado  */
+/*  solo avanza con los pulsos que llegan por MQTT.        */
+/***********************************************************/
+
+#define PORTON_HOST
+#define app_main Led_App_Main               //app_main lo reemplaza el simulador
+#include "../MQTT proyecto final.c"
+
+#include "simulador_flota.h"
+
+
+//Globales del firmware de una instancia
+struct LED_SIM
+{
+    uint8_t estado_actual;
+    uint8_t spp_button_pressed;
+    uint8_t spp_button_mqtt;
+    int64_t conexion_inicio_us;
+    uint32_t conexiones;
+    int64_t conexion_primera_us;
+    int64_t reconexion_suma_us;
+    jitter_monitor_t jitter_control;
+    jitter_monitor_t jitter_led;
+};
+
+
+static void Led_Iniciar(void *estado, uint64_t semilla, double falla)
+{
+    struct LED_SIM *l = estado;
+
+    memset(l, 0, sizeof(*l));
+    l->estado_actual = ESTADO_0;
+    l->jitter_control.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    l->jitter_led.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+}
+
+static void Led_Restaurar(const void *estado)
+{
+    const struct LED_SIM *l = estado;
+
+    estado_actual = l->estado_actual;
+    spp_button_pressed = l->spp_button_pressed;
+    spp_button_mqtt = l->spp_button_mqtt;
+    conexion_inicio_us = l->conexion_inicio_us;
+    conexiones = l->conexiones;
+    conexion_primera_us = l->conexion_primera_us;
+    reconexion_suma_us = l->reconexion_suma_us;
+    jitter_control = l->jitter_control;
+    jitter_led = l->jitter_led;
+}
+
+static void Led_Guardar(void *estado)
+{
+    struct LED_SIM *l = estado;
+
+    l->estado_actual = estado_actual;
+    l->spp_button_pressed = spp_button_pressed;
+    l->spp_button_mqtt = spp_button_mqtt;
+    l->conexion_inicio_us = conexion_inicio_us;
+    l->conexiones = conexiones;
+    l->conexion_primera_us = conexion_primera_us;
+    l->reconexion_suma_us = reconexion_suma_us;
+    l->jitter_control = jitter_control;
+    l->jitter_led = jitter_led;
+}
+
+static void Led_Evento(esp_mqtt_event_handle_t event)
+{
+    mqtt_event_handler(NULL, "MQTT_EVENTS", event->event_id, event);
+}
+
+static void Led_Outbox(struct OUTBOX_CONFIG *config)
+{
+    config->tag = TAG;
+    config->topic_eventos = TOPIC_EVENTOS;
+    config->topic_telemetria = TOPIC_EVENTOS;
+    config->contar = NULL;
+}
+
+static void Led_Cliente(esp_mqtt_client_handle_t cliente)
+{
+    cliente_mqtt = cliente;
+}
+
+//El botón físico nunca está apretado
+static int Led_Gpio_Leer(void *estado, gpio_num_t gpio, int64_t ahora_us)
+{
+    return (gpio == SPP_BUTTON) ? !LOGICA : 0;
+}
+
+
+static int Led_Estado(void)
+{
+    return estado_actual;
+}
+
+static int Led_Pendiente(void)
+{
+    return spp_button_mqtt;
+}
+
+//Cada pulso tomado avanza el estado
+static int Led_Aplicado(int previo, int actual)
+{
+    return 1;
+}
+
+
+const struct FIRMWARE_SIM FIRMWARE_LED = {
+    .nombre = "spp",
+    .estado_largo = sizeof(struct LED_SIM),
+    .tareas = { { maquina_estado_task, 0 }, { led_control_task, 0 } },
+    .cantidad_tareas = 2,
+    .topic_comando = "/2022-1143/SPP",
+    .comando_con_id = 0,
+    .nombres = NOMBRE_ESTADO,
+    .estados = sizeof(NOMBRE_ESTADO) / sizeof(NOMBRE_ESTADO[0]),
+    .outbox = Led_Outbox,
+    .cliente = Led_Cliente,
+    .iniciar = Led_Iniciar,
+    .restaurar = Led_Restaurar,
+    .guardar = Led_Guardar,
+    .evento = Led_Evento,
+    .gpio_leer = Led_Gpio_Leer,
+    .gpio_escribir = NULL,
+    .estado_actual = Led_Estado,
+    .comando_pendiente = Led_Pendiente,
+    .comando_aplicado = Led_Aplicado,
+};
@@ -0,0 +1,223 @@
+/***********************************************************/
+/*  El firmware del porton dentro del simulador de flota   */
+/*  (ver simulador_flota.h)                                */
+/*                                                         */
+/*  Se compila "Maquina de etado mircro.c" tal cual, con   */
+/*  PORTON_HOST. Cada instancia guarda las globales de la  */
+/*  máquina de estado y el porton físico que mueven sus    */
+/*  salidas: los limit switch se activan al llegar al      */
+/*  final del recorrido, salvo cuando el del destino falla */
+/*  (con la probabilidad -f cada vez que arranca el motor).*/
+/*                                                         */
+/*  La traza de eventos también es por instancia: es la    */
+/*  parte más grande de lo que se guarda (TRAZA_EVENTOS    */
+/*  eventos de 8 bytes).                                   */
+/***********************************************************/
+
+#define PORTON_HOST
+#define app_main Porton_App_Main            //app_main lo reemplaza el simulador
+#include "../Maquina de etado mircro.c"
+
+#include "simulador_flota.h"
+
+#define RECORRIDO_MIN_MS 8000               //Tiempo de recorrido del porton simulado
+#define RECORRIDO_MAX_MS 15000
+
+
+//Globales del firmware y porton físico de una instancia
+struct PORTON_SIM
+{
+    int next_state;
+    int state;
+    int past_state;
+    struct DATA_IO data_io;
+    struct GPIO_PREVIO gpio_previo;
+    struct JITTER jitter;
+    struct CONEXION_MQTT conexion_mqtt;
+    struct COMANDOS comandos;
+    int reinicio_pendiente;
+    int spp_pedido;
+    uint32_t contadores[CONT_TOTAL];
+    struct TRAZA traza;
+
+    uint64_t aleatorio;
+    double falla;
+    int32_t posicion_ms;                    //Recorrido desde cerrado
+    int32_t recorrido_ms;
+    int motor_abrir;
+    int motor_cerrar;
+    int sensor_roto;                        //El limit switch del destino no se activa en este recorrido
+    int64_t movido_us;                      //Hasta dónde se calculó la posición
+};
+
+
+static void Porton_Iniciar(void *estado, uint64_t semilla, double falla)
+{
+    struct PORTON_SIM *p = estado;
+
+    memset(p, 0, sizeof(*p));
+    p->next_state = STATE_START;
+    p->state = STATE_START;
+    p->past_state = STATE_START;
+    p->gpio_previo.sensores_previos = 0xFF;
+    p->comandos.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    p->jitter.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    p->traza.lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    p->traza.base.estado = STATE_START;
+    p->traza.base.previo = STATE_START;
+
+    p->aleatorio = semilla;
+    p->falla = falla;
+    p->recorrido_ms = RECORRIDO_MIN_MS + (int32_t)(Simulador_Uniforme(&p->aleatorio) * (RECORRIDO_MAX_MS - RECORRIDO_MIN_MS));
+    p->posicion_ms = (Simulador_Uniforme(&p->aleatorio) < 0.8) ? 0 : p->recorrido_ms / 2;
+}
+
+static void Porton_Restaurar(const void *estado)
+{
+    const struct PORTON_SIM *p = estado;
+
+    NEXT_STATE = p->next_state;
+    STATE = p->state;
+    PAST_STATE = p->past_state;
+    data_io = p->data_io;
+    gpio_previo = p->gpio_previo;
+    jitter = p->jitter;
+    conexion_mqtt = p->conexion_mqtt;
+    comandos = p->comandos;
+    atomic_store(&reinicio_pendiente, p->reinicio_pendiente);
+    atomic_store(&spp_pedido, p->spp_pedido);
+    for (int i = 0; i < CONT_TOTAL; i++)
+    {
+        atomic_store_explicit(&contadores[i], p->contadores[i], memory_order_relaxed);
+    }
+    traza = p->traza;
+}
+
+static void Porton_Guardar(void *estado)
+{
+    struct PORTON_SIM *p = estado;
+
+    p->next_state = NEXT_STATE;
+    p->state = STATE;
+    p->past_state = PAST_STATE;
+    p->data_io = data_io;
+    p->gpio_previo = gpio_previo;
+    p->jitter = jitter;
+    p->conexion_mqtt = conexion_mqtt;
+    p->comandos = comandos;
+    p->reinicio_pendiente = atomic_load(&reinicio_pendiente);
+    p->spp_pedido = atomic_load(&spp_pedido);
+    for (int i = 0; i < CONT_TOTAL; i++)
+    {
+        p->contadores[i] = atomic_load_explicit(&contadores[i], memory_order_relaxed);
+    }
+    p->traza = traza;
+}
+
+static void Porton_Evento(esp_mqtt_event_handle_t event)
+{
+    mqtt_event_handler(NULL, "MQTT_EVENTS", event->event_id, event);
+}
+
+static void Porton_Outbox(struct OUTBOX_CONFIG *config)
+{
+    config->tag = TAG;
+    config->topic_eventos = TOPIC_EVENTOS;
+    config->topic_telemetria = TOPIC_METRICAS;
+    config->contar = Contar_Outbox;
+}
+
+static void Porton_Cliente(esp_mqtt_client_handle_t cliente)
+{
+    cliente_mqtt = cliente;
+}
+
+
+//El porton se mueve 1 ms de recorrido por ms con el motor encendido
+static void Porton_Mover(struct PORTON_SIM *p, int64_t ahora_us)
+{
+    int32_t avance_ms = (int32_t)((ahora_us - p->movido_us) / 1000);
+
+    p->movido_us += (int64_t)avance_ms * 1000;
+    if (p->motor_abrir)
+    {
+        p->posicion_ms = (p->posicion_ms + avance_ms < p->recorrido_ms) ? p->posicion_ms + avance_ms : p->recorrido_ms;
+    }
+    if (p->motor_cerrar)
+    {
+        p->posicion_ms = (p->posicion_ms > avance_ms) ? p->posicion_ms - avance_ms : 0;
+    }
+}
+
+static int Porton_Gpio_Leer(void *estado, gpio_num_t gpio, int64_t ahora_us)
+{
+    struct PORTON_SIM *p = estado;
+
+    Porton_Mover(p, ahora_us);
+    if (gpio == SENSOR_OPEN)
+    {
+        return (p->posicion_ms >= p->recorrido_ms) && !(p->sensor_roto && p->motor_abrir);
+    }
+    if (gpio == SENSOR_CLOSE)
+    {
+        return (p->posicion_ms <= 0) && !(p->sensor_roto && p->motor_cerrar);
+    }
+    return 0;
+}
+
+static void Porton_Gpio_Escribir(void *estado, gpio_num_t gpio, uint32_t nivel, int64_t ahora_us)
+{
+    struct PORTON_SIM *p = estado;
+    int *motor = (gpio == MOTOR_ABRIR) ? &p->motor_abrir : (gpio == MOTOR_CERRAR) ? &p->motor_cerrar : NULL;
+
+    if (motor == NULL)
+    {
+        return;
+    }
+    Porton_Mover(p, ahora_us);
+    if (nivel && !*motor)
+    {
+        p->sensor_roto = Simulador_Uniforme(&p->aleatorio) < p->falla;
+    }
+    *motor = (nivel != 0);
+}
+
+
+static int Porton_Estado(void)
+{
+    return STATE;
+}
+
+static int Porton_Pendiente(void)
+{
+    return data_io.SPP || atomic_load(&spp_pedido);
+}
+
+//El pulso se toma en OPEN, CLOSE y BUG y lleva a estos estados; al entrar a OPEN o CLOSE se descarta
+static int Porton_Aplicado(int previo, int actual)
+{
+    return (actual == OPENING) || (actual == CLOSING) || (actual == STATE_START);
+}
+
+
+const struct FIRMWARE_SIM FIRMWARE_PORTON = {
+    .nombre = "porton",
+    .estado_largo = sizeof(struct PORTON_SIM),
+    .tareas = { { Maquina_Estado_Task, 0 }, { Metricas_Task, METRICAS_INTERVALO_MS } },
+    .cantidad_tareas = 2,
+    .topic_comando = "Boton_de_control",
+    .comando_con_id = TRUE,
+    .nombres = NOMBRE_FUNCION_ESTADO,
+    .estados = sizeof(NOMBRE_FUNCION_ESTADO) / sizeof(NOMBRE_FUNCION_ESTADO[0]),
+    .outbox = Porton_Outbox,
+    .cliente = Porton_Cliente,
+    .iniciar = Porton_Iniciar,
+    .restaurar = Porton_Restaurar,
+    .guardar = Porton_Guardar,
+    .evento = Porton_Evento,
+    .gpio_leer = Porton_Gpio_Leer,
+    .gpio_escribir = Porton_Gpio_Escribir,
+    .estado_actual = Porton_Estado,
+    .comando_pendiente = Porton_Pendiente,
+    .comando_aplicado = Porton_Aplicado,
+};
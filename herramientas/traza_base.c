@@ -0,0 +1,327 @@
+/***********************************************************/
+/*  Trazas de referencia grabadas con el firmware original */
+/*                                                         */
+/*  Corre en la PC la máquina de estado del commit base    */
+/*  (BASE en el Makefile, antes de toda la serie de        */
+/*  cambios) contra un porton simulado y graba lo que hace */
+/*  con el formato TRZ2 de Porton/traza/datos. El firmware */
+/*  base no tiene traza: los eventos se toman desde afuera */
+/*  (GPIO, vTaskDelay, STATE) en los mismos puntos donde   */
+/*  el firmware actual llama a Traza_Registrar. Así "make  */
+/*  check" compara el firmware actual con el original y no */
+/*  consigo mismo.                                         */
+/*                                                         */
+/*  El Makefile saca el firmware base con git show y le    */
+/*  quita los #include de ESP-IDF (base_porton.c).         */
+/*                                                         */
+/*  Uso:                                                   */
+/*    make -C herramientas trazas                          */
+/*    ./traza_base arranque|con_vuelta salida.bin          */
+/***********************************************************/
+
+#define PORTON_HOST
+#include "porton_host.h"
+#include "base_porton.c"
+#include "porton_host.c"
+
+#include <stdlib.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TRAZA_EVENTOS 2048                  //Mismo buffer circular que el firmware
+#define RECORRIDO_MS 12000                  //Recorrido completo del porton con el motor encendido
+
+
+//Formato del volcado, igual que TRAZA_* en "Maquina de etado mircro.c"
+enum TRAZA_TIPO
+{
+    TRAZA_GPIO = 1,
+    TRAZA_COMANDO,
+    TRAZA_TRANSICION,
+    TRAZA_TIMER,
+};
+#define TRAZA_TIMER_SEPARACION 0
+#define TRAZA_TIMER_RT 1
+
+struct TRAZA_EVENTO
+{
+    uint32_t t_ms;
+    uint8_t tipo;
+    uint8_t a;
+    uint16_t b;
+};
+
+struct TRAZA_BASE
+{
+    uint32_t t_ms;
+    uint8_t estado;
+    uint8_t previo;
+    uint8_t sensores;
+    uint8_t cod_err;
+};
+
+struct TRAZA_CABECERA
+{
+    char magia[4];
+    uint32_t eventos;
+    uint32_t perdidos;
+    struct TRAZA_BASE base;
+};
+
+
+//Corrida: el guion, el porton simulado y la traza que se va grabando
+struct ESCENARIO
+{
+    const char *nombre;
+    uint64_t semilla;
+    int64_t duracion_ms;
+    int32_t posicion_inicial_ms;    //0 cerrado, RECORRIDO_MS abierto
+    int32_t comando_min_ms;         //Pausa entre comandos, al azar entre min y max
+    int32_t comando_max_ms;
+    double falla;                   //Probabilidad de que un limit switch no responda en un recorrido
+    uint32_t falla_forzada;         //Recorrido (1, 2, ...) que falla siempre, 0 ninguno
+};
+
+static const struct ESCENARIO ESCENARIOS[] = {
+    //Desde el arranque con el porton a medio camino, con una falla RT en el quinto recorrido
+    { "arranque", 1, 30 * 60 * 1000, RECORRIDO_MS / 2, 15000, 45000, 0.0, 5 },
+    //Un día de uso: la traza da la vuelta al buffer y empieza a mitad de un estado
+    { "con_vuelta", 2, 24 * 3600 * 1000LL, 0, 20000, 90000, 0.01, 0 },
+};
+
+struct GRABACION
+{
+    const struct ESCENARIO *escenario;
+    uint64_t aleatorio;
+    int64_t ahora_us;
+    int64_t proximo_comando_us;
+    int32_t posicion_ms;
+    int64_t movido_us;
+    int motor_abrir;
+    int motor_cerrar;
+    int sensor_roto;
+    uint32_t recorridos;
+    int estado_visto;               //STATE en el último vTaskDelay, -1 antes del primero
+    uint8_t sensores_previos;
+    uint32_t escritos;
+    struct TRAZA_BASE base;
+    struct TRAZA_EVENTO eventos[TRAZA_EVENTOS];
+    jmp_buf salida;
+}grabacion;
+
+
+static double Uniforme(void)
+{
+    //xorshift64*, la misma semilla da la misma traza
+    grabacion.aleatorio ^= grabacion.aleatorio >> 12;
+    grabacion.aleatorio ^= grabacion.aleatorio << 25;
+    grabacion.aleatorio ^= grabacion.aleatorio >> 27;
+    return (double)((grabacion.aleatorio * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+//Igual que Traza_Registrar: el evento que se pisa pasa a la base
+static void Registrar(uint8_t tipo, uint8_t a, uint16_t b)
+{
+    struct TRAZA_EVENTO *lugar = &grabacion.eventos[grabacion.escritos % TRAZA_EVENTOS];
+
+    if (grabacion.escritos >= TRAZA_EVENTOS)
+    {
+        if (lugar->tipo == TRAZA_GPIO)
+        {
+            grabacion.base.sensores = lugar->a;
+        }
+        else if (lugar->tipo == TRAZA_TRANSICION)
+        {
+            grabacion.base.t_ms = lugar->t_ms;
+            grabacion.base.estado = lugar->a;
+            grabacion.base.previo = lugar->b & 0xFF;
+            grabacion.base.cod_err = lugar->b >> 8;
+        }
+    }
+    *lugar = (struct TRAZA_EVENTO){ (uint32_t)(grabacion.ahora_us / 1000), tipo, a, b };
+    ++grabacion.escritos;
+}
+
+
+//El porton se mueve 1 ms de recorrido por ms con el motor encendido
+static void Mover(void)
+{
+    int32_t avance_ms = (int32_t)((grabacion.ahora_us - grabacion.movido_us) / 1000);
+
+    grabacion.movido_us += (int64_t)avance_ms * 1000;
+    if (grabacion.motor_abrir)
+    {
+        grabacion.posicion_ms = (grabacion.posicion_ms + avance_ms < RECORRIDO_MS) ? grabacion.posicion_ms + avance_ms : RECORRIDO_MS;
+    }
+    if (grabacion.motor_cerrar)
+    {
+        grabacion.posicion_ms = (grabacion.posicion_ms > avance_ms) ? grabacion.posicion_ms - avance_ms : 0;
+    }
+}
+
+static void Programar_Comando(void)
+{
+    const struct ESCENARIO *e = grabacion.escenario;
+
+    grabacion.proximo_comando_us += (e->comando_min_ms + (int64_t)(Uniforme() * (e->comando_max_ms - e->comando_min_ms))) * 1000;
+}
+
+
+//Entrada a un estado: en el firmware actual Registrar_Transicion va antes del primer vTaskDelay del estado
+static void Ver_Transicion(void)
+{
+    if (STATE == grabacion.estado_visto)
+    {
+        return;
+    }
+    //La falla RT se registra al superar RT_MAX, justo antes de entrar a BUG
+    if ((STATE == BUG) && (data_io.COD_ERR == ERROR_RT))
+    {
+        Registrar(TRAZA_TIMER, TRAZA_TIMER_RT, data_io.Cont_RT);
+    }
+    Registrar(TRAZA_TRANSICION, STATE, PAST_STATE | (data_io.COD_ERR << 8));
+    grabacion.estado_visto = STATE;
+}
+
+//FreeRTOS virtual: la única tarea es la máquina de estado de app_main
+void vTaskDelay(TickType_t ticks)
+{
+    int64_t hasta_us = grabacion.ahora_us + (int64_t)ticks * 1000;
+
+    Ver_Transicion();
+
+    //Los comandos llegan por MQTT en cualquier momento del retardo
+    while (grabacion.proximo_comando_us <= hasta_us)
+    {
+        grabacion.ahora_us = (grabacion.proximo_comando_us > grabacion.ahora_us) ? grabacion.proximo_comando_us : grabacion.ahora_us;
+        char comando[] = "1";
+        Registrar(TRAZA_COMANDO, 0, 0);
+        Dato_MQTT(comando);
+        Programar_Comando();
+    }
+    grabacion.ahora_us = hasta_us;
+
+    if (ticks == 3000/portTICK_PERIOD_MS)
+    {
+        Registrar(TRAZA_TIMER, TRAZA_TIMER_SEPARACION, 0);
+    }
+    if (grabacion.ahora_us >= grabacion.escenario->duracion_ms * 1000)
+    {
+        longjmp(grabacion.salida, 1);
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return grabacion.ahora_us;
+}
+
+//Actualización_GPIO lee primero SENSOR_OPEN y después SENSOR_CLOSE
+int gpio_get_level(gpio_num_t gpio)
+{
+    Mover();
+    int lsa = (grabacion.posicion_ms >= RECORRIDO_MS) && !(grabacion.sensor_roto && grabacion.motor_abrir);
+    int lsc = (grabacion.posicion_ms <= 0) && !(grabacion.sensor_roto && grabacion.motor_cerrar);
+
+    if (gpio == SENSOR_CLOSE)
+    {
+        uint8_t sensores = data_io.LSA | (lsc << 1);
+        if (sensores != grabacion.sensores_previos)
+        {
+            Registrar(TRAZA_GPIO, sensores, 0);
+            grabacion.sensores_previos = sensores;
+        }
+        return lsc;
+    }
+    return (gpio == SENSOR_OPEN) ? lsa : 0;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t nivel)
+{
+    int *motor = (gpio == MOTOR_ABRIR) ? &grabacion.motor_abrir : (gpio == MOTOR_CERRAR) ? &grabacion.motor_cerrar : NULL;
+
+    if (motor == NULL)
+    {
+        return ESP_OK;
+    }
+    Mover();
+    if (nivel && !*motor)
+    {
+        grabacion.recorridos++;
+        grabacion.sensor_roto = (grabacion.recorridos == grabacion.escenario->falla_forzada) ||
+                                (Uniforme() < grabacion.escenario->falla);
+    }
+    *motor = (nivel != 0);
+    return ESP_OK;
+}
+
+
+//La red no se usa, el resto de la plataforma está en porton_host.c
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos) { return 0; }
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *datos, int largo,
+                            int qos, int retain) { return 0; }
+
+
+static int Guardar(const char *ruta)
+{
+    struct TRAZA_CABECERA cabecera = { .magia = { 'T', 'R', 'Z', '2' }, .base = grabacion.base };
+    uint32_t total = (grabacion.escritos < TRAZA_EVENTOS) ? grabacion.escritos : TRAZA_EVENTOS;
+    uint32_t primero = grabacion.escritos - total;
+    FILE *archivo = fopen(ruta, "wb");
+
+    if (archivo == NULL)
+    {
+        perror(ruta);
+        return FALSE;
+    }
+    cabecera.eventos = total;
+    cabecera.perdidos = primero;
+    fwrite(&cabecera, sizeof(cabecera), 1, archivo);
+    for (uint32_t i = 0; i < total; i++)
+    {
+        fwrite(&grabacion.eventos[(primero + i) % TRAZA_EVENTOS], sizeof(struct TRAZA_EVENTO), 1, archivo);
+    }
+    fclose(archivo);
+    fprintf(stderr, "%s: %" PRIu32 " eventos, %" PRIu32 " perdidos, %" PRIu32 " recorridos\n", ruta, total, primero,
+            grabacion.recorridos);
+    return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+    const struct ESCENARIO *escenario = NULL;
+
+    for (size_t i = 0; (argc == 3) && (i < sizeof(ESCENARIOS) / sizeof(ESCENARIOS[0])); i++)
+    {
+        if (strcmp(argv[1], ESCENARIOS[i].nombre) == 0)
+        {
+            escenario = &ESCENARIOS[i];
+        }
+    }
+    if (escenario == NULL)
+    {
+        fprintf(stderr, "uso: %s arranque|con_vuelta salida.bin\n", argv[0]);
+        return 2;
+    }
+
+    grabacion.escenario = escenario;
+    grabacion.aleatorio = escenario->semilla;
+    grabacion.posicion_ms = escenario->posicion_inicial_ms;
+    grabacion.estado_visto = -1;
+    grabacion.sensores_previos = 0xFF;
+    grabacion.base = (struct TRAZA_BASE){ .estado = STATE_START, .previo = STATE_START };
+    Programar_Comando();
+
+    //Los mensajes del firmware no interesan
+    int nulo = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(nulo, STDOUT_FILENO);
+    close(nulo);
+
+    if (setjmp(grabacion.salida) == 0)
+    {
+        app_main();
+    }
+    return Guardar(argv[2]) ? 0 : 1;
+}
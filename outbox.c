@@ -0,0 +1,426 @@
+/***********************************************************/
+/*  Outbox persistente de los dos firmwares                */
+/*  (ver outbox.h)                                         */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "outbox.h"
+
+#ifndef PORTON_HOST
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#endif
+
+
+//Sin MQTT_EVENT_DELETED un evento que esp-mqtt descarta de su outbox queda esperando un PUBACK que no llega
+#if !CONFIG_MQTT_REPORT_DELETED_MESSAGES
+#error "Outbox: habilitar MQTT_REPORT_DELETED_MESSAGES (ver sdkconfig.defaults)"
+#endif
+
+
+//Evento del outbox, se guarda en la clave "ev<slot>" de la partición OUTBOX_PARTICION
+struct OUTBOX_EVENTO
+{
+    uint32_t secuencia;             //Orden global entre reinicios, el backend ordena y descarta repetidos con esto
+    uint32_t t_ms;                  //Milisegundos desde el arranque en que ocurrió
+    uint8_t prioridad;              //OUTBOX_TELEMETRIA, OUTBOX_ESTADO u OUTBOX_FALLA
+    uint16_t largo;
+    char datos[OUTBOX_DATOS_MAX];   //Campos JSON sin llaves, se publica {"seq":<n>,"ms":<n>,<datos>}
+};
+
+//Índice en RAM de los eventos guardados, tamaño fijo sin importar cuánto dure la desconexión
+struct OUTBOX
+{
+    portMUX_TYPE lock;
+    nvs_handle_t nvs;
+    int disponible;                 //0 si no se pudo abrir la partición, los eventos se publican sin guardarlos
+    atomic_int conectado;
+    uint32_t siguiente;             //Secuencia del próximo evento
+    uint8_t ocupado[OUTBOX_EVENTOS];
+    uint8_t prioridad[OUTBOX_EVENTOS];
+    uint32_t secuencia[OUTBOX_EVENTOS];
+    int msg_id[OUTBOX_EVENTOS];     //Publicación del slot en el outbox de esp-mqtt, 0 si no se envió
+    uint8_t confirmado[OUTBOX_EVENTOS];     //Llegó el PUBACK, falta borrarlo de la flash
+    int64_t lote_us;                //Momento en que se envió el último lote
+};
+
+static struct OUTBOX outbox = { .lock = portMUX_INITIALIZER_UNLOCKED };
+static struct OUTBOX_CONFIG configuracion_outbox;
+static QueueHandle_t cola_outbox;
+static SemaphoreHandle_t lock_evento;               //Protege evento_armado
+static struct OUTBOX_EVENTO evento_armado;          //Evento que arma Outbox_Evento, fuera de la pila de quien llama
+static esp_mqtt_client_handle_t cliente_outbox = NULL;
+
+
+static void Outbox_Contar(enum OUTBOX_CUENTA cuenta, uint32_t cantidad)
+{
+    if (configuracion_outbox.contar != NULL)
+    {
+        configuracion_outbox.contar(cuenta, cantidad);
+    }
+}
+
+
+static void Outbox_Descartar(uint8_t prioridad)
+{
+    Outbox_Contar((prioridad == OUTBOX_TELEMETRIA) ? OUTBOX_TELEMETRIA_DESC : OUTBOX_EVENTOS_DESC, 1);
+}
+
+
+//Función para publicar un evento con QoS 1; devuelve el msg_id de esp-mqtt o -1
+static int Outbox_Publicar(const struct OUTBOX_EVENTO *evento)
+{
+    char mensaje[OUTBOX_DATOS_MAX + 40];            //Con las dos secuencias de 10 cifras entran los datos más largos
+
+    if (cliente_outbox == NULL)
+    {
+        return -1;
+    }
+    int largo = snprintf(mensaje, sizeof(mensaje), "{\"seq\":%" PRIu32 ",\"ms\":%" PRIu32 ",%s}", evento->secuencia, evento->t_ms, evento->datos);
+    if ((largo < 0) || (largo >= sizeof(mensaje)))
+    {
+        ESP_LOGE(configuracion_outbox.tag, "Outbox: el evento %" PRIu32 " no entra en el mensaje", evento->secuencia);
+        return -1;
+    }
+    return esp_mqtt_client_publish(cliente_outbox,
+                                   (evento->prioridad == OUTBOX_TELEMETRIA) ? configuracion_outbox.topic_telemetria : configuracion_outbox.topic_eventos,
+                                   mensaje, 0, 1, 0);
+}
+
+
+//Función para guardar un evento en la flash. Con el outbox lleno reemplaza el más viejo de menor prioridad
+//que no esté en el outbox de esp-mqtt, siempre que no sea más importante que el nuevo; si no, descarta el nuevo
+static void Outbox_Guardar(struct OUTBOX_EVENTO *evento)
+{
+    char clave[NVS_KEY_NAME_MAX_SIZE];
+    int slot = -1;
+
+    //Sin partición se publica como antes del outbox: esp-mqtt lo retiene en RAM mientras no hay conexión
+    if (!outbox.disponible)
+    {
+        evento->secuencia = outbox.siguiente++;
+        if (Outbox_Publicar(evento) < 0)
+        {
+            Outbox_Descartar(evento->prioridad);
+        }
+        return;
+    }
+
+    taskENTER_CRITICAL(&outbox.lock);
+    for (int i = 0; (i < OUTBOX_EVENTOS) && (slot < 0); i++)
+    {
+        if (!outbox.ocupado[i])
+        {
+            slot = i;
+        }
+    }
+    int reemplazado = (slot < 0);
+    for (int i = 0; (i < OUTBOX_EVENTOS) && reemplazado; i++)
+    {
+        if ((outbox.msg_id[i] != 0) || outbox.confirmado[i] || (outbox.prioridad[i] > evento->prioridad))
+        {
+            continue;
+        }
+        if ((slot < 0) || (outbox.prioridad[i] < outbox.prioridad[slot]) ||
+            ((outbox.prioridad[i] == outbox.prioridad[slot]) && (outbox.secuencia[i] < outbox.secuencia[slot])))
+        {
+            slot = i;
+        }
+    }
+    uint8_t prioridad_reemplazada = (slot >= 0) ? outbox.prioridad[slot] : 0;
+    if (slot >= 0)
+    {
+        outbox.ocupado[slot] = 0;
+    }
+    taskEXIT_CRITICAL(&outbox.lock);
+
+    if (slot < 0)
+    {
+        Outbox_Descartar(evento->prioridad);
+        return;
+    }
+    if (reemplazado)
+    {
+        Outbox_Descartar(prioridad_reemplazada);
+    }
+
+    //Se guarda solo la parte usada de datos, el reemplazo pisa la misma clave
+    evento->secuencia = outbox.siguiente++;
+    snprintf(clave, sizeof(clave), "ev%02d", slot);
+    if ((nvs_set_blob(outbox.nvs, clave, evento, offsetof(struct OUTBOX_EVENTO, datos) + evento->largo + 1) != ESP_OK) ||
+        (nvs_set_u32(outbox.nvs, "sec", outbox.siguiente) != ESP_OK) || (nvs_commit(outbox.nvs) != ESP_OK))
+    {
+        ESP_LOGW(configuracion_outbox.tag, "Outbox: no se pudo guardar el evento %" PRIu32, evento->secuencia);
+        Outbox_Descartar(evento->prioridad);
+        return;
+    }
+
+    taskENTER_CRITICAL(&outbox.lock);
+    outbox.ocupado[slot] = 1;
+    outbox.prioridad[slot] = evento->prioridad;
+    outbox.secuencia[slot] = evento->secuencia;
+    outbox.msg_id[slot] = 0;
+    outbox.confirmado[slot] = 0;
+    taskEXIT_CRITICAL(&outbox.lock);
+}
+
+
+//Función para borrar de la flash los eventos que el broker ya confirmó
+static void Outbox_Limpiar(void)
+{
+    char clave[NVS_KEY_NAME_MAX_SIZE];
+    int borrados = 0;
+
+    for (int i = 0; i < OUTBOX_EVENTOS; i++)
+    {
+        if (!outbox.ocupado[i] || !outbox.confirmado[i])
+        {
+            continue;
+        }
+        snprintf(clave, sizeof(clave), "ev%02d", i);
+        nvs_erase_key(outbox.nvs, clave);
+        taskENTER_CRITICAL(&outbox.lock);
+        outbox.ocupado[i] = 0;
+        outbox.confirmado[i] = 0;
+        outbox.msg_id[i] = 0;
+        taskEXIT_CRITICAL(&outbox.lock);
+        borrados++;
+    }
+    if (borrados > 0)
+    {
+        nvs_commit(outbox.nvs);
+        Outbox_Contar(OUTBOX_ENVIADOS, borrados);
+    }
+}
+
+
+//Función para publicar el siguiente lote en orden de secuencia. Solo hay un lote en vuelo: el próximo
+//sale cuando todos sus eventos se confirmaron (o esp-mqtt los descartó) y pasó OUTBOX_PAUSA_MS, así al
+//reconectar no se satura el enlace. Un evento en vuelo no se vuelve a publicar: esp-mqtt lo retransmite
+//con el mismo msg_id, también después de una reconexión, y su PUBACK sigue encontrando el slot
+static void Outbox_Enviar_Lote(void)
+{
+    struct OUTBOX_EVENTO evento;
+    char clave[NVS_KEY_NAME_MAX_SIZE];
+    int64_t ahora_us = esp_timer_get_time();
+
+    if (!atomic_load(&outbox.conectado))
+    {
+        return;
+    }
+
+    for (int i = 0; i < OUTBOX_EVENTOS; i++)
+    {
+        if (outbox.ocupado[i] && (outbox.msg_id[i] != 0) && !outbox.confirmado[i])
+        {
+            return;
+        }
+    }
+    if (ahora_us - outbox.lote_us < OUTBOX_PAUSA_MS * 1000LL)
+    {
+        return;
+    }
+
+    int enviados = 0;
+    int64_t ultima = -1;
+    while (enviados < OUTBOX_LOTE)
+    {
+        int slot = -1;
+        for (int i = 0; i < OUTBOX_EVENTOS; i++)
+        {
+            if (outbox.ocupado[i] && !outbox.confirmado[i] && ((int64_t)outbox.secuencia[i] > ultima) &&
+                ((slot < 0) || (outbox.secuencia[i] < outbox.secuencia[slot])))
+            {
+                slot = i;
+            }
+        }
+        if (slot < 0)
+        {
+            break;
+        }
+        ultima = outbox.secuencia[slot];
+
+        size_t largo = sizeof(evento);
+        snprintf(clave, sizeof(clave), "ev%02d", slot);
+        if ((nvs_get_blob(outbox.nvs, clave, &evento, &largo) != ESP_OK) || (largo <= offsetof(struct OUTBOX_EVENTO, datos)))
+        {
+            continue;
+        }
+        evento.datos[largo - offsetof(struct OUTBOX_EVENTO, datos) - 1] = '\0';
+
+        int msg_id = Outbox_Publicar(&evento);
+        if (msg_id <= 0)
+        {
+            break;
+        }
+        taskENTER_CRITICAL(&outbox.lock);
+        outbox.msg_id[slot] = msg_id;
+        taskEXIT_CRITICAL(&outbox.lock);
+        enviados++;
+    }
+    if (enviados > 0)
+    {
+        outbox.lote_us = ahora_us;
+    }
+}
+
+
+void Outbox_Iniciar(const struct OUTBOX_CONFIG *config)
+{
+    struct OUTBOX_EVENTO evento;
+    char clave[NVS_KEY_NAME_MAX_SIZE];
+    int guardados = 0;
+
+    configuracion_outbox = *config;
+    cola_outbox = xQueueCreate(OUTBOX_COLA, sizeof(struct OUTBOX_EVENTO));
+    lock_evento = xSemaphoreCreateMutex();
+
+    esp_err_t err = nvs_flash_init_partition(OUTBOX_PARTICION);
+    if ((err == ESP_ERR_NVS_NO_FREE_PAGES) || (err == ESP_ERR_NVS_NEW_VERSION_FOUND))
+    {
+        nvs_flash_erase_partition(OUTBOX_PARTICION);
+        err = nvs_flash_init_partition(OUTBOX_PARTICION);
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_open_from_partition(OUTBOX_PARTICION, "outbox", NVS_READWRITE, &outbox.nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(configuracion_outbox.tag, "Outbox: no se pudo abrir la particion (%s), los eventos se publican sin guardarlos",
+                 esp_err_to_name(err));
+        return;
+    }
+
+    nvs_get_u32(outbox.nvs, "sec", &outbox.siguiente);
+    for (int i = 0; i < OUTBOX_EVENTOS; i++)
+    {
+        size_t largo = sizeof(evento);
+
+        snprintf(clave, sizeof(clave), "ev%02d", i);
+        if ((nvs_get_blob(outbox.nvs, clave, &evento, &largo) == ESP_OK) && (largo > offsetof(struct OUTBOX_EVENTO, datos)))
+        {
+            outbox.ocupado[i] = 1;
+            outbox.prioridad[i] = evento.prioridad;
+            outbox.secuencia[i] = evento.secuencia;
+            guardados++;
+
+            //Por si se cortó la energía entre guardar el evento y la secuencia
+            if (evento.secuencia >= outbox.siguiente)
+            {
+                outbox.siguiente = evento.secuencia + 1;
+            }
+        }
+    }
+    outbox.disponible = 1;
+    ESP_LOGI(configuracion_outbox.tag, "Outbox: %d eventos pendientes, siguiente secuencia %" PRIu32, guardados, outbox.siguiente);
+}
+
+
+void Outbox_Cliente(esp_mqtt_client_handle_t cliente)
+{
+    cliente_outbox = cliente;
+}
+
+
+//Se llama desde las máquinas de estado y el handler de Wi-Fi, la escritura en flash la hace Outbox_Task.
+//El evento se arma en evento_armado y no en la pila de quien llama, que puede ser chica (el handler de
+//Wi-Fi corre en la tarea de eventos del sistema); solo espera a otro Outbox_Evento que esté armando el suyo
+void Outbox_Evento(uint8_t prioridad, const char *formato, ...)
+{
+    va_list argumentos;
+
+    if ((lock_evento == NULL) || (xSemaphoreTake(lock_evento, portMAX_DELAY) != pdTRUE))
+    {
+        Outbox_Descartar(prioridad);
+        return;
+    }
+    evento_armado.t_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    evento_armado.prioridad = prioridad;
+    va_start(argumentos, formato);
+    int largo = vsnprintf(evento_armado.datos, sizeof(evento_armado.datos), formato, argumentos);
+    va_end(argumentos);
+    evento_armado.largo = (largo < sizeof(evento_armado.datos)) ? largo : sizeof(evento_armado.datos) - 1;
+
+    int encolado = (xQueueSend(cola_outbox, &evento_armado, 0) == pdTRUE);
+    xSemaphoreGive(lock_evento);
+    if (!encolado)
+    {
+        Outbox_Descartar(prioridad);
+    }
+}
+
+
+//Los eventos en vuelo conservan su msg_id al desconectar: esp-mqtt los retransmite al reconectar
+void Outbox_Conexion(int conectado)
+{
+    atomic_store(&outbox.conectado, conectado);
+}
+
+
+void Outbox_Publicado(int msg_id)
+{
+    if (msg_id <= 0)
+    {
+        return;
+    }
+    taskENTER_CRITICAL(&outbox.lock);
+    for (int i = 0; i < OUTBOX_EVENTOS; i++)
+    {
+        if (outbox.ocupado[i] && (outbox.msg_id[i] == msg_id))
+        {
+            outbox.confirmado[i] = 1;
+        }
+    }
+    taskEXIT_CRITICAL(&outbox.lock);
+}
+
+
+//El evento sigue en la flash: vuelve a quedar pendiente y sale en un lote siguiente con un msg_id nuevo
+void Outbox_Borrado(int msg_id)
+{
+    if (msg_id <= 0)
+    {
+        return;
+    }
+    taskENTER_CRITICAL(&outbox.lock);
+    for (int i = 0; i < OUTBOX_EVENTOS; i++)
+    {
+        if (outbox.ocupado[i] && !outbox.confirmado[i] && (outbox.msg_id[i] == msg_id))
+        {
+            outbox.msg_id[i] = 0;
+        }
+    }
+    taskEXIT_CRITICAL(&outbox.lock);
+}
+
+
+void Outbox_Task(void *pvParameters)
+{
+    struct OUTBOX_EVENTO evento;
+
+    for(;;)
+    {
+        if (xQueueReceive(cola_outbox, &evento, OUTBOX_PAUSA_MS/portTICK_PERIOD_MS) == pdTRUE)
+        {
+            Outbox_Guardar(&evento);
+        }
+        if (outbox.disponible)
+        {
+            Outbox_Limpiar();
+            Outbox_Enviar_Lote();
+        }
+    }
+}
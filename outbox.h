@@ -0,0 +1,80 @@
+/***********************************************************/
+/*  Outbox persistente de los dos firmwares                */
+/*                                                         */
+/*  Los cambios de estado, las fallas y la telemetría se   */
+/*  guardan en una partición NVS propia (OUTBOX_PARTICION  */
+/*  en partitions.csv) y se publican con QoS 1 en lotes    */
+/*  mientras hay conexión. Cada evento lleva una secuencia */
+/*  global para que el backend ordene y descarte repetidos.*/
+/*                                                         */
+/*  outbox.c se compila junto a cada firmware (va en SRCS  */
+/*  del CMakeLists del componente main).                   */
+/***********************************************************/
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdint.h>
+
+#ifdef PORTON_HOST
+#include "herramientas/porton_host.h"
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+#endif
+
+
+#define OUTBOX_PARTICION "outbox"                   //Partición NVS propia en partitions.csv (0x6000 bytes o más)
+#define OUTBOX_EVENTOS 32                           //Eventos guardados como máximo en flash
+#define OUTBOX_DATOS_MAX 448                        //Cuerpo JSON de un evento
+#define OUTBOX_COLA 8                               //Eventos nuevos esperando que Outbox_Task los guarde
+#define OUTBOX_LOTE 8                               //Eventos publicados antes de esperar sus PUBACK
+#define OUTBOX_PAUSA_MS 250                         //Pausa entre lotes: a lo sumo OUTBOX_LOTE eventos cada OUTBOX_PAUSA_MS
+#define OUTBOX_TELEMETRIA 0                         //Prioridades: con el outbox lleno se descarta primero la menor
+#define OUTBOX_ESTADO 1
+#define OUTBOX_FALLA 2
+
+
+//Lo que el outbox informa al firmware para sus métricas
+enum OUTBOX_CUENTA
+{
+    OUTBOX_ENVIADOS,                //Eventos confirmados por el broker y borrados de la flash
+    OUTBOX_TELEMETRIA_DESC,         //Telemetría descartada con el outbox lleno
+    OUTBOX_EVENTOS_DESC,            //Estados o fallas descartados (outbox lleno de fallas o cola llena)
+};
+
+typedef void (*Outbox_Contar_t)(enum OUTBOX_CUENTA cuenta, uint32_t cantidad);
+
+struct OUTBOX_CONFIG
+{
+    const char *tag;                //Etiqueta de los mensajes por serial
+    const char *topic_eventos;      //Estados y fallas
+    const char *topic_telemetria;
+    Outbox_Contar_t contar;         //Puede ser NULL
+};
+
+
+//Abre la partición, reconstruye el índice de lo guardado y crea la cola, antes de crear Outbox_Task
+//Sin partición los eventos se publican directamente, sin guardarlos
+void Outbox_Iniciar(const struct OUTBOX_CONFIG *config);
+
+//Cliente con el que se publican los eventos
+void Outbox_Cliente(esp_mqtt_client_handle_t cliente);
+
+//Encola un evento sin esperar lugar en la cola; formato arma los campos JSON sin llaves
+void Outbox_Evento(uint8_t prioridad, const char *formato, ...);
+
+//Llamar en MQTT_EVENT_CONNECTED y MQTT_EVENT_DISCONNECTED
+void Outbox_Conexion(int conectado);
+
+//Llamar en MQTT_EVENT_PUBLISHED: el broker confirmó msg_id
+void Outbox_Publicado(int msg_id);
+
+//Llamar en MQTT_EVENT_DELETED: esp-mqtt descartó msg_id de su outbox sin confirmarlo
+void Outbox_Borrado(int msg_id);
+
+//Tarea que guarda en flash los eventos encolados y vacía el outbox en lotes mientras hay conexión
+void Outbox_Task(void *pvParameters);
+
+#endif /* OUTBOX_H */
@@ -0,0 +1,417 @@
+/***********************************************************/
+/*  Perfilador de CPU de los dos firmwares                 */
+/*  (ver perfilador.h)                                     */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfilador.h"
+
+#ifndef PORTON_HOST
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#endif
+
+
+//El CPU y la pila por tarea salen de los contadores de FreeRTOS; sin ellos el CPU se estima del muestreo
+#define PERFILADOR_CONTADORES (configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS)
+
+#if !PERFILADOR_CONTADORES
+#warning "Perfilador: sin FREERTOS_USE_TRACE_FACILITY y FREERTOS_GENERATE_RUN_TIME_STATS el CPU por tarea sale del muestreo (ver sdkconfig.defaults)"
+#endif
+//Sin despacho desde la interrupción, el núcleo del esp_timer siempre se muestrea en la tarea esp_timer
+#if !CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+#warning "Perfilador: sin ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD no se muestrean bien los dos núcleos (ver sdkconfig.defaults)"
+#endif
+#ifndef configRUN_TIME_COUNTER_TYPE
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+#endif
+
+#define PERFILADOR_MENSAJE_MAX (128 + (PERFILADOR_TAREAS_MAX + PERFILADOR_CALIENTES) * 64)
+
+
+//Cuenta del perfilador: veces que se encontró una tarea en ejecución y, para las tareas
+//seguidas, el estado en curso (su lazo es el que más consume)
+struct PERFILADOR_CUENTA
+{
+    TaskHandle_t tarea;
+    int8_t estado;                  //Estado de la máquina en las tareas seguidas, -1 en las demás
+    uint32_t muestras;
+};
+
+//Medición en curso del perfilador
+struct PERFILADOR
+{
+    portMUX_TYPE lock;
+    esp_timer_handle_t timer;
+    TaskHandle_t seguidas[PERFILADOR_SEGUIDAS];
+    uint32_t muestras;              //Una por núcleo en cada disparo del muestreo
+    uint32_t perdidas;              //Muestras que no entraron en la tabla
+    uint32_t distintas;
+    int64_t costo_us;               //Tiempo total dentro del muestreo
+    struct PERFILADOR_CUENTA tabla[PERFILADOR_TABLA];
+};
+
+static struct PERFILADOR perfilador = { .lock = portMUX_INITIALIZER_UNLOCKED };
+static struct PERFILADOR_CONFIG configuracion;
+static QueueHandle_t cola_perfilador;
+static esp_mqtt_client_handle_t cliente_perfilador = NULL;
+
+
+//Callback del muestreo del perfilador, anota qué corre en cada núcleo en este momento
+//Está en IRAM porque corre en la interrupción del esp_timer, incluso mientras OTA escribe la flash
+static void IRAM_ATTR Perfilador_Muestreo(void *arg)
+{
+    int64_t inicio = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&perfilador.lock);
+    for (int nucleo = 0; nucleo < portNUM_PROCESSORS; nucleo++)
+    {
+        TaskHandle_t tarea = xTaskGetCurrentTaskHandleForCore(nucleo);
+        int8_t estado = -1;
+        uint32_t i = 0;
+
+        for (int s = 0; s < PERFILADOR_SEGUIDAS; s++)
+        {
+            if ((tarea != NULL) && (tarea == perfilador.seguidas[s]))
+            {
+                estado = configuracion.estado();
+            }
+        }
+        while ((i < perfilador.distintas) && ((perfilador.tabla[i].tarea != tarea) || (perfilador.tabla[i].estado != estado)))
+        {
+            ++i;
+        }
+        if (i == perfilador.distintas)
+        {
+            if (i == PERFILADOR_TABLA)
+            {
+                ++perfilador.perdidas;
+                continue;
+            }
+            perfilador.tabla[i].tarea = tarea;
+            perfilador.tabla[i].estado = estado;
+            perfilador.tabla[i].muestras = 0;
+            ++perfilador.distintas;
+        }
+        ++perfilador.tabla[i].muestras;
+        ++perfilador.muestras;
+    }
+    perfilador.costo_us += esp_timer_get_time() - inicio;
+    portEXIT_CRITICAL_SAFE(&perfilador.lock);
+}
+
+
+//Función para interpretar un pedido "perfil" o "perfil:<ms>"
+//Devuelve la ventana de medición en milisegundos, 0 si el texto no es un pedido
+static uint32_t Perfilador_Ventana(const char *texto, int largo)
+{
+    char copia[24];
+
+    if ((largo < 6) || (largo >= sizeof(copia)) || (strncmp(texto, "perfil", 6) != 0))
+    {
+        return 0;
+    }
+    if (largo == 6)
+    {
+        return PERFILADOR_VENTANA_MS;
+    }
+    if (texto[6] != ':')
+    {
+        return 0;
+    }
+    memcpy(copia, texto, largo);
+    copia[largo] = '\0';
+
+    uint32_t ventana = strtoul(&copia[7], NULL, 10);
+    return (ventana > PERFILADOR_VENTANA_MAX_MS) ? PERFILADOR_VENTANA_MAX_MS : ventana;
+}
+
+
+#if PERFILADOR_CONTADORES
+//Función para buscar el nombre de una tarea en una copia de los estados de las tareas
+static const char *Perfilador_Nombre(TaskHandle_t tarea, const TaskStatus_t *tareas, UBaseType_t cantidad)
+{
+    for (UBaseType_t i = 0; i < cantidad; i++)
+    {
+        if (tareas[i].xHandle == tarea)
+        {
+            return tareas[i].pcTaskName;
+        }
+    }
+    return "?";
+}
+#endif
+
+
+//Agrega una entrada al mensaje desde largo y devuelve el largo nuevo. Una entrada que no entra
+//(dejando lugar para el cierre "]}") se descarta entera, así el JSON publicado sigue siendo válido
+static int Perfilador_Agregar(char *mensaje, int largo, const char *formato, ...)
+{
+    int lugar = PERFILADOR_MENSAJE_MAX - largo - (int)sizeof("]}");
+    int agregado = -1;
+    va_list argumentos;
+
+    if (lugar > 0)
+    {
+        va_start(argumentos, formato);
+        agregado = vsnprintf(&mensaje[largo], lugar, formato, argumentos);
+        va_end(argumentos);
+    }
+    if ((agregado < 0) || (agregado >= lugar))
+    {
+        mensaje[largo] = '\0';
+        ESP_LOGW(configuracion.tag, "Perfilador: el mensaje no entra en %d bytes, se publica recortado", PERFILADOR_MENSAJE_MAX);
+        return largo;
+    }
+    return largo + agregado;
+}
+
+//Función para medir el CPU por tarea y las entradas más muestreadas durante ventana_ms
+//El resultado se imprime por serial y se publica en el topic de la configuración:
+//{"ventana_ms":<n>,"muestras":<n>,"costo_pct":<n>,"tareas":[{"n":"<tarea>","cpu":<%>,"pila":<libre>},...],
+// "calientes":[{"f":"<tarea>[/<estado>]","cpu":<%>},...]}
+//Los porcentajes son de un núcleo: en el ESP32 las tareas suman hasta 200
+static void Perfilador_Medir(uint32_t ventana_ms)
+{
+    char *mensaje = malloc(PERFILADOR_MENSAJE_MAX);
+    static struct PERFILADOR copia;
+
+    if (mensaje == NULL)
+    {
+        ESP_LOGE(configuracion.tag, "Sin memoria para el perfilador");
+        return;
+    }
+#if PERFILADOR_CONTADORES
+    TaskStatus_t *antes = malloc(2 * PERFILADOR_TAREAS_MAX * sizeof(TaskStatus_t));
+    configRUN_TIME_COUNTER_TYPE total_antes = 0;
+    configRUN_TIME_COUNTER_TYPE total_despues = 0;
+
+    if (antes == NULL)
+    {
+        ESP_LOGE(configuracion.tag, "Sin memoria para el perfilador");
+        free(mensaje);
+        return;
+    }
+    TaskStatus_t *despues = antes + PERFILADOR_TAREAS_MAX;
+#endif
+
+    //Reiniciamos la tabla y tomamos los contadores de tiempo al inicio de la ventana
+    taskENTER_CRITICAL(&perfilador.lock);
+    perfilador.muestras = 0;
+    perfilador.perdidas = 0;
+    perfilador.distintas = 0;
+    perfilador.costo_us = 0;
+    taskEXIT_CRITICAL(&perfilador.lock);
+
+#if PERFILADOR_CONTADORES
+    UBaseType_t cantidad_antes = uxTaskGetSystemState(antes, PERFILADOR_TAREAS_MAX, &total_antes);
+#endif
+    esp_timer_start_periodic(perfilador.timer, PERFILADOR_MUESTREO_US);
+    vTaskDelay(ventana_ms/portTICK_PERIOD_MS);
+    esp_timer_stop(perfilador.timer);
+#if PERFILADOR_CONTADORES
+    UBaseType_t cantidad = uxTaskGetSystemState(despues, PERFILADOR_TAREAS_MAX, &total_despues);
+#endif
+
+    taskENTER_CRITICAL(&perfilador.lock);
+    copia = perfilador;
+    taskEXIT_CRITICAL(&perfilador.lock);
+
+    int largo = Perfilador_Agregar(mensaje, 0, "{\"ventana_ms\":%" PRIu32 ",\"muestras\":%" PRIu32 ",\"perdidas\":%" PRIu32
+                         ",\"costo_pct\":%.3f,\"tareas\":[",
+                         ventana_ms, copia.muestras, copia.perdidas, copia.costo_us * 100.0 / (ventana_ms * 1000.0));
+
+#if PERFILADOR_CONTADORES
+    if (cantidad == 0)
+    {
+        ESP_LOGW(configuracion.tag, "Perfilador: hay más de %d tareas, aumentar PERFILADOR_TAREAS_MAX", PERFILADOR_TAREAS_MAX);
+    }
+
+    //CPU por tarea: tiempo de ejecución de la tarea en la ventana sobre el tiempo total de la ventana
+    configRUN_TIME_COUNTER_TYPE total = total_despues - total_antes;
+    for (UBaseType_t i = 0; i < cantidad; i++)
+    {
+        configRUN_TIME_COUNTER_TYPE previo = 0;
+        for (UBaseType_t j = 0; j < cantidad_antes; j++)
+        {
+            if (antes[j].xHandle == despues[i].xHandle)
+            {
+                previo = antes[j].ulRunTimeCounter;
+                break;
+            }
+        }
+        double cpu = (total > 0) ? (despues[i].ulRunTimeCounter - previo) * 100.0 / total : 0.0;
+
+        ESP_LOGI(configuracion.tag, "Perfil %-16s cpu %5.1f%% pila libre %" PRIu32, despues[i].pcTaskName, cpu,
+                 (uint32_t)despues[i].usStackHighWaterMark);
+        largo = Perfilador_Agregar(mensaje, largo, "%s{\"n\":\"%s\",\"cpu\":%.1f,\"pila\":%" PRIu32 "}", (i > 0) ? "," : "",
+                                   despues[i].pcTaskName, cpu, (uint32_t)despues[i].usStackHighWaterMark);
+    }
+#else
+    //CPU por tarea: muestras de la tarea (todos sus estados) sobre las muestras de un núcleo; sin pila libre
+    int tareas = 0;
+    for (uint32_t i = 0; i < copia.distintas; i++)
+    {
+        uint32_t muestras = 0;
+        int repetida = 0;
+        for (uint32_t j = 0; j < copia.distintas; j++)
+        {
+            if (copia.tabla[j].tarea == copia.tabla[i].tarea)
+            {
+                repetida |= (j < i);
+                muestras += copia.tabla[j].muestras;
+            }
+        }
+        if (repetida || (tareas == PERFILADOR_TAREAS_MAX))
+        {
+            continue;
+        }
+        const char *nombre = (copia.tabla[i].tarea != NULL) ? pcTaskGetName(copia.tabla[i].tarea) : "?";
+        double cpu = (copia.muestras > 0) ? muestras * 100.0 * portNUM_PROCESSORS / copia.muestras : 0.0;
+
+        ESP_LOGI(configuracion.tag, "Perfil %-16s cpu %5.1f%% (muestreo)", nombre, cpu);
+        largo = Perfilador_Agregar(mensaje, largo, "%s{\"n\":\"%s\",\"cpu\":%.1f}", (tareas > 0) ? "," : "", nombre, cpu);
+        ++tareas;
+    }
+#endif
+    largo = Perfilador_Agregar(mensaje, largo, "],\"calientes\":[");
+
+    //Entradas más muestreadas, de mayor a menor
+    for (uint32_t i = 0; (i < PERFILADOR_CALIENTES) && (i < copia.distintas); i++)
+    {
+        uint32_t mayor = i;
+        for (uint32_t j = i + 1; j < copia.distintas; j++)
+        {
+            if (copia.tabla[j].muestras > copia.tabla[mayor].muestras)
+            {
+                mayor = j;
+            }
+        }
+        struct PERFILADOR_CUENTA cuenta = copia.tabla[mayor];
+        copia.tabla[mayor] = copia.tabla[i];
+        copia.tabla[i] = cuenta;
+
+#if PERFILADOR_CONTADORES
+        const char *tarea = Perfilador_Nombre(cuenta.tarea, despues, cantidad);
+#else
+        const char *tarea = (cuenta.tarea != NULL) ? pcTaskGetName(cuenta.tarea) : "?";
+#endif
+        const char *estado = ((cuenta.estado >= 0) && (cuenta.estado < configuracion.estados)) ?
+                             configuracion.nombres[cuenta.estado] : "";
+        double cpu = cuenta.muestras * 100.0 * portNUM_PROCESSORS / copia.muestras;
+
+        ESP_LOGI(configuracion.tag, "Caliente %s%s%s %5.1f%%", tarea, (estado[0] != '\0') ? "/" : "", estado, cpu);
+        largo = Perfilador_Agregar(mensaje, largo, "%s{\"f\":\"%s%s%s\",\"cpu\":%.1f}", (i > 0) ? "," : "",
+                                   tarea, (estado[0] != '\0') ? "/" : "", estado, cpu);
+    }
+    strcpy(&mensaje[largo], "]}");
+
+    if (cliente_perfilador != NULL)
+    {
+        esp_mqtt_client_publish(cliente_perfilador, configuracion.topic, mensaje, 0, 1, 0);
+    }
+#if PERFILADOR_CONTADORES
+    free(antes);
+#endif
+    free(mensaje);
+}
+
+
+void Perfilador_Iniciar(const struct PERFILADOR_CONFIG *config)
+{
+    esp_timer_create_args_t muestreo = {
+        .callback = Perfilador_Muestreo,
+        .name = "perfilador",
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        .dispatch_method = ESP_TIMER_ISR,
+#endif
+    };
+
+    configuracion = *config;
+    cola_perfilador = xQueueCreate(1, sizeof(uint32_t));
+    ESP_ERROR_CHECK(esp_timer_create(&muestreo, &perfilador.timer));
+}
+
+
+void Perfilador_Seguir(TaskHandle_t tarea)
+{
+    taskENTER_CRITICAL(&perfilador.lock);
+    for (int s = 0; s < PERFILADOR_SEGUIDAS; s++)
+    {
+        if (perfilador.seguidas[s] == NULL)
+        {
+            perfilador.seguidas[s] = tarea;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&perfilador.lock);
+}
+
+
+void Perfilador_Cliente(esp_mqtt_client_handle_t cliente)
+{
+    cliente_perfilador = cliente;
+}
+
+
+int Perfilador_Pedir(const char *texto, int largo)
+{
+    uint32_t ventana = Perfilador_Ventana(texto, largo);
+
+    if (ventana == 0)
+    {
+        return 0;
+    }
+    if (xQueueSend(cola_perfilador, &ventana, 0) != pdTRUE)
+    {
+        ESP_LOGW(configuracion.tag, "Perfilador ocupado, se descarta el pedido");
+    }
+    return 1;
+}
+
+
+//Fuera de una medición el muestreo está detenido y solo quedan los contadores de FreeRTOS
+void Perfilador_Task(void *pvParameters)
+{
+    char linea[24];
+    int largo = 0;
+    uint32_t ventana;
+
+    for(;;)
+    {
+        //Pedidos por MQTT
+        if (xQueueReceive(cola_perfilador, &ventana, 100/portTICK_PERIOD_MS) == pdTRUE)
+        {
+            Perfilador_Medir(ventana);
+            continue;
+        }
+
+        //Pedidos por la consola serial, uno por línea
+        int c;
+        while ((c = fgetc(stdin)) != EOF)
+        {
+            if ((c == '\n') || (c == '\r'))
+            {
+                ventana = Perfilador_Ventana(linea, largo);
+                largo = 0;
+                if (ventana > 0)
+                {
+                    Perfilador_Medir(ventana);
+                }
+            }
+            else if (largo < sizeof(linea))
+            {
+                linea[largo++] = c;
+            }
+        }
+        clearerr(stdin);
+    }
+}
@@ -0,0 +1,67 @@
+/***********************************************************/
+/*  Perfilador de CPU de los dos firmwares                 */
+/*                                                         */
+/*  Una medición dura la ventana pedida por MQTT o por la  */
+/*  consola serial ("perfil" o "perfil:<ms>") y reporta:   */
+/*    - CPU y pila libre por tarea, de los contadores de   */
+/*      tiempo de ejecución de FreeRTOS                    */
+/*    - las entradas más muestreadas: la tarea que corre   */
+/*      en cada núcleo cada PERFILADOR_MUESTREO_US y, en   */
+/*      las tareas seguidas, el estado de la máquina       */
+/*                                                         */
+/*  perfilador.c se compila junto a cada firmware (va en   */
+/*  SRCS del CMakeLists del componente main).              */
+/***********************************************************/
+
+#ifndef PERFILADOR_H
+#define PERFILADOR_H
+
+#include <stdint.h>
+
+#ifdef PORTON_HOST
+#include "herramientas/porton_host.h"
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+#endif
+
+
+#define PERFILADOR_VENTANA_MS 5000                          //Duración de la medición si no se indica otra
+#define PERFILADOR_VENTANA_MAX_MS 60000
+#define PERFILADOR_MUESTREO_US 1000                         //Periodo del muestreo de la tarea en ejecución de cada núcleo
+#define PERFILADOR_TAREAS_MAX 24
+#define PERFILADOR_TABLA 32                                 //Pares tarea/estado distintos que se cuentan
+#define PERFILADOR_CALIENTES 8                              //Entradas más muestreadas que se reportan
+#define PERFILADOR_SEGUIDAS 2                               //Tareas cuyas muestras se separan por estado
+
+
+//Estado en curso de la máquina; se llama desde la interrupción del muestreo, tiene que estar en IRAM
+typedef int (*Perfilador_Estado_t)(void);
+
+struct PERFILADOR_CONFIG
+{
+    const char *tag;                //Etiqueta de los mensajes por serial
+    const char *topic;              //Donde se publica el resultado en JSON
+    Perfilador_Estado_t estado;
+    const char *const *nombres;     //Nombre de cada estado, las entradas se reportan como "<tarea>/<nombre>"
+    int estados;
+};
+
+
+//Prepara el muestreo y la cola de pedidos, antes de crear Perfilador_Task
+void Perfilador_Iniciar(const struct PERFILADOR_CONFIG *config);
+
+//Separa por estado las muestras de una tarea (hasta PERFILADOR_SEGUIDAS)
+void Perfilador_Seguir(TaskHandle_t tarea);
+
+//Cliente con el que se publican los resultados, sin él solo se imprimen
+void Perfilador_Cliente(esp_mqtt_client_handle_t cliente);
+
+//Pasa a Perfilador_Task un pedido recibido por MQTT; devuelve 0 si el texto no es un pedido
+int Perfilador_Pedir(const char *texto, int largo);
+
+//Tarea que atiende los pedidos por MQTT o por la consola serial
+void Perfilador_Task(void *pvParameters);
+
+#endif /* PERFILADOR_H */
@@ -0,0 +1,258 @@
+/***********************************************************/
+/*  Transporte mqtts:// con reanudación de sesión TLS de   */
+/*  los dos firmwares                                      */
+/*  (ver sesion_tls.h)                                     */
+/***********************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "sesion_tls.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_tls.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+
+
+//Sin esto esp-tls no guarda ni ofrece la sesión y cada conexión hace el handshake completo
+#if !CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#error "Sesión TLS: habilitar ESP_TLS_CLIENT_SESSION_TICKETS (ver sdkconfig.defaults)"
+#endif
+
+//La reanudación se reconoce por el secreto maestro, que TLS 1.3 no conserva entre conexiones
+#if CONFIG_MBEDTLS_SSL_PROTO_TLS1_3
+#error "Sesión TLS: la medición de reanudación es de TLS 1.2, deshabilitar MBEDTLS_SSL_PROTO_TLS1_3"
+#endif
+
+#define SESION_TLS_MAESTRA 48       //Largo del secreto maestro de TLS 1.2
+
+
+struct SESION_TLS
+{
+    portMUX_TYPE lock;              //Protege las estadísticas, el resto lo usa solo la tarea de esp-mqtt
+    esp_tls_t *tls;                 //Conexión en curso
+    esp_tls_client_session_t *sesion;   //Sesión de la última conexión, se ofrece en la siguiente
+    uint8_t maestra[SESION_TLS_MAESTRA];    //Secreto maestro de esa sesión
+    struct SESION_TLS_ESTADISTICAS estadisticas;
+};
+
+static struct SESION_TLS sesion_tls = { .lock = portMUX_INITIALIZER_UNLOCKED };
+static struct SESION_TLS_CONFIG configuracion_sesion_tls;
+
+
+//Secreto maestro de la conexión recién establecida; con la misma sesión reanudada no cambia
+static void Sesion_TLS_Maestra(esp_tls_t *tls, uint8_t maestra[SESION_TLS_MAESTRA])
+{
+    mbedtls_ssl_context *ssl = esp_tls_get_ssl_context(tls);
+
+    memset(maestra, 0, SESION_TLS_MAESTRA);
+    if (ssl != NULL && ssl->MBEDTLS_PRIVATE(session) != NULL)
+    {
+        memcpy(maestra, ssl->MBEDTLS_PRIVATE(session)->MBEDTLS_PRIVATE(master), SESION_TLS_MAESTRA);
+    }
+}
+
+//Descarta la sesión guardada: la próxima conexión hace el handshake completo
+static void Sesion_TLS_Olvidar(void)
+{
+    if (sesion_tls.sesion != NULL)
+    {
+        esp_tls_free_client_session(sesion_tls.sesion);
+        sesion_tls.sesion = NULL;
+    }
+}
+
+//Espera hasta timeout_ms a que el socket se pueda leer o escribir: 1 listo, 0 tiempo agotado, -1 error
+static int Sesion_TLS_Esperar(int escribir, int timeout_ms)
+{
+    int fd;
+    fd_set conjunto;
+    fd_set errores;
+    struct timeval espera = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+
+    if (sesion_tls.tls == NULL || esp_tls_get_conn_sockfd(sesion_tls.tls, &fd) != ESP_OK || fd < 0)
+    {
+        return -1;
+    }
+    FD_ZERO(&conjunto);
+    FD_ZERO(&errores);
+    FD_SET(fd, &conjunto);
+    FD_SET(fd, &errores);
+    int listo = select(fd + 1, escribir ? NULL : &conjunto, escribir ? &conjunto : NULL, &errores,
+                       (timeout_ms < 0) ? NULL : &espera);
+    if (listo > 0 && FD_ISSET(fd, &errores))
+    {
+        return -1;
+    }
+    return listo;
+}
+
+static int Sesion_TLS_Conectar(esp_transport_handle_t t, const char *host, int puerto, int timeout_ms)
+{
+    esp_tls_cfg_t cfg = {
+        .cacert_buf = (const unsigned char *)configuracion_sesion_tls.ca_pem,
+        .cacert_bytes = strlen(configuracion_sesion_tls.ca_pem) + 1,
+        .timeout_ms = timeout_ms,
+        .client_session = sesion_tls.sesion,
+    };
+    int ofrecida = (sesion_tls.sesion != NULL);
+    uint8_t maestra[SESION_TLS_MAESTRA];
+    int64_t inicio_us;
+    int64_t duracion_us;
+    int reanudado;
+
+    sesion_tls.tls = esp_tls_init();
+    if (sesion_tls.tls == NULL)
+    {
+        return -1;
+    }
+
+    //Incluye DNS y TCP: esp-tls los hace dentro de la misma llamada
+    inicio_us = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), puerto, &cfg, sesion_tls.tls) != 1)
+    {
+        ESP_LOGW(configuracion_sesion_tls.tag, "TLS: no se pudo conectar con %s:%d%s", host, puerto,
+                 ofrecida ? ", la próxima conexión no ofrece la sesión" : "");
+        //Una sesión que el broker ya no reconoce no debería impedir conectar; por las dudas se descarta
+        Sesion_TLS_Olvidar();
+        esp_tls_conn_destroy(sesion_tls.tls);
+        sesion_tls.tls = NULL;
+        taskENTER_CRITICAL(&sesion_tls.lock);
+        sesion_tls.estadisticas.fallidos++;
+        taskEXIT_CRITICAL(&sesion_tls.lock);
+        return -1;
+    }
+    duracion_us = esp_timer_get_time() - inicio_us;
+
+    //Con la sesión reanudada el broker no negoció claves nuevas: el secreto maestro es el mismo
+    Sesion_TLS_Maestra(sesion_tls.tls, maestra);
+    reanudado = ofrecida && memcmp(maestra, sesion_tls.maestra, SESION_TLS_MAESTRA) == 0;
+
+    //La sesión (con el ticket nuevo si el broker mandó uno) queda para la próxima conexión
+    Sesion_TLS_Olvidar();
+    sesion_tls.sesion = esp_tls_get_client_session(sesion_tls.tls);
+    memcpy(sesion_tls.maestra, maestra, SESION_TLS_MAESTRA);
+
+    taskENTER_CRITICAL(&sesion_tls.lock);
+    if (reanudado)
+    {
+        sesion_tls.estadisticas.reanudados++;
+        sesion_tls.estadisticas.reanudado_suma_us += duracion_us;
+        if (duracion_us > sesion_tls.estadisticas.reanudado_max_us)
+        {
+            sesion_tls.estadisticas.reanudado_max_us = duracion_us;
+        }
+    }
+    else
+    {
+        sesion_tls.estadisticas.completos++;
+        sesion_tls.estadisticas.completo_suma_us += duracion_us;
+        if (duracion_us > sesion_tls.estadisticas.completo_max_us)
+        {
+            sesion_tls.estadisticas.completo_max_us = duracion_us;
+        }
+    }
+    taskEXIT_CRITICAL(&sesion_tls.lock);
+
+    ESP_LOGI(configuracion_sesion_tls.tag, "TLS: handshake %s en %" PRId64 " ms%s",
+             reanudado ? "reanudado" : "completo", duracion_us / 1000,
+             (ofrecida && !reanudado) ? " (el broker no aceptó la sesión guardada)" : "");
+    return 0;
+}
+
+static int Sesion_TLS_Poll_Leer(esp_transport_handle_t t, int timeout_ms)
+{
+    //mbedtls puede tener descifrado lo que el socket ya entregó
+    if (sesion_tls.tls != NULL && esp_tls_get_bytes_avail(sesion_tls.tls) > 0)
+    {
+        return 1;
+    }
+    return Sesion_TLS_Esperar(0, timeout_ms);
+}
+
+static int Sesion_TLS_Poll_Escribir(esp_transport_handle_t t, int timeout_ms)
+{
+    return Sesion_TLS_Esperar(1, timeout_ms);
+}
+
+//Mismos códigos que el transporte SSL de ESP-IDF: 0 sin datos a tiempo, negativo conexión perdida
+static int Sesion_TLS_Leer(esp_transport_handle_t t, char *buffer, int largo, int timeout_ms)
+{
+    int listo = Sesion_TLS_Poll_Leer(t, timeout_ms);
+
+    if (listo <= 0)
+    {
+        return listo;
+    }
+    ssize_t leidos = esp_tls_conn_read(sesion_tls.tls, buffer, largo);
+    if (leidos == ESP_TLS_ERR_SSL_WANT_READ || leidos == ESP_TLS_ERR_SSL_TIMEOUT)
+    {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (leidos == 0)
+    {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return leidos;
+}
+
+static int Sesion_TLS_Escribir(esp_transport_handle_t t, const char *buffer, int largo, int timeout_ms)
+{
+    int listo = Sesion_TLS_Poll_Escribir(t, timeout_ms);
+
+    if (listo <= 0)
+    {
+        return listo;
+    }
+    ssize_t escritos = esp_tls_conn_write(sesion_tls.tls, buffer, largo);
+    if (escritos == ESP_TLS_ERR_SSL_WANT_WRITE)
+    {
+        return 0;
+    }
+    return escritos;
+}
+
+static int Sesion_TLS_Cerrar(esp_transport_handle_t t)
+{
+    //La sesión guardada sigue para la próxima conexión
+    if (sesion_tls.tls != NULL)
+    {
+        esp_tls_conn_destroy(sesion_tls.tls);
+        sesion_tls.tls = NULL;
+    }
+    return 0;
+}
+
+static int Sesion_TLS_Destruir(esp_transport_handle_t t)
+{
+    Sesion_TLS_Cerrar(t);
+    Sesion_TLS_Olvidar();
+    return 0;
+}
+
+esp_transport_handle_t Sesion_TLS_Transporte(const struct SESION_TLS_CONFIG *config)
+{
+    esp_transport_handle_t t = esp_transport_init();
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    configuracion_sesion_tls = *config;
+    esp_transport_set_func(t, Sesion_TLS_Conectar, Sesion_TLS_Leer, Sesion_TLS_Escribir, Sesion_TLS_Cerrar,
+                           Sesion_TLS_Poll_Leer, Sesion_TLS_Poll_Escribir, Sesion_TLS_Destruir);
+    esp_transport_set_default_port(t, SESION_TLS_PUERTO);
+    return t;
+}
+
+void Sesion_TLS_Estadisticas(struct SESION_TLS_ESTADISTICAS *estadisticas)
+{
+    taskENTER_CRITICAL(&sesion_tls.lock);
+    *estadisticas = sesion_tls.estadisticas;
+    taskEXIT_CRITICAL(&sesion_tls.lock);
+}
@@ -0,0 +1,64 @@
+/***********************************************************/
+/*  Transporte mqtts:// con reanudación de sesión TLS de   */
+/*  los dos firmwares                                      */
+/*                                                         */
+/*  esp-mqtt lo recibe en network.transport en lugar de su */
+/*  transporte SSL. Está hecho sobre esp-tls y guarda la   */
+/*  sesión de cada conexión (esp_tls_get_client_session)   */
+/*  para ofrecerla en la siguiente: si el broker la acepta */
+/*  (ticket de sesión o identificador de sesión) la        */
+/*  reconexión se ahorra el intercambio de claves y la     */
+/*  verificación del certificado.                          */
+/*                                                         */
+/*  El broker se verifica solo contra la CA fijada         */
+/*  (broker_ca.pem). Cada handshake se mide y se cuenta    */
+/*  como completo o reanudado.                             */
+/*                                                         */
+/*  La sesión vive en RAM: sobrevive a las reconexiones,   */
+/*  no a un reinicio (ningún firmware usa deep sleep).     */
+/*                                                         */
+/*  sesion_tls.c se compila junto a cada firmware (va en   */
+/*  SRCS del CMakeLists del componente main).              */
+/***********************************************************/
+
+#ifndef SESION_TLS_H
+#define SESION_TLS_H
+
+#include <stdint.h>
+
+#ifdef PORTON_HOST
+#include "herramientas/porton_host.h"
+#else
+#include "esp_transport.h"
+#endif
+
+
+#define SESION_TLS_PUERTO 8883                      //Puerto si la URL no trae uno
+
+
+struct SESION_TLS_CONFIG
+{
+    const char *tag;                //Etiqueta de los mensajes por serial
+    const char *ca_pem;             //CA fijada del broker, PEM terminado en '\0' (EMBED_TXTFILES)
+};
+
+//Handshakes TLS medidos desde que arrancó el firmware
+struct SESION_TLS_ESTADISTICAS
+{
+    uint32_t completos;
+    uint32_t reanudados;
+    uint32_t fallidos;              //Conexiones que no llegaron a terminar el handshake
+    int64_t completo_suma_us;
+    int64_t completo_max_us;
+    int64_t reanudado_suma_us;
+    int64_t reanudado_max_us;
+};
+
+
+//Crea el transporte para network.transport de esp_mqtt_client_config_t; NULL si no hay memoria
+esp_transport_handle_t Sesion_TLS_Transporte(const struct SESION_TLS_CONFIG *config);
+
+//Copia de las estadísticas actuales
+void Sesion_TLS_Estadisticas(struct SESION_TLS_ESTADISTICAS *estadisticas);
+
+#endif /* SESION_TLS_H */